@@ -15,9 +15,25 @@
 */
 #pragma once
 
+#include <memory>
+#include <strings.h>
+#include "ColumnarDecoder.hpp"
 #include "CommandLine.hpp"
 #include "Connection.hpp"
-#include "ServerChallenge.hpp"
+#include "ConnectionSettings.hpp"
+#include "Deadline.hpp"
+#include "Handshake.hpp"
+#include "IoUring.hpp"
+#include "LazyResult.hpp"
+#include "ParallelDecoder.hpp"
+#include "PrefetchingCursor.hpp"
+#include "PreparedStatementCache.hpp"
+#include "RandomAccessCursor.hpp"
+#include "ResponseParser.hpp"
+#include "ResultLifecycle.hpp"
+#include "ResultRegistry.hpp"
+#include "SpillStore.hpp"
+#include "Transport.hpp"
 
 namespace MonetExplorer {
     /**
@@ -26,7 +42,21 @@ namespace MonetExplorer {
     class Client {
         private:
             CommandLine::Arguments &args;
+            std::unique_ptr<Transport> transport;     // Must be destroyed after the connection
             Connection connection;
+            ResultLifecycle lifecycle;                  // Closes the results of the cursors
+            ResponseParser parser;
+            ColumnarDecoder decoder;
+            ColumnarResult columnar;
+            ResultRegistry registry;
+            MaterializationPolicy policy;
+            LazyResult lazy;
+            std::unique_ptr<ParallelDecoder> parallel;  // Only for multiple decoder threads
+            SegmentedResult segmented;
+            std::unique_ptr<PrefetchingCursor> cursor;  // Only if the queries are paginated
+            std::unique_ptr<RandomAccessCursor> browser; // Only if the results are browsed
+            std::unique_ptr<SpillStore> spill;          // Only if the pages of the cursor are stored
+            std::unique_ptr<PreparedStatementCache> prepared;   // Only if the prepared statements are cached
 
             /**
              * @brief Format a message for the console output.
@@ -37,10 +67,10 @@ namespace MonetExplorer {
              * @param isSent True = sent to the server, False = received from it.
              * @param output Most probably std::cout.
              */
-            void PrintFormatted(const std::string &msg, bool isSent, std::ostream &output) {
+            void PrintFormatted(StringView msg, bool isSent, std::ostream &output) {
                 int mb_remain = 0;  // Bytes remaining from a multi-byte character
-                const char *pos = msg.c_str();
-                const char *endPos = pos + msg.length();
+                const char *pos = msg.data;
+                const char *endPos = pos + msg.length;
                 char c = ' ';
 
                 if (isSent) {
@@ -132,27 +162,586 @@ namespace MonetExplorer {
                 }
             }
 
+            /**
+             * @brief Print the transfer counters of the connection.
+             * 
+             * @param output Most probably std::cout.
+             */
+            void PrintStats(std::ostream &output) {
+                const TransferStats &stats = this->connection.GetStats();
+
+                output << "\033[32mStats:\033[0m " << stats.messagesReceived << " messages, "
+                    << stats.packetsReceived << " packets, " << stats.bytesReceived << " bytes received, "
+                    << stats.bytesCopied << " bytes copied (" << stats.GetCopiesPerByte()
+                    << " per received byte), " << stats.arenaGrowths << " arena growths, "
+                    << stats.readCalls << " read calls, " << stats.messagesSent << " messages and "
+                    << stats.packetsSent << " packets sent in " << stats.writeCalls << " write calls, "
+                    << this->connection.GetTransport().GetSystemCalls() << " system calls by the "
+                    << this->connection.GetTransport().GetName() << " transport\n";
+
+                output << "\033[32mSocket:\033[0m " << this->connection.GetSocketTuning().Describe(
+                    this->connection.GetSocket()) << '\n';
+
+                const LifecycleStats &lifecycle = this->lifecycle.GetStats();
+                output << "\033[32mLifecycle:\033[0m " << lifecycle.closes << " Xclose and " << lifecycle.releases
+                    << " Xrelease sent, " << lifecycle.pipelined << " of them with a request, " << lifecycle.flushes
+                    << " own round trips, " << lifecycle.failures << " failed, " << this->lifecycle.GetPendingCount()
+                    << " queued\n";
+            }
+
+            /**
+             * @brief Print the columns of a result with the values of its
+             * first row, materialized lazily.
+             *
+             * @param result
+             * @param output
+             */
+            void PrintLazy(const ParsedResult &result, std::ostream &output) {
+                this->lazy.Load(result);
+                output << " (" << this->lazy.GetRowCount() << " rows indexed)\n";
+
+                for (size_t j = 0; j < this->lazy.GetColumnCount(); j++) {
+                    output << "    " << this->lazy.GetColumnName(j) << " -> "
+                        << GetColumnTypeName(this->lazy.GetColumnType(j));
+
+                    if (this->lazy.GetRowCount() > 0) {
+                        if (this->lazy.IsNull(0, j)) {
+                            output << ", first value NULL";
+                        } else {
+                            output << ", first value '" << this->lazy.GetString(0, j).ToString() << "'";
+                        }
+                    }
+
+                    output << '\n';
+                }
+
+                const LazyStats &stats = this->lazy.GetStats();
+                output << "    Rows parsed: " << stats.rowsParsed << ", strings unescaped: "
+                    << stats.stringsUnescaped << " (since the start)\n";
+            }
+
+            /**
+             * @brief Print the columns of a result decoded on multiple threads.
+             *
+             * @param result
+             * @param output
+             */
+            void PrintSegmented(const ParsedResult &result, std::ostream &output) {
+                this->parallel->Decode(result, this->segmented);
+
+                if (result.tupleCount > 0) {
+                    output << " (decoded into " << this->segmented.GetSegmentCount() << " segments, "
+                        << this->segmented.GetMemoryUsage() << " bytes by " << this->parallel->GetThreadCount()
+                        << " threads)";
+                }
+
+                output << '\n';
+
+                for (size_t j = 0; j < result.columns.size(); j++) {
+                    const ColumnInfo &info = result.columns[j];
+                    int scale;
+
+                    output << "    " << info.tableName.ToString() << "." << info.name.ToString()
+                        << " " << info.type.ToString() << "(" << info.length << ") -> "
+                        << GetColumnTypeName(GetColumnType(info, scale));
+
+                    if (this->segmented.GetSegmentCount() > 0) {
+                        output << ", " << this->segmented.GetNullCount(j) << " NULLs";
+                    }
+
+                    output << '\n';
+                }
+            }
+
+            /**
+             * @brief Execute a query through the prefetching cursor,
+             * and print the sizes of the decoded pages.
+             *
+             * @param query Without the 's' prefix.
+             * @param output
+             */
+            void PrintPaginated(StringView query, std::ostream &output) {
+                try {
+                    if (!this->cursor->Open(query, (size_t)this->args.GetIntValue("prefetch"))) {
+                        output << "\033[32mNo result set.\033[0m\n";
+                        return;
+                    }
+
+                    output << "\033[32mResult " << this->cursor->GetResultId() << ":\033[0m "
+                        << this->cursor->GetTotalRowCount() << " rows\n";
+
+                    if (this->spill) {
+                        this->spill->Clear();
+                    }
+
+                    for (size_t page = 1; this->cursor->NextBatch() != nullptr; page++) {
+                        output << "    Page " << page << ": " << this->cursor->GetBatch().GetRowCount()
+                            << " rows from row " << this->cursor->GetRowNumber() << '\n';
+
+                        if (this->spill) {
+                            this->spill->Append(this->cursor->GetBatch());
+                        }
+                    }
+
+                    const CursorStats &stats = this->cursor->GetStats();
+                    output << "\033[32mCursor:\033[0m " << stats.pages << " pages, " << stats.rows << " rows, "
+                        << stats.bytes << " bytes, " << stats.stallUs << " us stalled on the network, "
+                        << stats.networkUs << " us of requests and " << stats.idleUs
+                        << " us waiting for a free buffer on the I/O thread\n";
+
+                    if (this->args.GetIntValue("page-bytes") > 0) {
+                        const PageSizeController &controller = this->cursor->GetPageSizeController();
+
+                        output << "\033[32mPage size:\033[0m " << controller.GetBytesPerRow() << " bytes per row, "
+                            << (uint64_t)(controller.GetRoundTrip() * 1000000) << " us round trip, "
+                            << (uint64_t)(controller.GetThroughput() / 1048576) << " MiB/s, next page "
+                            << controller.GetPageBytes() << " bytes\n";
+                    }
+
+                    if (this->spill) {
+                        this->PrintSpilled(output);
+                    }
+                } catch (const std::runtime_error &err) {
+                    output << "\033[31mError:\033[0m " << err.what() << '\n';
+                }
+            }
+
+            /**
+             * @brief Read back the stored pages of the last result,
+             * and print the state of the spill store.
+             *
+             * @param output
+             */
+            void PrintSpilled(std::ostream &output) {
+                SegmentView view;
+                uint64_t rows = 0;
+                uint64_t nulls = 0;
+
+                for (size_t i = 0; i < this->spill->GetSegmentCount(); i++) {
+                    this->spill->Read(i, view);
+                    rows += view.GetRowCount();
+
+                    for (size_t j = 0; j < view.GetColumnCount(); j++) {
+                        nulls += view.GetColumn(j).GetNullCount();
+                    }
+                }
+
+                const SpillStats &stats = this->spill->GetStats();
+                output << "\033[32mSpill:\033[0m " << stats.segmentsInMemory << " pages in memory ("
+                    << this->spill->GetMemoryUsage() << " bytes), " << stats.segmentsSpilled << " pages on disk ("
+                    << this->spill->GetFileSize() << " bytes, " << stats.writeCalls << " writes), " << rows
+                    << " rows and " << nulls << " NULL values read back\n";
+            }
+
+            /**
+             * @brief Format a decoded value. The dates and times
+             * are printed as their stored numbers.
+             *
+             * @param column
+             * @param row
+             * @return std::string
+             */
+            static std::string FormatValue(const Column &column, size_t row) {
+                if (column.IsNull(row)) {
+                    return "NULL";
+                }
+
+                switch (column.GetType()) {
+                    case ColumnType::Boolean: return column.GetValues<bool>()[row] ? "true" : "false";
+                    case ColumnType::TinyInt: return std::to_string(column.GetValues<int8_t>()[row]);
+                    case ColumnType::SmallInt: return std::to_string(column.GetValues<int16_t>()[row]);
+                    case ColumnType::Int: return std::to_string(column.GetValues<int32_t>()[row]);
+                    case ColumnType::BigInt: return std::to_string(column.GetValues<int64_t>()[row]);
+                    case ColumnType::HugeInt: return ValueParser::FormatHugeInt(column.GetValues<HugeInt>()[row]);
+                    case ColumnType::Decimal:
+                        return ValueParser::FormatDecimal(column.GetValues<HugeInt>()[row], column.GetScale());
+                    case ColumnType::Double: return std::to_string(column.GetValues<double>()[row]);
+                    case ColumnType::Date: return std::to_string(column.GetValues<int32_t>()[row]) + " days";
+                    case ColumnType::Time:
+                    case ColumnType::Timestamp: return std::to_string(column.GetValues<int64_t>()[row]) + " us";
+                    case ColumnType::String: return "'" + column.GetString(row).ToString() + "'";
+                }
+
+                return "";
+            }
+
+            /**
+             * @brief Execute a query through the random-access cursor.
+             *
+             * @param query Without the 's' prefix.
+             * @param output
+             */
+            void OpenBrowser(StringView query, std::ostream &output) {
+                try {
+                    if (!this->browser->Open(query, (size_t)this->args.GetIntValue("browse"))) {
+                        output << "\033[32mNo result set.\033[0m\n";
+                        return;
+                    }
+
+                    output << "\033[32mResult " << this->browser->GetResultId() << ":\033[0m "
+                        << this->browser->GetTotalRowCount() << " rows in " << this->browser->GetPageCount()
+                        << " pages. Enter @row to show a row.\n";
+                } catch (const std::runtime_error &err) {
+                    output << "\033[31mError:\033[0m " << err.what() << '\n';
+                }
+            }
+
+            /**
+             * @brief Print a row of the browsed result, and the state of the page cache.
+             *
+             * @param row The row number, as entered.
+             * @param output
+             */
+            void PrintBrowsedRow(const std::string &row, std::ostream &output) {
+                try {
+                    if (!this->browser->IsOpen()) {
+                        throw std::runtime_error("No result is browsed.");
+                    }
+
+                    size_t end = 0;
+                    uint64_t number = std::stoull(row, &end);
+                    if (end != row.length()) {
+                        throw std::invalid_argument(row);
+                    }
+
+                    size_t index;
+                    const ColumnarResult &page = this->browser->GetRow(number, index);
+                    output << "\033[32mRow " << number << ":\033[0m\n";
+
+                    for (size_t j = 0; j < page.GetColumnCount(); j++) {
+                        output << "    " << page.GetColumn(j).GetName() << " = "
+                            << FormatValue(page.GetColumn(j), index) << '\n';
+                    }
+
+                    const PageCacheStats &stats = this->browser->GetStats();
+                    output << "\033[32mCache:\033[0m " << this->browser->GetCachedPageCount() << " pages in "
+                        << this->browser->GetCachedBytes() << " bytes, " << stats.hits << " hits, " << stats.misses
+                        << " misses, " << stats.requests << " requests, " << stats.pagesReadAhead << " pages read ahead, "
+                        << stats.evictions << " evictions\n";
+                } catch (const std::logic_error &) {
+                    output << "\033[31mError:\033[0m Invalid row number: " << row << '\n';
+                } catch (const std::runtime_error &err) {
+                    output << "\033[31mError:\033[0m " << err.what() << '\n';
+                }
+            }
+
+            /**
+             * @brief Prepare a query through the prepared statement cache.
+             *
+             * @param query Without the 's' prefix and PREPARE.
+             * @param output
+             */
+            void PrintPrepared(StringView query, std::ostream &output) {
+                try {
+                    bool cached;
+                    int64_t id = this->prepared->Prepare(query, cached);
+                    const PreparedCacheStats &stats = this->prepared->GetStats();
+
+                    output << "\033[32mPrepared statement " << id << ":\033[0m " << (cached ? "cached" : "prepared")
+                        << ". Cache: " << this->prepared->GetCount() << " statements, " << stats.hits << " hits, "
+                        << stats.misses << " misses, " << stats.evictions << " evictions\n";
+                } catch (const std::runtime_error &err) {
+                    output << "\033[31mError:\033[0m " << err.what() << '\n';
+                }
+            }
+
+            /**
+             * @brief Decode a result of a response message, and print
+             * the summary of its columns.
+             *
+             * @param result
+             * @param output
+             * @throw runtime_error On invalid values, or if the parse plan
+             * doesn't match the columns of the result.
+             */
+            void PrintResult(const ParsedResult &result, std::ostream &output) {
+                if (this->policy == MaterializationPolicy::Lazy) {
+                    this->PrintLazy(result, output);
+                    return;
+                }
+
+                /*
+                    The pages of the results which don't fit into the message
+                    are decoded through the registry below, on a single thread,
+                    so that their &6 blocks can be appended.
+                */
+                bool paged = result.status.type == ResponseType::Block || (result.status.type == ResponseType::Table
+                    && result.status.totalRowCount > (int64_t)result.tupleCount);
+
+                if (this->parallel && !paged) {
+                    this->PrintSegmented(result, output);
+                    return;
+                }
+
+                /*
+                    The result sets are registered, so that the &6 blocks
+                    of their Xexport commands are decoded into them.
+                */
+                if (result.status.type == ResponseType::Block
+                    && this->registry.Find(result.status.resultId) == nullptr) {
+
+                    output << " (unknown result)\n";
+                    return;
+                }
+
+                const ParsedResult *header = &result;
+                const ColumnarResult *decoded = &this->columnar;
+                RegisteredResult *registered = this->registry.Process(result);
+
+                if (registered != nullptr) {
+                    header = &registered->GetHeader();
+                    decoded = &registered->GetResult();
+                } else {
+                    this->decoder.Decode(result, this->columnar);
+                }
+
+                if (result.tupleCount > 0) {
+                    output << " (decoded into " << decoded->GetMemoryUsage() << " bytes by the "
+                        << GetKernelName(this->decoder.GetKernel()) << " kernel)";
+                }
+
+                if (registered != nullptr) {
+                    output << ", page " << registered->GetPageCount() << " of result "
+                        << registered->GetResultId() << " with " << decoded->GetRowCount() << " rows so far";
+
+                    if (registered->GetRejectedRowCount() > 0) {
+                        output << " (" << registered->GetRejectedRowCount() << " filtered out)";
+                    }
+
+                    if (registered->IsComplete()) {
+                        output << ", complete";
+                    }
+                }
+
+                output << '\n';
+
+                for (size_t j = 0; j < decoded->GetColumnCount(); j++) {
+                    const Column &column = decoded->GetColumn(j);
+                    const ColumnInfo &info = header->columns[column.GetIndex()];
+
+                    output << "    " << info.tableName.ToString() << "." << info.name.ToString()
+                        << " " << info.type.ToString() << "(" << info.length << ") -> "
+                        << GetColumnTypeName(column.GetType());
+
+                    if (column.GetType() == ColumnType::Decimal) {
+                        output << ", scale " << column.GetScale();
+                    }
+
+                    if (column.IsDictionaryEncoded()) {
+                        output << ", dictionary of " << column.GetDictionarySize() << " values ("
+                            << column.GetMemoryUsage() << " bytes instead of " << column.GetPlainMemoryUsage() << ")";
+                    }
+
+                    output << ", " << column.GetNullCount() << " NULLs\n";
+                }
+
+                // No more blocks can arrive for a complete result.
+                if (registered != nullptr && registered->IsComplete()) {
+                    this->registry.Remove(registered->GetResultId());
+                }
+            }
+
+            /**
+             * @brief Print a summary of the results of a response message.
+             *
+             * @param msg A complete response message.
+             * @param output Most probably std::cout.
+             */
+            void PrintParsed(StringView msg, std::ostream &output) {
+                try {
+                    this->parser.Parse(msg);
+                } catch (const std::runtime_error &err) {
+                    output << "\033[31mError:\033[0m " << err.what() << '\n';
+                    return;
+                }
+
+                for (size_t i = 0; i < this->parser.GetResultCount(); i++) {
+                    const ParsedResult &result = this->parser.GetResult(i);
+                    const StatusRecord &status = result.status;
+
+                    output << "\033[32mResult " << (i + 1) << ":\033[0m type &" << (int)status.type;
+
+                    if (status.resultId > -1) {
+                        output << ", result id " << status.resultId;
+                    }
+
+                    if (status.totalRowCount > -1) {
+                        output << ", " << status.totalRowCount << " rows in total";
+                    }
+
+                    if (status.affectedRows > -1) {
+                        output << ", " << status.affectedRows << " affected rows";
+                    }
+
+                    if (status.queryTimeUs > -1) {
+                        output << ", query time " << status.queryTimeUs << " us";
+                    }
+
+                    output << ", " << result.tupleCount << " tuples in the message";
+
+                    // An error only affects its own result.
+                    try {
+                        this->PrintResult(result, output);
+                    } catch (const std::runtime_error &err) {
+                        output << "\n\033[31mError:\033[0m " << err.what() << '\n';
+                    }
+                }
+
+                if (this->parser.HasError()) {
+                    output << "\033[31mError:\033[0m " << this->parser.GetError().ToString();
+                }
+            }
+
+            /**
+             * @brief Remove a result set from the registry,
+             * if the user closed it with an Xclose command.
+             *
+             * @param msg The sent message.
+             * @param response The response to it.
+             */
+            void ForgetClosedResult(const std::string &msg, StringView response) {
+                int64_t resultId;
+
+                if (msg.compare(0, 7, "Xclose ") != 0 || response.StartsWith("!")) {
+                    return;
+                }
+
+                size_t end = msg.find_last_not_of(" \r\n");
+                if (end > 6 && ResponseParser::ParseInt(StringView(msg.data() + 7, end - 6), resultId)) {
+                    this->registry.Remove(resultId);
+                }
+            }
+
         public:
             /**
              * @brief Construct a new Client object
              * 
              * @param args Command line arguments.
              */
-            Client(CommandLine::Arguments &args) : args(args), connection() { }
+            Client(CommandLine::Arguments &args) : args(args), connection(), lifecycle(connection) {
+                if (args.GetIntValue("read-ahead") < 0) {
+                    throw std::runtime_error("The read-ahead size cannot be negative.");
+                }
+
+                this->connection.SetReadAheadSize(args.GetIntValue("read-ahead"));
+                this->policy = ParseMaterializationPolicy(args.GetStringValue("materialize"));
+
+                if (args.GetIntValue("decode-threads") < 0) {
+                    throw std::runtime_error("The number of the decoder threads cannot be negative.");
+                }
+
+                if (args.GetIntValue("dictionary") < 0) {
+                    throw std::runtime_error("The dictionary size limit cannot be negative.");
+                }
+
+                this->decoder.SetMaxDictionarySize((size_t)args.GetIntValue("dictionary"));
+                this->registry.SetMaxDictionarySize((size_t)args.GetIntValue("dictionary"));
+
+                ParsePlan plan;
+                for (const std::string &name : args.GetStringValueList("select")) {
+                    plan.Select(name);
+                }
+
+                for (const std::string &condition : args.GetStringValueList("where")) {
+                    plan.Where(condition);
+                }
+
+                this->registry.SetParsePlan(plan);
+
+                if (args.GetIntValue("browse") < 0 || args.GetIntValue("page-cache") <= 0) {
+                    throw std::runtime_error("The page size of the browsing cannot be negative, "
+                        "and the page cache limit must be positive.");
+                }
+
+                if (args.GetIntValue("browse") > 0) {
+                    PageCacheSettings settings;
+                    settings.maxBytes = (size_t)args.GetIntValue("page-cache");
+
+                    this->browser.reset(new RandomAccessCursor(this->connection, settings));
+                    this->browser->SetLifecycle(this->lifecycle);
+                    this->browser->SetMaxDictionarySize((size_t)args.GetIntValue("dictionary"));
+                }
+
+                if (args.GetIntValue("prefetch") < 0) {
+                    throw std::runtime_error("The page size of the cursor cannot be negative.");
+                }
+
+                if (args.GetIntValue("prefetch") > 0) {
+                    this->cursor.reset(new PrefetchingCursor(this->connection));
+                    this->cursor->SetLifecycle(this->lifecycle);
+                    this->cursor->SetParsePlan(plan);
+                    this->cursor->SetMaxDictionarySize((size_t)args.GetIntValue("dictionary"));
+
+                    if (args.GetIntValue("page-bytes") < 0 || args.GetIntValue("page-memory") <= 0) {
+                        throw std::runtime_error("The page size target cannot be negative, "
+                            "and the page memory limit must be positive.");
+                    }
+
+                    if (args.GetIntValue("spill") < 0) {
+                        throw std::runtime_error("The memory budget of the spill store cannot be negative.");
+                    }
+
+                    if (args.GetIntValue("spill") > 0) {
+                        SpillSettings settings;
+                        settings.memoryBudget = (size_t)args.GetIntValue("spill");
+                        this->spill.reset(new SpillStore(settings));
+                    }
+
+                    if (args.GetIntValue("page-bytes") > 0) {
+                        PageSizeSettings settings;
+                        settings.targetPageBytes = (size_t)args.GetIntValue("page-bytes");
+                        settings.maxBufferedBytes = (size_t)args.GetIntValue("page-memory");
+                        this->cursor->SetAdaptivePageSize(settings);
+                    }
+                }
+
+                if (args.GetIntValue("prepared-cache") < 0) {
+                    throw std::runtime_error("The size of the prepared statement cache cannot be negative.");
+                }
+
+                if (args.GetIntValue("prepared-cache") > 0) {
+                    this->prepared.reset(new PreparedStatementCache(this->lifecycle,
+                        (size_t)args.GetIntValue("prepared-cache")));
+                }
+
+                if (args.GetIntValue("decode-threads") != 1) {
+                    this->parallel.reset(new ParallelDecoder((size_t)args.GetIntValue("decode-threads")));
+                    this->parallel->SetMaxDictionarySize((size_t)args.GetIntValue("dictionary"));
+                }
+
+                std::string transportName = args.GetStringValue("transport");
+                if (transportName == "io_uring") {
+#ifdef MONET_EXPLORER_IO_URING
+                    this->transport.reset(new UringTransport());
+                    this->connection.SetTransport(*this->transport);
+#else
+                    throw std::runtime_error("This build has no io_uring support. (Requires Linux 6.0+ headers.)");
+#endif
+                } else if (transportName != "socket") {
+                    throw std::runtime_error("Invalid transport: '" + transportName + "'. "
+                        "The supported values are: socket, io_uring.");
+                }
+            }
 
             /**
              * @brief Start the client application.
              */
             void Start() {
-                if (args.GetStringValue("database") == "") {
+                ConnectionSettings settings = ConnectionSettings::FromArguments(this->args);
+
+                if (settings.database == "") {
                     throw std::runtime_error("Please specify a database to connect to.");
                 }
 
                 /*
                     Connect to the server
                 */
-                if (args.IsOptionSet("unix-domain-socket")) {
-                    std::string socketFilePath("/tmp/.s.monetdb." + std::to_string(args.GetIntValue("port")));
+                this->connection.SetSocketTuning(settings.tuning);
+                this->connection.SetTimeout(settings.timeoutMs);
+                this->connection.SetDeadline(Deadline::After(settings.connectTimeoutMs));
+
+                if (settings.unixDomainSocket) {
+                    std::string socketFilePath = settings.GetSocketFilePath();
                     std::cout << "\033[32mConnecting through Unix domain socket to " << socketFilePath << ".\033[0m\n";
 
                     this->connection.ConnectUnix(socketFilePath);
@@ -160,52 +749,36 @@ namespace MonetExplorer {
                     std::cout << "\033[32mSending the init byte 0x30 ('0') to the server.\033[0m\n";
                     this->connection.SendUnixDomainSocketInitByte();
                 } else {
-                    std::cout << "\033[32mConnecting through TCP/IP to: " << args.GetStringValue("host") << ':'
-                        << args.GetIntValue("port") << "\033[0m\n";
+                    std::cout << "\033[32mConnecting through TCP/IP to: " << settings.host << ':'
+                        << settings.port << "\033[0m\n";
 
-                    this->connection.ConnectTCP(
-                        args.GetStringValue("host"),
-                        args.GetIntValue("port")
-                    );
+                    this->connection.ConnectTCP(settings.host, settings.port);
                 }
 
-                std::cout << "\033[32mConnected.\033[0m\n";
+                std::cout << "\033[32mConnected. Socket: " << this->connection.GetSocketTuning().Describe(
+                    this->connection.GetSocket()) << "\033[0m\n";
                 std::string msg;
 
                 /*
                     Authentication
                 */
-                for (int i = 0; i <= 10; i++) {
-                    if (i == 10) {
-                        throw std::runtime_error("Authentication failed: Too many Merovingian redirects.");
-                    }
+                Handshake handshake(settings);
+                std::string reply;
 
+                while (true) {
                     msg = this->connection.ReceiveMessage();
                     this->PrintFormatted(msg, false, std::cout);
 
-                    if (msg.rfind("^mapi:merovingian:", 0) == 0) {
-                        // Merovingian redirect
-                        continue;
-                    } else if (msg == "") {
-                        // Successful authentication
+                    HandshakeStep step = handshake.Process(msg, reply);
+                    if (step == HandshakeStep::Authenticated) {
                         break;
-                    } else if (msg.rfind("!", 0) == 0) {
-                        throw std::runtime_error("Authentication failed: " + msg);
+                    } else if (step == HandshakeStep::SendReply) {
+                        this->PrintFormatted(reply, true, std::cout);
+                        this->connection.SendMessage(reply);
                     }
-
-                    ServerChallenge challenge(msg);
-                    msg = challenge.Authenticate(
-                        args.GetStringValue("user"),
-                        args.GetStringValue("password"),
-                        args.GetStringValue("database"),
-                        args.GetStringValue("auth-algo"),
-                        args.IsOptionSet("file-transfer")
-                    );
-                    this->PrintFormatted(msg, true, std::cout);
-
-                    this->connection.SendMessage(msg);
                 }
 
+                this->connection.SetDeadline(Deadline::Never());
                 std::cout << "\033[32mAuthenticated.\033[0m\n";
 
                 /*
@@ -224,10 +797,44 @@ namespace MonetExplorer {
                     }
                     
                     msg = multiLine.str();
-                    this->connection.SendMessage(msg);
 
-                    msg = this->connection.ReceiveMessage();
-                    this->PrintFormatted(msg, false, std::cout);
+                    if (this->prepared && msg.length() > 9 && strncasecmp(msg.c_str(), "sPREPARE ", 9) == 0) {
+                        this->PrintPrepared(StringView(msg.data() + 9, msg.length() - 9), std::cout);
+                        continue;
+                    }
+
+                    if (this->browser && msg.length() > 1 && msg[0] == '@') {
+                        this->PrintBrowsedRow(msg.substr(1, msg.length() - 2), std::cout);
+                        continue;
+                    }
+
+                    if (this->browser && msg.length() > 1 && msg[0] == 's') {
+                        this->OpenBrowser(StringView(msg.data() + 1, msg.length() - 1), std::cout);
+                        continue;
+                    }
+
+                    if (this->cursor && msg.length() > 1 && msg[0] == 's') {
+                        this->PrintPaginated(StringView(msg.data() + 1, msg.length() - 1), std::cout);
+
+                        if (args.IsOptionSet("stats")) {
+                            this->PrintStats(std::cout);
+                        }
+
+                        continue;
+                    }
+
+                    // The queued Xclose and Xrelease commands are sent along.
+                    StringView response = this->lifecycle.Execute(msg);
+                    this->PrintFormatted(response, false, std::cout);
+                    this->ForgetClosedResult(msg, response);
+
+                    if (args.IsOptionSet("decode")) {
+                        this->PrintParsed(response, std::cout);
+                    }
+
+                    if (args.IsOptionSet("stats")) {
+                        this->PrintStats(std::cout);
+                    }
                 } while (this->connection.IsConnected());
 
                 std::cout << "\033[32mServer disconnected.\033[0m\n";
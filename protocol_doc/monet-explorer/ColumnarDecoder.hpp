@@ -0,0 +1,1063 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "ColumnarResult.hpp"
+#include "FieldDecoders.hpp"
+#include "ParsePlan.hpp"
+#include "ResponseParser.hpp"
+#include "SimdKernel.hpp"
+#include "StringView.hpp"
+#include "TupleSplitter.hpp"
+#include "Unescaper.hpp"
+#include "ValueParser.hpp"
+
+
+namespace MonetExplorer {
+    /**
+     * @brief Get the storage type of a column from its header.
+     *
+     * @param info
+     * @param scale Output: the scale of the decimals, from the 'typesizes'
+     * header if present, otherwise -1 (taken from the first value).
+     * @return ColumnType
+     */
+    inline ColumnType GetColumnType(const ColumnInfo &info, int &scale) {
+        ColumnType type = GetColumnType(info.type, scale);
+
+        // The 'typesizes' header contains the precision and the scale.
+        if (type == ColumnType::Decimal && !info.typeSizes.IsEmpty()) {
+            const char *space = (const char*)memchr(info.typeSizes.data, ' ', info.typeSizes.length);
+            int64_t value;
+
+            if (space != nullptr && ResponseParser::ParseInt(StringView(space + 1,
+                info.typeSizes.data + info.typeSizes.length - space - 1), value)) {
+
+                scale = (int)value;
+            }
+        }
+
+        return type;
+    }
+
+    /**
+     * @brief How the decoder selects the parser of the fields.
+     */
+    enum class DecoderDispatch : int {
+        PerField = 1,   // Row by row, a switch on the type of each field
+        PerColumn = 2   // Column by column, with a loop specialized for the type
+    };
+
+    /**
+     * @brief Decodes the tuples of a result directly into typed columns,
+     * based on the types in the header. The pages of a result (the &1
+     * response and the &6 blocks) are appended to the same columns.
+     * The type of a column is known from the header, so by default the
+     * decoding function of each column is selected once, from a table of
+     * loops generated for each type (see: FieldDecoders.hpp), and the
+     * pages are decoded column by column.
+     * Optionally the string columns are dictionary encoded, until the
+     * number of their distinct values exceeds a limit. Then the column
+     * is converted to plain strings, and decoded as such.
+     * A parse plan can restrict the decoding to some of the columns, and
+     * to the rows matching its predicates. (See: ParsePlan.hpp)
+     * Not thread safe: use one instance per thread.
+     */
+    class ColumnarDecoder {
+        private:
+            /**
+             * @brief Decodes a column of a block of rows of the current page.
+             */
+            typedef void (ColumnarDecoder::*ColumnFunction)(Column &column, size_t index, size_t pageRow,
+                size_t rowCount, size_t firstRow, const char *data);
+
+            /**
+             * @brief The pages are decoded in blocks of this many rows, column by
+             * column inside the blocks, so that the text of a block stays in the
+             * cache until all of its columns are decoded.
+             */
+            static const size_t ROW_BLOCK = 128;
+
+            /**
+             * @brief The hash table of a dictionary encoded column. The
+             * entries themselves are stored in the column.
+             */
+            struct Dictionary {
+                /**
+                 * @brief A slot of the hash table. The hash is stored here rather
+                 * than with the entry, to save a dependent load at each probe.
+                 */
+                struct Slot {
+                    uint32_t hash;
+                    uint32_t code;                  // Code + 1, or 0 for empty
+                };
+
+                std::vector<Slot> slots;            // Open addressing
+                size_t size = 0;                    // The number of the entries
+            };
+
+            /**
+             * @brief The initial number of the hash slots. (Power of 2)
+             */
+            static const size_t DICTIONARY_SLOTS = 64;
+
+            /**
+             * @brief The largest scale of the decimals. (10^38 still fits into a HugeInt.)
+             */
+            static const int MAX_DECIMAL_SCALE = 38;
+
+            /**
+             * @brief A bound of a range predicate, parsed by the type of the column.
+             */
+            struct Bound {
+                HugeInt integer = 0;                // All the types, except double
+                double real = 0;                    // Double only
+                int scale = 0;                      // Decimal only
+                bool present = false;
+            };
+
+            struct BoundPredicate;
+
+            /**
+             * @brief Evaluates a predicate on a field.
+             */
+            typedef bool (ColumnarDecoder::*PredicateFunction)(BoundPredicate &predicate, const FieldSpan &span,
+                const char *data);
+
+            /**
+             * @brief A predicate of the plan, bound to the type of its column.
+             */
+            struct BoundPredicate {
+                std::string name;
+                size_t column = 0;                  // The index in the tuples
+                PredicateFunction match = nullptr;
+                Bound low;
+                Bound high;
+                int scale = -1;                     // Decimal only: the scale of the values. -1 until known.
+                std::string prefix;
+            };
+
+            /**
+             * @brief Binds a range predicate to a type.
+             */
+            typedef void (*RangeBinder)(BoundPredicate &bound, const Predicate &predicate);
+
+            TupleSplitter splitter;
+            Unescaper unescaper;
+            SplitPage page;
+            DecoderDispatch dispatch;
+            size_t maxDictionarySize = 0;
+            std::vector<ColumnFunction> bound;      // For each column
+            std::vector<Dictionary> dictionaries;   // For each column
+            size_t sourceColumnCount = 0;           // The number of the fields in the tuples
+            bool planned = false;
+            std::vector<size_t> projection;         // Planned only: the source of each output column
+            std::vector<BoundPredicate> predicates;
+            std::vector<FieldSpan> projected;       // The spans of the accepted rows and the selected columns
+            std::vector<char> scratch;              // For unescaping the strings of the prefix predicates
+            uint64_t rejectedRows = 0;
+
+            /**
+             * @brief Throw an exception about an invalid value.
+             *
+             * @param column
+             * @param field
+             */
+            [[noreturn]] static void ThrowInvalidValue(const Column &column, StringView field) {
+                throw std::runtime_error("Invalid " + column.sqlType + " value in column '" + column.name
+                    + "': " + field.ToString());
+            }
+
+            /**
+             * @brief Decode a non-NULL value of a fixed-width column.
+             *
+             * @tparam Type
+             * @param column
+             * @param row
+             * @param field The raw field.
+             */
+            template<ColumnType Type>
+            static inline void DecodeValue(Column &column, size_t row, StringView field) {
+                typedef FieldDecoder<Type> Decoder;
+                typename Decoder::Value *values = (typename Decoder::Value*)column.values.data();
+
+                field = ValueParser::Unquote(field);
+
+                if (!Decoder::Decode(field, column.scale, values[row])) {
+                    ThrowInvalidValue(column, field);
+                }
+            }
+
+            /**
+             * @brief Decode a non-NULL value of a string column.
+             *
+             * @param column
+             * @param row
+             * @param field The raw field.
+             * @param escaped True if the field contains a backslash.
+             */
+            inline void DecodeString(Column &column, size_t row, StringView field, bool escaped) {
+                StringView text = ValueParser::Unquote(field);
+                size_t start = column.bytes.size();
+
+                if (escaped && text.length < field.length) {
+                    column.bytes.resize(start + text.length);
+                    column.bytes.resize(start + this->unescaper.Unescape(text.data, text.length, &column.bytes[start]));
+                } else {
+                    column.bytes.insert(column.bytes.end(), text.data, text.data + text.length);
+                }
+
+                column.offsets[row + 1] = column.bytes.size();
+            }
+
+            /**
+             * @brief Hash a string for the dictionaries. Processes 8 bytes
+             * at a time, because the values are mostly short. The last word
+             * is read overlapping with the previous one, instead of a
+             * variable length copy.
+             *
+             * @param data
+             * @param length
+             * @return uint32_t
+             */
+            static inline uint32_t HashString(const char *data, size_t length) {
+                const uint64_t multiplier = 0x9E3779B97F4A7C15ULL;
+                uint64_t hash = length * multiplier;
+                uint64_t word = 0;
+
+                if (length >= 8) {
+                    const char *last = data + length - 8;
+
+                    for (; data < last; data += 8) {
+                        memcpy(&word, data, 8);
+                        hash = (hash ^ word) * multiplier;
+                        hash ^= hash >> 29;
+                    }
+
+                    memcpy(&word, last, 8);
+                } else {
+                    for (size_t i = 0; i < length; i++) {
+                        word |= (uint64_t)(unsigned char)data[i] << (i * 8);
+                    }
+                }
+
+                hash = (hash ^ word) * multiplier;
+
+                /*
+                    The finalizer of MurmurHash3. The values often differ only
+                    in their last characters, which are in the high bits of the
+                    last word, while the slots are selected by the low bits.
+                */
+                hash ^= hash >> 33;
+                hash *= 0xFF51AFD7ED558CCDULL;
+                hash ^= hash >> 33;
+                hash *= 0xC4CEB9FE1A85EC53ULL;
+                hash ^= hash >> 33;
+
+                return (uint32_t)hash;
+            }
+
+            /**
+             * @brief Double the hash slots of a dictionary.
+             *
+             * @param dictionary
+             */
+            static void Rehash(Dictionary &dictionary) {
+                std::vector<Dictionary::Slot> previous(dictionary.slots.size() * 2, Dictionary::Slot());
+                previous.swap(dictionary.slots);
+                size_t mask = dictionary.slots.size() - 1;
+
+                for (const Dictionary::Slot &entry : previous) {
+                    if (entry.code == 0) {
+                        continue;
+                    }
+
+                    size_t slot = entry.hash & mask;
+
+                    while (dictionary.slots[slot].code != 0) {
+                        slot = (slot + 1) & mask;
+                    }
+
+                    dictionary.slots[slot] = entry;
+                }
+            }
+
+            /**
+             * @brief Convert a dictionary encoded column to plain strings.
+             *
+             * @param column
+             * @param index The index of the column.
+             * @param rows The number of the rows already decoded.
+             */
+            void Expand(Column &column, size_t index, size_t rows) {
+                std::vector<size_t> offsets(column.codes.size() + 1, 0);
+                std::vector<char> bytes;
+                bytes.reserve(column.valueBytes);
+
+                for (size_t row = 0; row < rows; row++) {
+                    if (!column.IsNull(row)) {
+                        uint32_t code = column.codes[row];
+                        bytes.insert(bytes.end(), column.bytes.data() + column.offsets[code],
+                            column.bytes.data() + column.offsets[code + 1]);
+                    }
+
+                    offsets[row + 1] = bytes.size();
+                }
+
+                column.offsets.swap(offsets);
+                column.bytes.swap(bytes);
+                std::vector<uint32_t>().swap(column.codes);
+                column.dictionary = false;
+                column.valueBytes = 0;
+
+                std::vector<Dictionary::Slot>().swap(this->dictionaries[index].slots);
+                this->dictionaries[index].size = 0;
+                this->bound[index] = &ColumnarDecoder::DecodeStringColumn;
+            }
+
+            /**
+             * @brief Decode a single field into a column, dispatching on its type.
+             *
+             * @param column
+             * @param row
+             * @param field The raw field.
+             * @param escaped True if the field contains a backslash.
+             */
+            void DecodeField(Column &column, size_t row, StringView field, bool escaped) {
+                if (ResponseParser::IsNull(field)) {
+                    column.nullCount++;
+
+                    if (column.type == ColumnType::String) {
+                        column.offsets[row + 1] = column.bytes.size();
+                    }
+
+                    return;
+                }
+
+                column.SetValid(row);
+
+                switch (column.type) {
+                    case ColumnType::Boolean: DecodeValue<ColumnType::Boolean>(column, row, field); break;
+                    case ColumnType::TinyInt: DecodeValue<ColumnType::TinyInt>(column, row, field); break;
+                    case ColumnType::SmallInt: DecodeValue<ColumnType::SmallInt>(column, row, field); break;
+                    case ColumnType::Int: DecodeValue<ColumnType::Int>(column, row, field); break;
+                    case ColumnType::BigInt: DecodeValue<ColumnType::BigInt>(column, row, field); break;
+                    case ColumnType::HugeInt: DecodeValue<ColumnType::HugeInt>(column, row, field); break;
+                    case ColumnType::Decimal: DecodeValue<ColumnType::Decimal>(column, row, field); break;
+                    case ColumnType::Double: DecodeValue<ColumnType::Double>(column, row, field); break;
+                    case ColumnType::Date: DecodeValue<ColumnType::Date>(column, row, field); break;
+                    case ColumnType::Time: DecodeValue<ColumnType::Time>(column, row, field); break;
+                    case ColumnType::Timestamp: DecodeValue<ColumnType::Timestamp>(column, row, field); break;
+                    default: this->DecodeString(column, row, field, escaped); break;
+                }
+            }
+
+            /**
+             * @brief Decode a fixed-width column of the current page.
+             *
+             * @tparam Type
+             * @param column
+             * @param index The index of the column.
+             * @param pageRow The first row of the block inside the page.
+             * @param rowCount The number of rows in the block.
+             * @param firstRow The row of the column where the page starts.
+             * @param data The start of the page.
+             */
+            template<ColumnType Type>
+            void DecodeFixedColumn(Column &column, size_t index, size_t pageRow, size_t rowCount, size_t firstRow,
+                const char *data) {
+                typedef FieldDecoder<Type> Decoder;
+
+                /*
+                    The members are copied into locals, because the stores of
+                    the values could alias them, which would force reloading.
+                */
+                typename Decoder::Value *values = (typename Decoder::Value*)column.values.data();
+                uint64_t *validity = column.validity.data();
+                size_t nullCount = 0;
+                int scale = column.scale;
+
+                const size_t stride = this->page.columnCount;
+                const FieldSpan *span = this->page.fields.data() + pageRow * stride + index;
+                const size_t end = firstRow + pageRow + rowCount;
+
+                for (size_t row = firstRow + pageRow; row < end; row++, span += stride) {
+                    StringView field(data + span->offset, span->length);
+
+                    if (ResponseParser::IsNull(field)) {
+                        nullCount++;
+                        continue;
+                    }
+
+                    validity[row >> 6] |= 1ULL << (row & 63);
+                    field = ValueParser::Unquote(field);
+
+                    if (!Decoder::Decode(field, scale, values[row])) {
+                        column.scale = scale;
+                        ThrowInvalidValue(column, field);
+                    }
+                }
+
+                column.nullCount += nullCount;
+                column.scale = scale;
+            }
+
+            /**
+             * @brief Decode a string column of the current page.
+             *
+             * @param column
+             * @param index The index of the column.
+             * @param pageRow The first row of the block inside the page.
+             * @param rowCount The number of rows in the block.
+             * @param firstRow The row of the column where the page starts.
+             * @param data The start of the page.
+             */
+            void DecodeStringColumn(Column &column, size_t index, size_t pageRow, size_t rowCount, size_t firstRow,
+                const char *data) {
+                const size_t stride = this->page.columnCount;
+                const FieldSpan *span = this->page.fields.data() + pageRow * stride + index;
+                const size_t end = firstRow + pageRow + rowCount;
+
+                for (size_t row = firstRow + pageRow; row < end; row++, span += stride) {
+                    StringView field(data + span->offset, span->length);
+
+                    if (ResponseParser::IsNull(field)) {
+                        column.nullCount++;
+                        column.offsets[row + 1] = column.bytes.size();
+                        continue;
+                    }
+
+                    column.SetValid(row);
+                    this->DecodeString(column, row, field, span->escaped);
+                }
+            }
+
+            /**
+             * @brief Decode a dictionary encoded string column of the current
+             * page. Each value is unescaped to the end of the entries, and
+             * removed from there if it is already in the dictionary.
+             *
+             * @param column
+             * @param index The index of the column.
+             * @param pageRow The first row of the block inside the page.
+             * @param rowCount The number of rows in the block.
+             * @param firstRow The row of the column where the page starts.
+             * @param data The start of the page.
+             */
+            void DecodeDictionaryColumn(Column &column, size_t index, size_t pageRow, size_t rowCount,
+                size_t firstRow, const char *data) {
+                Dictionary &dictionary = this->dictionaries[index];
+                const size_t stride = this->page.columnCount;
+                const FieldSpan *span = this->page.fields.data() + pageRow * stride + index;
+                const size_t end = firstRow + pageRow + rowCount;
+
+                for (size_t row = firstRow + pageRow; row < end; row++, span += stride) {
+                    StringView field(data + span->offset, span->length);
+
+                    if (ResponseParser::IsNull(field)) {
+                        column.nullCount++;
+                        column.codes[row] = 0;
+                        continue;
+                    }
+
+                    StringView text = ValueParser::Unquote(field);
+                    size_t start = column.bytes.size();
+                    bool escaped = span->escaped && text.length < field.length;
+                    const char *value = text.data;
+                    size_t length = text.length;
+
+                    // Only the escaped values are copied before the lookup.
+                    if (escaped) {
+                        column.bytes.resize(start + text.length);
+                        length = this->unescaper.Unescape(text.data, text.length, &column.bytes[start]);
+                        column.bytes.resize(start + length);
+                        value = column.bytes.data() + start;
+                    }
+
+                    uint32_t hash = HashString(value, length);
+                    size_t mask = dictionary.slots.size() - 1;
+                    size_t slot = hash & mask;
+                    bool found = false;
+
+                    while (dictionary.slots[slot].code != 0) {
+                        uint32_t code = dictionary.slots[slot].code - 1;
+
+                        if (dictionary.slots[slot].hash == hash && column.offsets[code + 1] - column.offsets[code] == length
+                            && memcmp(column.bytes.data() + column.offsets[code], value, length) == 0) {
+
+                            column.codes[row] = code;
+                            found = true;
+                            break;
+                        }
+
+                        slot = (slot + 1) & mask;
+                    }
+
+                    if (found) {
+                        column.bytes.resize(start);
+                    } else if (dictionary.size >= this->maxDictionarySize) {
+                        // Too many distinct values: continue as plain strings
+                        column.bytes.resize(start);
+                        this->Expand(column, index, row);
+                        this->DecodeStringColumn(column, index, row - firstRow, end - row, firstRow, data);
+                        return;
+                    } else {
+                        if (!escaped) {
+                            column.bytes.insert(column.bytes.end(), text.data, text.data + text.length);
+                        }
+
+                        column.codes[row] = (uint32_t)dictionary.size;
+                        dictionary.slots[slot].hash = hash;
+                        dictionary.slots[slot].code = (uint32_t)++dictionary.size;
+                        column.offsets.push_back(column.bytes.size());
+
+                        if (dictionary.size * 2 > dictionary.slots.size()) {
+                            Rehash(dictionary);
+                        }
+                    }
+
+                    column.SetValid(row);
+                    column.valueBytes += length;
+                }
+            }
+
+            /**
+             * @brief Get 10^exponent.
+             *
+             * @param exponent
+             * @return HugeInt
+             */
+            static HugeInt Power10(int exponent) {
+                HugeInt result = 1;
+
+                for (int i = 0; i < exponent; i++) {
+                    result *= 10;
+                }
+
+                return result;
+            }
+
+            /**
+             * @brief Compare a value to a bound. The decimals are compared by
+             * their integer parts first, then by their fractions converted to
+             * the same scale. (Converting the whole values could overflow.)
+             *
+             * @tparam T An integer type.
+             * @param value
+             * @param scale The scale of the value. (0 for the non-decimals)
+             * @param bound
+             * @return int Negative, zero or positive.
+             */
+            template<typename T>
+            static inline int Compare(T value, int scale, const Bound &bound) {
+                HugeInt left = (HugeInt)value;
+                HugeInt right = bound.integer;
+
+                if (scale != bound.scale) {
+                    HugeInt leftUnit = Power10(scale);
+                    HugeInt rightUnit = Power10(bound.scale);
+
+                    if (left / leftUnit != right / rightUnit) {
+                        left /= leftUnit;
+                        right /= rightUnit;
+                    } else if (scale < bound.scale) {
+                        // The fractions keep the signs, and stay below 10^38 when rescaled.
+                        left = left % leftUnit * Power10(bound.scale - scale);
+                        right %= rightUnit;
+                    } else {
+                        left %= leftUnit;
+                        right = right % rightUnit * Power10(scale - bound.scale);
+                    }
+                }
+
+                return left < right ? -1 : (left > right ? 1 : 0);
+            }
+
+            static inline int Compare(double value, int, const Bound &bound) {
+                return value < bound.real ? -1 : (value > bound.real ? 1 : 0);
+            }
+
+            template<typename T>
+            static void SetBound(Bound &bound, T value, int scale) {
+                bound.integer = (HugeInt)value;
+                bound.scale = scale;
+                bound.present = true;
+            }
+
+            static void SetBound(Bound &bound, double value, int) {
+                bound.real = value;
+                bound.present = true;
+            }
+
+            /**
+             * @brief Parse a bound of a range predicate.
+             *
+             * @tparam Type The storage type of the column.
+             * @param text Empty for no bound.
+             * @param predicate
+             * @param bound Output.
+             */
+            template<ColumnType Type>
+            static void ParseBound(const std::string &text, const BoundPredicate &predicate, Bound &bound) {
+                typename FieldDecoder<Type>::Value value;
+                int scale = -1;
+
+                if (text.empty()) {
+                    return;
+                }
+
+                if (!FieldDecoder<Type>::Decode(StringView(text), scale, value)) {
+                    throw std::runtime_error("Invalid value in the condition on column '" + predicate.name
+                        + "': " + text);
+                }
+
+                SetBound(bound, value, Type == ColumnType::Decimal ? scale : 0);
+            }
+
+            /**
+             * @brief Bind a range predicate to the type of its column.
+             *
+             * @tparam Type
+             * @param bound
+             * @param predicate
+             */
+            template<ColumnType Type>
+            static void BindRange(BoundPredicate &bound, const Predicate &predicate) {
+                ParseBound<Type>(predicate.low, bound, bound.low);
+                ParseBound<Type>(predicate.high, bound, bound.high);
+                bound.match = &ColumnarDecoder::MatchRange<Type>;
+            }
+
+            /**
+             * @brief Evaluate a range predicate.
+             *
+             * @tparam Type The storage type of the column.
+             * @param predicate
+             * @param span
+             * @param data The start of the page.
+             * @return bool
+             */
+            template<ColumnType Type>
+            bool MatchRange(BoundPredicate &predicate, const FieldSpan &span, const char *data) {
+                StringView field(data + span.offset, span.length);
+                typename FieldDecoder<Type>::Value value;
+
+                if (ResponseParser::IsNull(field)) {
+                    return false;
+                }
+
+                field = ValueParser::Unquote(field);
+                if (!FieldDecoder<Type>::Decode(field, predicate.scale, value)) {
+                    throw std::runtime_error("Invalid value in column '" + predicate.name + "': " + field.ToString());
+                }
+
+                int scale = Type == ColumnType::Decimal ? predicate.scale : 0;
+
+                return (!predicate.low.present || Compare(value, scale, predicate.low) >= 0)
+                    && (!predicate.high.present || Compare(value, scale, predicate.high) <= 0);
+            }
+
+            /**
+             * @brief Evaluate a prefix predicate. The strings are only
+             * unescaped if they contain escape sequences.
+             *
+             * @param predicate
+             * @param span
+             * @param data The start of the page.
+             * @return bool
+             */
+            bool MatchPrefix(BoundPredicate &predicate, const FieldSpan &span, const char *data) {
+                StringView field(data + span.offset, span.length);
+
+                if (ResponseParser::IsNull(field)) {
+                    return false;
+                }
+
+                StringView text = ValueParser::Unquote(field);
+
+                if (span.escaped && text.length < field.length) {
+                    this->scratch.resize(text.length);
+                    text.length = this->unescaper.Unescape(text.data, text.length, this->scratch.data());
+                    text.data = this->scratch.data();
+                }
+
+                return text.length >= predicate.prefix.length()
+                    && memcmp(text.data, predicate.prefix.data(), predicate.prefix.length()) == 0;
+            }
+
+            /**
+             * @brief Get the range binder of a type.
+             *
+             * @param type
+             * @return RangeBinder
+             */
+            static RangeBinder GetRangeBinder(ColumnType type) {
+                static const RangeBinder table[] = {
+                    nullptr,
+                    &ColumnarDecoder::BindRange<ColumnType::Boolean>,
+                    &ColumnarDecoder::BindRange<ColumnType::TinyInt>,
+                    &ColumnarDecoder::BindRange<ColumnType::SmallInt>,
+                    &ColumnarDecoder::BindRange<ColumnType::Int>,
+                    &ColumnarDecoder::BindRange<ColumnType::BigInt>,
+                    &ColumnarDecoder::BindRange<ColumnType::HugeInt>,
+                    &ColumnarDecoder::BindRange<ColumnType::Decimal>,
+                    &ColumnarDecoder::BindRange<ColumnType::Double>,
+                    &ColumnarDecoder::BindRange<ColumnType::Date>,
+                    &ColumnarDecoder::BindRange<ColumnType::Time>,
+                    &ColumnarDecoder::BindRange<ColumnType::Timestamp>,
+                    nullptr
+                };
+
+                return table[(int)type];
+            }
+
+            /**
+             * @brief Find a column of a result by name.
+             *
+             * @param result
+             * @param name
+             * @return size_t
+             * @throw runtime_error If not found.
+             */
+            static size_t FindColumn(const ParsedResult &result, const std::string &name) {
+                for (size_t i = 0; i < result.columns.size(); i++) {
+                    const StringView &columnName = result.columns[i].name;
+
+                    if (columnName.length == name.length() && memcmp(columnName.data, name.data(), name.length()) == 0) {
+                        return i;
+                    }
+                }
+
+                throw std::runtime_error("The result has no column named '" + name + "'.");
+            }
+
+            /**
+             * @brief Filter the rows of the current page by the predicates,
+             * and keep only the spans of the selected columns.
+             *
+             * @param data The start of the page.
+             */
+            void ApplyPlan(const char *data) {
+                const size_t stride = this->page.columnCount;
+                const size_t width = this->projection.size();
+                const FieldSpan *row = this->page.fields.data();
+
+                this->projected.resize(this->page.rowCount * width);
+                FieldSpan *out = this->projected.data();
+                size_t accepted = 0;
+
+                for (size_t i = 0; i < this->page.rowCount; i++, row += stride) {
+                    bool match = true;
+
+                    for (BoundPredicate &predicate : this->predicates) {
+                        if (!(this->*predicate.match)(predicate, row[predicate.column], data)) {
+                            match = false;
+                            break;
+                        }
+                    }
+
+                    if (!match) {
+                        continue;
+                    }
+
+                    for (size_t j = 0; j < width; j++) {
+                        *out++ = row[this->projection[j]];
+                    }
+
+                    accepted++;
+                }
+
+                this->rejectedRows += this->page.rowCount - accepted;
+                this->projected.resize(accepted * width);
+                this->page.fields.swap(this->projected);
+                this->page.columnCount = width;
+                this->page.rowCount = accepted;
+            }
+
+            /**
+             * @brief Get the decoding function of a type, from the table
+             * of the specialized loops.
+             *
+             * @param type
+             * @return ColumnFunction
+             */
+            static ColumnFunction GetColumnFunction(ColumnType type) {
+                static const ColumnFunction table[] = {
+                    nullptr,
+                    &ColumnarDecoder::DecodeFixedColumn<ColumnType::Boolean>,
+                    &ColumnarDecoder::DecodeFixedColumn<ColumnType::TinyInt>,
+                    &ColumnarDecoder::DecodeFixedColumn<ColumnType::SmallInt>,
+                    &ColumnarDecoder::DecodeFixedColumn<ColumnType::Int>,
+                    &ColumnarDecoder::DecodeFixedColumn<ColumnType::BigInt>,
+                    &ColumnarDecoder::DecodeFixedColumn<ColumnType::HugeInt>,
+                    &ColumnarDecoder::DecodeFixedColumn<ColumnType::Decimal>,
+                    &ColumnarDecoder::DecodeFixedColumn<ColumnType::Double>,
+                    &ColumnarDecoder::DecodeFixedColumn<ColumnType::Date>,
+                    &ColumnarDecoder::DecodeFixedColumn<ColumnType::Time>,
+                    &ColumnarDecoder::DecodeFixedColumn<ColumnType::Timestamp>,
+                    &ColumnarDecoder::DecodeStringColumn
+                };
+
+                return table[(int)type];
+            }
+
+            /**
+             * @brief Set up the output columns, and bind their decoding functions.
+             *
+             * @param result
+             * @param output
+             */
+            void Setup(const ParsedResult &result, ColumnarResult &output) {
+                size_t columnCount = this->planned ? this->projection.size() : result.columns.size();
+
+                output.columns.resize(columnCount);
+                output.rowCount = 0;
+                this->sourceColumnCount = result.columns.size();
+                this->bound.resize(columnCount);
+                this->dictionaries.resize(columnCount);
+
+                // Only the tuples of the message: the total row count of a paged
+                // result can be much larger. With predicates, it is only an upper bound.
+                size_t expectedRows = this->predicates.empty() ? result.tupleCount : 0;
+
+                for (size_t i = 0; i < columnCount; i++) {
+                    const ColumnInfo &info = result.columns[this->planned ? this->projection[i] : i];
+                    Column &column = output.columns[i];
+
+                    column.index = this->planned ? this->projection[i] : i;
+                    column.name = info.name.ToString();
+                    column.tableName = info.tableName.ToString();
+                    column.sqlType = info.type.ToString();
+                    column.type = GetColumnType(info, column.scale);
+                    column.rowCount = 0;
+                    column.nullCount = 0;
+                    column.values.clear();
+                    column.offsets.clear();
+                    column.bytes.clear();
+                    column.codes.clear();
+                    column.validity.clear();
+                    column.valueBytes = 0;
+                    column.dictionary = column.type == ColumnType::String && this->maxDictionarySize > 0
+                        && this->dispatch == DecoderDispatch::PerColumn;
+
+                    if (column.dictionary) {
+                        column.codes.reserve(expectedRows);
+                        column.offsets.push_back(0);
+                        this->dictionaries[i].slots.assign(DICTIONARY_SLOTS, Dictionary::Slot());
+                        this->dictionaries[i].size = 0;
+                    } else if (column.type == ColumnType::String) {
+                        column.offsets.reserve(expectedRows + 1);
+                    } else {
+                        column.values.reserve(expectedRows * GetColumnTypeSize(column.type));
+                    }
+
+                    column.Resize(0);
+                    this->bound[i] = column.dictionary ? &ColumnarDecoder::DecodeDictionaryColumn
+                        : GetColumnFunction(column.type);
+                }
+            }
+
+        public:
+            /**
+             * @brief Construct a new ColumnarDecoder object
+             *
+             * @param kernel The SIMD kernel of the splitting and unescaping.
+             * @param dispatch PerField is only kept as a baseline for measurements.
+             */
+            ColumnarDecoder(SimdKernel kernel = GetBestKernel(), DecoderDispatch dispatch = DecoderDispatch::PerColumn)
+                : splitter(kernel), unescaper(kernel), dispatch(dispatch) { }
+
+            /**
+             * @brief Get the SIMD kernel in use.
+             *
+             * @return SimdKernel
+             */
+            SimdKernel GetKernel() const {
+                return this->splitter.GetKernel();
+            }
+
+            /**
+             * @brief Enable the dictionary encoding of the string columns.
+             * Only used with the PerColumn dispatch. Applies from the next
+             * Begin() call.
+             *
+             * @param maxSize The maximal number of distinct values in a
+             * dictionary. 0 disables the encoding.
+             */
+            void SetMaxDictionarySize(size_t maxSize) {
+                if (maxSize > UINT32_MAX) {
+                    throw std::runtime_error("The dictionary size limit cannot exceed 2^32 - 1.");
+                }
+
+                this->maxDictionarySize = maxSize;
+            }
+
+            /**
+             * @brief Set up the columns of a result, from its header.
+             * The previous content of the output is discarded, but the
+             * allocations are reused.
+             *
+             * @param result A parsed &1 (or &5) response.
+             * @param output
+             */
+            void Begin(const ParsedResult &result, ColumnarResult &output) {
+                this->planned = false;
+                this->projection.clear();
+                this->predicates.clear();
+                this->Setup(result, output);
+            }
+
+            /**
+             * @brief Set up the columns of a result, with a parse plan.
+             * Only the selected columns are in the output, in the order of
+             * the selection, and only the rows matching the predicates.
+             *
+             * @param result A parsed &1 (or &5) response.
+             * @param output
+             * @param plan
+             * @throw runtime_error If the plan doesn't match the columns.
+             */
+            void Begin(const ParsedResult &result, ColumnarResult &output, const ParsePlan &plan) {
+                this->projection.clear();
+                this->predicates.clear();
+
+                for (const std::string &name : plan.GetColumns()) {
+                    this->projection.push_back(FindColumn(result, name));
+                }
+
+                if (this->projection.empty()) {
+                    for (size_t i = 0; i < result.columns.size(); i++) {
+                        this->projection.push_back(i);
+                    }
+                }
+
+                for (const Predicate &predicate : plan.GetPredicates()) {
+                    BoundPredicate bound;
+                    bound.name = predicate.column;
+                    bound.column = FindColumn(result, predicate.column);
+
+                    ColumnType type = MonetExplorer::GetColumnType(result.columns[bound.column], bound.scale);
+
+                    if (predicate.type == PredicateType::Prefix) {
+                        if (type != ColumnType::String) {
+                            throw std::runtime_error("Prefix condition on the non-string column '"
+                                + predicate.column + "'.");
+                        }
+
+                        bound.prefix = predicate.prefix;
+                        bound.match = &ColumnarDecoder::MatchPrefix;
+                    } else {
+                        if (type == ColumnType::String) {
+                            throw std::runtime_error("Range condition on the string column '"
+                                + predicate.column + "'.");
+                        }
+
+                        if (type == ColumnType::Decimal && bound.scale > MAX_DECIMAL_SCALE) {
+                            throw std::runtime_error("Range condition on the column '" + predicate.column
+                                + "', whose scale is larger than " + std::to_string(MAX_DECIMAL_SCALE) + ".");
+                        }
+
+                        GetRangeBinder(type)(bound, predicate);
+                    }
+
+                    this->predicates.push_back(bound);
+                }
+
+                this->planned = true;
+                this->Setup(result, output);
+            }
+
+            /**
+             * @brief Get the number of the rows dropped by the predicates
+             * of the parse plans, since the construction.
+             *
+             * @return uint64_t
+             */
+            uint64_t GetRejectedRowCount() const {
+                return this->rejectedRows;
+            }
+
+            /**
+             * @brief Decode a page of tuples, and append them to the columns.
+             *
+             * @param tuples The tuple lines of a &1 response or a &6 block.
+             * @param output Initialized by Begin(). Its content is unspecified
+             * after an exception.
+             * @throw runtime_error On invalid tuples or values.
+             */
+            void Append(StringView tuples, ColumnarResult &output) {
+                if (output.columns.empty() || tuples.IsEmpty()) {
+                    return;
+                }
+
+                this->splitter.Split(tuples, this->sourceColumnCount, this->page);
+
+                if (this->planned) {
+                    this->ApplyPlan(tuples.data);
+                }
+
+                size_t firstRow = output.rowCount;
+                size_t rowCount = firstRow + this->page.rowCount;
+                size_t columnCount = output.columns.size();
+
+                for (Column &column : output.columns) {
+                    column.Resize(rowCount);
+                }
+
+                if (this->dispatch == DecoderDispatch::PerColumn) {
+                    for (size_t block = 0; block < this->page.rowCount; block += ROW_BLOCK) {
+                        size_t blockRows = std::min(ROW_BLOCK, this->page.rowCount - block);
+
+                        for (size_t i = 0; i < columnCount; i++) {
+                            (this->*this->bound[i])(output.columns[i], i, block, blockRows, firstRow, tuples.data);
+                        }
+                    }
+                } else {
+                    const FieldSpan *span = this->page.fields.data();
+
+                    for (size_t row = firstRow; row < rowCount; row++) {
+                        for (size_t i = 0; i < columnCount; i++, span++) {
+                            this->DecodeField(output.columns[i], row,
+                                StringView(tuples.data + span->offset, span->length), span->escaped);
+                        }
+                    }
+                }
+
+                for (Column &column : output.columns) {
+                    column.rowCount = rowCount;
+                }
+
+                output.rowCount = rowCount;
+            }
+
+            /**
+             * @brief Decode a complete result.
+             *
+             * @param result
+             * @param output
+             */
+            void Decode(const ParsedResult &result, ColumnarResult &output) {
+                this->Begin(result, output);
+                this->Append(result.tuples, output);
+            }
+    };
+}
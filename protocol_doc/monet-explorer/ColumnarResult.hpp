@@ -0,0 +1,466 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "StringView.hpp"
+#include "ValueParser.hpp"
+
+
+namespace MonetExplorer {
+    /**
+     * @brief The storage types of the columns.
+     */
+    enum class ColumnType : int {
+        Boolean = 1,    // bool
+        TinyInt = 2,    // int8_t
+        SmallInt = 3,   // int16_t
+        Int = 4,        // int32_t
+        BigInt = 5,     // int64_t
+        HugeInt = 6,    // HugeInt (128 bits)
+        Decimal = 7,    // HugeInt: the unscaled value
+        Double = 8,     // double
+        Date = 9,       // int32_t: days since 1970-01-01
+        Time = 10,      // int64_t: microseconds since midnight (UTC for 'timetz')
+        Timestamp = 11, // int64_t: microseconds since 1970-01-01 00:00:00 (UTC for 'timestamptz')
+        String = 12     // Offsets + bytes
+    };
+
+    /**
+     * @brief Get the storage type of an SQL type. The types
+     * which have no native representation are stored as strings.
+     *
+     * @param sqlType The type from the '% ... # type' header line.
+     * @param scale Output: the scale implied by the type, or -1 if unknown.
+     * @return ColumnType
+     */
+    inline ColumnType GetColumnType(StringView sqlType, int &scale) {
+        std::string type = sqlType.ToString();
+        scale = -1;
+
+        if (type == "boolean") {
+            return ColumnType::Boolean;
+        } else if (type == "tinyint") {
+            return ColumnType::TinyInt;
+        } else if (type == "smallint") {
+            return ColumnType::SmallInt;
+        } else if (type == "int" || type == "month_interval") {
+            return ColumnType::Int;
+        } else if (type == "bigint" || type == "oid") {
+            return ColumnType::BigInt;
+        } else if (type == "hugeint") {
+            return ColumnType::HugeInt;
+        } else if (type == "decimal") {
+            return ColumnType::Decimal;
+        } else if (type == "sec_interval" || type == "day_interval") {
+            scale = 3;
+            return ColumnType::Decimal;
+        } else if (type == "double" || type == "real" || type == "float") {
+            return ColumnType::Double;
+        } else if (type == "date") {
+            return ColumnType::Date;
+        } else if (type == "time" || type == "timetz") {
+            return ColumnType::Time;
+        } else if (type == "timestamp" || type == "timestamptz") {
+            return ColumnType::Timestamp;
+        }
+
+        return ColumnType::String;
+    }
+
+    /**
+     * @brief Get the name of a storage type.
+     *
+     * @param type
+     * @return const char*
+     */
+    inline const char *GetColumnTypeName(ColumnType type) {
+        switch (type) {
+            case ColumnType::Boolean: return "boolean";
+            case ColumnType::TinyInt: return "int8";
+            case ColumnType::SmallInt: return "int16";
+            case ColumnType::Int: return "int32";
+            case ColumnType::BigInt: return "int64";
+            case ColumnType::HugeInt: return "int128";
+            case ColumnType::Decimal: return "decimal";
+            case ColumnType::Double: return "double";
+            case ColumnType::Date: return "date";
+            case ColumnType::Time: return "time";
+            case ColumnType::Timestamp: return "timestamp";
+            default: return "string";
+        }
+    }
+
+    /**
+     * @brief Get the size of the values of a fixed-width type.
+     *
+     * @param type
+     * @return size_t 0 for strings.
+     */
+    inline size_t GetColumnTypeSize(ColumnType type) {
+        switch (type) {
+            case ColumnType::Boolean: return sizeof(bool);
+            case ColumnType::TinyInt: return sizeof(int8_t);
+            case ColumnType::SmallInt: return sizeof(int16_t);
+            case ColumnType::Int: return sizeof(int32_t);
+            case ColumnType::BigInt: return sizeof(int64_t);
+            case ColumnType::HugeInt: return sizeof(HugeInt);
+            case ColumnType::Decimal: return sizeof(HugeInt);
+            case ColumnType::Double: return sizeof(double);
+            case ColumnType::Date: return sizeof(int32_t);
+            case ColumnType::Time: return sizeof(int64_t);
+            case ColumnType::Timestamp: return sizeof(int64_t);
+            default: return 0;
+        }
+    }
+
+    /**
+     * @brief A read-only view of a contiguous array.
+     *
+     * @tparam T
+     */
+    template<typename T>
+    struct Span {
+        const T *data = nullptr;
+        size_t size = 0;
+
+        Span() { }
+        Span(const T *data, size_t size) : data(data), size(size) { }
+
+        const T &operator[](size_t index) const {
+            return this->data[index];
+        }
+
+        const T *begin() const {
+            return this->data;
+        }
+
+        const T *end() const {
+            return this->data + this->size;
+        }
+    };
+
+    /**
+     * @brief A column of a result, decoded into a typed contiguous array.
+     * The strings are stored as an offset array (one more item than the
+     * rows) and a byte array. The NULL values have their bit cleared in
+     * the validity bitmap, and are stored as zero (or as empty strings).
+     * Dictionary encoded string columns store a code for each row, and
+     * the distinct values in the offset and byte arrays.
+     */
+    class Column {
+        friend class ColumnarDecoder;
+
+        private:
+            std::string name;
+            std::string tableName;
+            std::string sqlType;
+            size_t index = 0;               // The position of the column in the tuples
+            ColumnType type = ColumnType::String;
+            int scale = -1;                 // Decimal only. -1 until known.
+            size_t rowCount = 0;
+            size_t nullCount = 0;
+            std::vector<char> values;       // Fixed-width types. (Aligned for 16 bytes by the allocator.)
+            std::vector<size_t> offsets;    // Strings only
+            std::vector<char> bytes;        // Strings only
+            std::vector<uint32_t> codes;    // Dictionary encoded strings only. 0 for NULL.
+            bool dictionary = false;
+            size_t valueBytes = 0;          // Dictionary encoded strings only: the total length of the values
+            std::vector<uint64_t> validity; // Bit 'i % 64' of item 'i / 64' is 1 for non-NULL values
+
+            /**
+             * @brief Make room for more rows.
+             *
+             * @param rows The new row count.
+             */
+            void Resize(size_t rows) {
+                if (this->dictionary) {
+                    this->codes.resize(rows);
+                } else if (this->type == ColumnType::String) {
+                    this->offsets.resize(rows + 1, this->bytes.size());
+                } else {
+                    this->values.resize(rows * GetColumnTypeSize(this->type));
+                }
+
+                this->validity.resize((rows + 63) / 64, 0);
+            }
+
+            /**
+             * @brief Mark a value as not NULL.
+             *
+             * @param row
+             */
+            inline void SetValid(size_t row) {
+                this->validity[row >> 6] |= 1ULL << (row & 63);
+            }
+
+            /**
+             * @brief Throw an exception if the column doesn't store 'T' values.
+             *
+             * @tparam T
+             */
+            template<typename T>
+            void CheckType() const {
+                if (this->type == ColumnType::String || sizeof(T) != GetColumnTypeSize(this->type)) {
+                    throw std::runtime_error("Column '" + this->name + "' stores "
+                        + GetColumnTypeName(this->type) + " values, which don't match the requested type.");
+                }
+            }
+
+        public:
+            const std::string &GetName() const {
+                return this->name;
+            }
+
+            const std::string &GetTableName() const {
+                return this->tableName;
+            }
+
+            /**
+             * @brief Get the position of the column in the tuples (and in
+             * the header), which differs from its position in the result
+             * if a parse plan selected the columns.
+             *
+             * @return size_t
+             */
+            size_t GetIndex() const {
+                return this->index;
+            }
+
+            /**
+             * @brief Get the SQL type, as it was received in the header.
+             *
+             * @return const std::string&
+             */
+            const std::string &GetSqlType() const {
+                return this->sqlType;
+            }
+
+            ColumnType GetType() const {
+                return this->type;
+            }
+
+            /**
+             * @brief Get the scale of a decimal column: the value is
+             * the stored integer divided by 10^scale.
+             *
+             * @return int
+             */
+            int GetScale() const {
+                return this->scale;
+            }
+
+            size_t GetRowCount() const {
+                return this->rowCount;
+            }
+
+            size_t GetNullCount() const {
+                return this->nullCount;
+            }
+
+            /**
+             * @brief Get the values of a fixed-width column.
+             *
+             * @tparam T Must have the size of the storage type.
+             * @return Span<T>
+             * @throw runtime_error If the type doesn't match.
+             */
+            template<typename T>
+            Span<T> GetValues() const {
+                this->CheckType<T>();
+                return Span<T>((const T*)this->values.data(), this->rowCount);
+            }
+
+            /**
+             * @brief Returns true if the strings are stored as dictionary codes.
+             *
+             * @return bool
+             */
+            bool IsDictionaryEncoded() const {
+                return this->dictionary;
+            }
+
+            /**
+             * @brief Get the dictionary codes of the rows. The value of
+             * row 'i' is the dictionary entry codes[i].
+             *
+             * @return Span<uint32_t> Empty if not dictionary encoded.
+             */
+            Span<uint32_t> GetCodes() const {
+                return Span<uint32_t>(this->codes.data(), this->dictionary ? this->rowCount : 0);
+            }
+
+            /**
+             * @brief Get the number of the distinct values of a dictionary encoded column.
+             *
+             * @return size_t
+             */
+            size_t GetDictionarySize() const {
+                return this->dictionary ? this->offsets.size() - 1 : 0;
+            }
+
+            /**
+             * @brief Get the string offsets. The value of row 'i' is
+             * between offsets[i] and offsets[i + 1] in the bytes.
+             * For dictionary encoded columns, these are the offsets
+             * of the dictionary entries instead of the rows.
+             *
+             * @return Span<size_t>
+             */
+            Span<size_t> GetOffsets() const {
+                if (this->dictionary) {
+                    return Span<size_t>(this->offsets.data(), this->offsets.size());
+                }
+
+                return Span<size_t>(this->offsets.data(), this->type == ColumnType::String ? this->rowCount + 1 : 0);
+            }
+
+            /**
+             * @brief Get the concatenated strings. (Or dictionary entries)
+             *
+             * @return Span<char>
+             */
+            Span<char> GetBytes() const {
+                if (this->type != ColumnType::String || this->offsets.empty()) {
+                    return Span<char>();
+                }
+
+                return Span<char>(this->bytes.data(), this->offsets[this->GetOffsets().size - 1]);
+            }
+
+            /**
+             * @brief Get the validity bitmap. (1 bits for the non-NULL values)
+             *
+             * @return Span<uint64_t>
+             */
+            Span<uint64_t> GetValidity() const {
+                return Span<uint64_t>(this->validity.data(), (this->rowCount + 63) / 64);
+            }
+
+            /**
+             * @brief Returns true if the value is NULL.
+             *
+             * @param row
+             * @return bool
+             */
+            bool IsNull(size_t row) const {
+                return ((this->validity[row >> 6] >> (row & 63)) & 1) == 0;
+            }
+
+            /**
+             * @brief Get a value of a string column.
+             *
+             * @param row
+             * @return StringView
+             */
+            StringView GetString(size_t row) const {
+                if (this->type != ColumnType::String) {
+                    throw std::runtime_error("Column '" + this->name + "' is not a string column.");
+                }
+
+                size_t index = this->dictionary ? this->codes[row] : row;
+
+                return StringView(this->bytes.data() + this->offsets[index],
+                    this->offsets[index + 1] - this->offsets[index]);
+            }
+
+            /**
+             * @brief Get the memory used by the decoded data.
+             *
+             * @return size_t
+             */
+            size_t GetMemoryUsage() const {
+                return this->values.capacity() + this->offsets.capacity() * sizeof(size_t)
+                    + this->bytes.capacity() + this->codes.capacity() * sizeof(uint32_t)
+                    + this->validity.capacity() * sizeof(uint64_t);
+            }
+
+            /**
+             * @brief Estimate the memory, which the data would use without
+             * the dictionary encoding. (The same as GetMemoryUsage() for
+             * the other columns.)
+             *
+             * @return size_t
+             */
+            size_t GetPlainMemoryUsage() const {
+                if (!this->dictionary) {
+                    return this->GetMemoryUsage();
+                }
+
+                return (this->rowCount + 1) * sizeof(size_t) + this->valueBytes
+                    + this->validity.capacity() * sizeof(uint64_t);
+            }
+    };
+
+    /**
+     * @brief A result set decoded into columns.
+     */
+    class ColumnarResult {
+        friend class ColumnarDecoder;
+
+        private:
+            std::vector<Column> columns;
+            size_t rowCount = 0;
+
+        public:
+            size_t GetColumnCount() const {
+                return this->columns.size();
+            }
+
+            size_t GetRowCount() const {
+                return this->rowCount;
+            }
+
+            const Column &GetColumn(size_t index) const {
+                return this->columns.at(index);
+            }
+
+            /**
+             * @brief Find a column by its name.
+             *
+             * @param name
+             * @return const Column*
+             */
+            const Column *FindColumn(const std::string &name) const {
+                for (const Column &column : this->columns) {
+                    if (column.GetName() == name) {
+                        return &column;
+                    }
+                }
+
+                return nullptr;
+            }
+
+            /**
+             * @brief Get the memory used by the decoded data.
+             *
+             * @return size_t
+             */
+            size_t GetMemoryUsage() const {
+                size_t total = 0;
+
+                for (const Column &column : this->columns) {
+                    total += column.GetMemoryUsage();
+                }
+
+                return total;
+            }
+    };
+}
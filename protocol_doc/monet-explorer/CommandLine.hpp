@@ -343,6 +343,7 @@ namespace CommandLine {
                         /*
                             Convert string to int
                         */
+                        errno = 0;
                         int result = strtol(value.c_str(), &endPtr, 10);
                         if (errno == ERANGE) {
                             throw std::runtime_error("Integer value out of range: " + value);
@@ -377,6 +378,7 @@ namespace CommandLine {
                         /*
                             Convert string to double
                         */
+                        errno = 0;
                         double result = strtod(value.c_str(), &endPtr);
                         if (errno == ERANGE) {
                             throw std::runtime_error("Double value out of range: " + value);
@@ -16,18 +16,63 @@
 #pragma once
 
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <strings.h>
-#include <sstream>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
 #include <cstring>
+#include <string>
+#include <vector>
 #include "CommandLine.hpp"
+#include "Deadline.hpp"
+#include "SocketTuning.hpp"
+#include "StringView.hpp"
+#include "Transport.hpp"
 
 
 namespace MonetExplorer {
+    /**
+     * @brief Counters about the data transferred through
+     * a connection. Can be used to measure the efficiency
+     * of the receive and send paths.
+     */
+    struct TransferStats {
+        uint64_t messagesReceived = 0;
+        uint64_t packetsReceived = 0;
+        uint64_t bytesReceived = 0;     // Payload bytes, without packet headers
+        uint64_t bytesCopied = 0;       // Payload bytes copied after being received
+        uint64_t arenaGrowths = 0;
+        uint64_t readCalls = 0;         // Read operations (system calls, unless io_uring is used)
+        uint64_t messagesSent = 0;
+        uint64_t packetsSent = 0;
+        uint64_t writeCalls = 0;        // Write operations (system calls, unless io_uring is used)
+
+        /**
+         * @brief The number of bytes copied for each received
+         * payload byte. Zero means that all received messages
+         * were consumed in place.
+         *
+         * @return double
+         */
+        double GetCopiesPerByte() const {
+            if (this->bytesReceived == 0) {
+                return 0;
+            }
+
+            return (double)this->bytesCopied / (double)this->bytesReceived;
+        }
+    };
+
     /**
      * @brief Represents the connection to the server.
      * Provides methods for sending and receiving text messages.
@@ -36,36 +81,266 @@ namespace MonetExplorer {
     class Connection {
         private:
             const int BUFFER_SIZE = 8192;
+            const size_t MAX_PAYLOAD_SIZE = 8190;
+            const size_t ARENA_INITIAL_SIZE = 65536;
             int clientSocket = -1;
             bool connected = false;
+            Transport *transport = &SocketTransport::GetInstance();
+            SocketTuning tuning;
+            bool tcpSocket = false;
             char *buffer;
 
+            /*
+                Deadlines of the blocking mode. Each public operation
+                has to complete before the earlier of the per-operation
+                timeout and the explicit deadline.
+            */
+            int timeoutMs = -1;
+            Deadline deadline;
+            Deadline activeDeadline;
+
+            /*
+                The receive arena. The payloads of the packets are read
+                directly into it, so a message is stored contiguously
+                without further copying. Reused between the messages.
+            */
+            char *arena = nullptr;
+            size_t arenaCapacity = 0;
+            size_t arenaLength = 0;
+
+            /*
+                The read-ahead buffer. Large chunks are read from the socket
+                into it, and as many packet headers and payloads are served
+                from it as available. It is only refilled after it has been
+                fully drained, therefore it never wraps around.
+            */
+            char *readAhead = nullptr;
+            size_t readAheadCapacity = 0;
+            size_t readAheadStart = 0;
+            size_t readAheadEnd = 0;
+
+            /*
+                Reused between the sent messages. The packet headers
+                are stored separately from the payloads, so the
+                payloads can be sent without copying them.
+            */
+            std::vector<uint16_t> sendHeaders;
+            std::vector<struct iovec> sendVectors;
+
+            /*
+                State of the line by line receive. (See: ReceiveLine)
+            */
+            bool lineStreamActive = false;
+            bool lineStreamLastPacket = false;
+            size_t linePosition = 0;
+
+            /*
+                State of the non-blocking mode. The received packets are
+                parsed incrementally, and the outgoing messages are queued.
+                (See: TryReceiveMessage, QueueMessage, TryFlush)
+            */
+            bool nonBlocking = false;
+            bool messageInProgress = false;
+            uint16_t partialHeader = 0;
+            size_t partialHeaderBytes = 0;
+            size_t payloadRemaining = 0;
+            std::string outgoing;
+            size_t outgoingPosition = 0;
+
+            TransferStats stats;
+
+            /**
+             * @brief Read from the socket through the selected transport.
+             * The transports are blocking, therefore the non-blocking
+             * mode uses the system call directly.
+             * 
+             * @param vectors Where to put the data.
+             * @param count The number of vectors.
+             * @return ssize_t Same as for readv().
+             */
+            ssize_t SocketRead(const struct iovec *vectors, int count) {
+                this->stats.readCalls++;
+
+                if (this->nonBlocking) {
+                    return readv(this->clientSocket, vectors, count);
+                }
+
+                ssize_t result = this->transport->Read(this->clientSocket, vectors, count,
+                    this->activeDeadline.GetRemainingMs());
+
+                if (this->tcpSocket) {
+                    this->tuning.ApplyQuickAck(this->clientSocket);
+                }
+
+                return result;
+            }
+
+            /**
+             * @brief Write to the socket through the selected transport.
+             * The transports are blocking, therefore the non-blocking
+             * mode uses the system call directly.
+             * 
+             * @param vectors The data to write.
+             * @param count The number of vectors.
+             * @return ssize_t Same as for writev().
+             */
+            ssize_t SocketWrite(const struct iovec *vectors, int count) {
+                this->stats.writeCalls++;
+
+                if (this->nonBlocking) {
+                    return writev(this->clientSocket, vectors, count);
+                }
+
+                return this->transport->Write(this->clientSocket, vectors, count,
+                    this->activeDeadline.GetRemainingMs());
+            }
+
+            /**
+             * @brief Start the deadline of a public operation.
+             */
+            void BeginOperation() {
+                this->activeDeadline = Deadline::Earliest(this->deadline, Deadline::After(this->timeoutMs));
+            }
+
+            /**
+             * @brief Throw the exception for a failed socket operation,
+             * based on errno. After a timeout the connection is closed,
+             * because the position inside the message stream is lost.
+             * 
+             * @param operation What failed, for the error message.
+             */
+            void ThrowSocketError(const std::string &operation) {
+                int error = errno;
+
+                if (error == ETIMEDOUT) {
+                    this->Abort();
+                    throw TimeoutError("Timed out while trying to " + operation + ".");
+                }
+
+                throw std::runtime_error("Failed to " + operation + ". Error: '"
+                    + std::string(strerror(error)) + "' (" + std::to_string(error) + ")");
+            }
+
+            /**
+             * @brief Reset the state belonging to the socket.
+             */
+            void ResetState() {
+                this->readAheadStart = 0;
+                this->readAheadEnd = 0;
+                this->lineStreamActive = false;
+                this->messageInProgress = false;
+                this->partialHeaderBytes = 0;
+                this->payloadRemaining = 0;
+                this->outgoing.clear();
+                this->outgoingPosition = 0;
+
+                this->clientSocket = -1;
+                this->connected = false;
+            }
+
+            /**
+             * @brief Close the socket immediately, without
+             * waiting for the server to close its side.
+             */
+            void Abort() {
+                if (this->clientSocket > -1) {
+                    this->transport->Release(this->clientSocket);
+                    close(this->clientSocket);
+                }
+
+                this->ResetState();
+            }
+
+            /**
+             * @brief Connect the socket. In blocking mode with a deadline,
+             * the connect is done in non-blocking mode, and poll() waits
+             * for its completion.
+             * 
+             * @param address
+             * @param length
+             */
+            void ConnectSocket(const struct sockaddr *address, socklen_t length) {
+                bool timed = !this->nonBlocking && !this->activeDeadline.IsInfinite();
+                int flags = 0;
+
+                if (timed) {
+                    flags = fcntl(this->clientSocket, F_GETFL, 0);
+                    fcntl(this->clientSocket, F_SETFL, flags | O_NONBLOCK);
+                }
+
+                if (connect(this->clientSocket, address, length) == 0
+                        || (this->nonBlocking && errno == EINPROGRESS)) {
+
+                    if (timed) {
+                        fcntl(this->clientSocket, F_SETFL, flags);
+                    }
+
+                    return;
+                }
+
+                if (!timed || errno != EINPROGRESS) {
+                    this->ThrowConnectError();
+                }
+
+                struct pollfd item;
+                item.fd = this->clientSocket;
+                item.events = POLLOUT;
+                item.revents = 0;
+                int result;
+
+                do {
+                    result = poll(&item, 1, this->activeDeadline.GetRemainingMs());
+                } while (result < 0 && errno == EINTR);
+
+                if (result == 0) {
+                    errno = ETIMEDOUT;
+                } else if (result > 0) {
+                    errno = this->GetConnectError();
+                }
+
+                if (result <= 0 || errno != 0) {
+                    this->ThrowConnectError();
+                }
+
+                fcntl(this->clientSocket, F_SETFL, flags);
+            }
+
+            /**
+             * @brief Close the socket of a failed connect, then throw
+             * the exception of the error in errno.
+             */
+            void ThrowConnectError() {
+                int error = errno;
+                this->Abort();
+                errno = error;
+
+                this->ThrowSocketError("connect to the server");
+            }
+
             /**
              * @brief Blocks until the exact number of bytes is read.
              * 
-             * @param byteCount The number of bytes to read. Must be less than
-             * the buffer size.
+             * @param dest The destination of the read. Must have space
+             * for at least byteCount bytes.
+             * @param byteCount The number of bytes to read.
              * @param throwError If false, then won't throw exception on read error.
              * @return int Returns byteCount on success. Returns 0 if
              * the connection was terminated on the server side.
              * Returns -1 on error and the errno is populated.
              */
-            int ReadExact(int byteCount, bool throwError) {
-                if (byteCount > BUFFER_SIZE) {
-                    throw std::runtime_error("Connection::ReadExact(): byteCount is larger "
-                        "than the buffer size.");
-                }
-
-                char *startPos = this->buffer;
+            int ReadExact(char *dest, int byteCount, bool throwError) {
+                char *startPos = dest;
                 int remaining = byteCount;
                 int response;
+                struct iovec iov;
 
                 do {
-                    response = read(this->clientSocket, startPos, remaining);
+                    iov.iov_base = startPos;
+                    iov.iov_len = remaining;
+                    response = this->SocketRead(&iov, 1);
                     if (response < 1) {
                         if (throwError && response < 0) {
-                            throw std::runtime_error("Failed to read from the server. Error: '"
-                                + std::string(strerror(errno)) + "' (" + std::to_string(errno) + ")");
+                            this->ThrowSocketError("read from the server");
                         }
 
                         return response;
@@ -78,6 +353,230 @@ namespace MonetExplorer {
                 return byteCount;
             }
 
+            /**
+             * @brief Blocks until the exact number of bytes is read,
+             * serving them from the read-ahead buffer when possible.
+             * When the buffer is drained, a single readv() call
+             * reads the missing bytes directly into the destination
+             * and the following ones into the read-ahead buffer.
+             * 
+             * @param dest The destination of the read. Must have space
+             * for at least byteCount bytes.
+             * @param byteCount The number of bytes to read.
+             * @return int Returns byteCount on success. Returns 0 if
+             * the connection was terminated on the server side.
+             */
+            int ReadBuffered(char *dest, int byteCount) {
+                size_t remaining = byteCount;
+                size_t available = this->readAheadEnd - this->readAheadStart;
+                ssize_t response;
+                struct iovec iov[2];
+
+                if (available > 0) {
+                    size_t count = std::min(available, remaining);
+                    std::memcpy(dest, this->readAhead + this->readAheadStart, count);
+
+                    this->readAheadStart += count;
+                    dest += count;
+                    remaining -= count;
+                }
+
+                while (remaining > 0) {
+                    // The read-ahead buffer is drained at this point.
+                    this->readAheadStart = 0;
+                    this->readAheadEnd = 0;
+
+                    iov[0].iov_base = dest;
+                    iov[0].iov_len = remaining;
+                    iov[1].iov_base = this->readAhead;
+                    iov[1].iov_len = this->readAheadCapacity;
+
+                    response = this->SocketRead(iov, this->readAheadCapacity > 0 ? 2 : 1);
+
+                    if (response < 1) {
+                        if (response < 0) {
+                            this->ThrowSocketError("read from the server");
+                        }
+
+                        return 0;
+                    }
+
+                    if ((size_t)response <= remaining) {
+                        dest += response;
+                        remaining -= response;
+                    } else {
+                        this->readAheadEnd = response - remaining;
+                        remaining = 0;
+                    }
+                }
+
+                return byteCount;
+            }
+
+            /**
+             * @brief Blocks until all the passed vectors are written
+             * to the server. Uses as few writev() calls as possible,
+             * continuing after partial writes.
+             * 
+             * @param vectors The vectors to write. Their contents
+             * are modified on partial writes.
+             * @param count The number of vectors.
+             */
+            void WriteVectors(struct iovec *vectors, size_t count) {
+                ssize_t result;
+
+                while (count > 0) {
+                    result = this->SocketWrite(vectors, std::min(count, (size_t)IOV_MAX));
+
+                    if (result < 0) {
+                        if (errno == EINTR) {
+                            continue;
+                        }
+
+                        this->ThrowSocketError("write to the server");
+                    }
+
+                    /*
+                        Skip the fully written vectors,
+                        then adjust the partially written one.
+                    */
+                    while (count > 0 && (size_t)result >= vectors->iov_len) {
+                        result -= vectors->iov_len;
+                        vectors++;
+                        count--;
+                    }
+
+                    if (result > 0) {
+                        vectors->iov_base = (char*)vectors->iov_base + result;
+                        vectors->iov_len -= result;
+                    }
+                }
+            }
+
+            /**
+             * @brief Set the O_NONBLOCK flag of the socket according
+             * to the selected mode.
+             */
+            void ApplyNonBlocking() {
+                if (this->clientSocket < 0) {
+                    return;
+                }
+
+                int flags = fcntl(this->clientSocket, F_GETFL, 0);
+                if (flags == -1) {
+                    throw std::runtime_error("Failed to get the socket flags. Error: '"
+                        + std::string(strerror(errno)) + "' (" + std::to_string(errno) + ")");
+                }
+
+                flags = this->nonBlocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+
+                if (fcntl(this->clientSocket, F_SETFL, flags) == -1) {
+                    throw std::runtime_error("Failed to set the socket flags. Error: '"
+                        + std::string(strerror(errno)) + "' (" + std::to_string(errno) + ")");
+                }
+            }
+
+            /**
+             * @brief Split messages into packets. The headers are
+             * generated into the header array, and the vectors point
+             * to the headers and to the payloads inside the messages.
+             * 
+             * @param messages The messages to be sent, in order.
+             * @param count The number of the messages.
+             * @return size_t The number of vectors generated.
+             */
+            size_t FrameMessages(const StringView *messages, size_t count) {
+                size_t packetCount = 0;
+                size_t vectorCount = 0;
+                size_t packetIndex = 0;
+                size_t packetSize;
+
+                for (size_t m = 0; m < count; m++) {
+                    packetCount += std::max((size_t)1, (messages[m].length + MAX_PAYLOAD_SIZE - 1) / MAX_PAYLOAD_SIZE);
+                }
+
+                // Resize first, so that the vectors can point into the header array.
+                this->sendHeaders.resize(packetCount);
+                this->sendVectors.resize(packetCount * 2);
+
+                for (size_t m = 0; m < count; m++) {
+                    const char *pos = messages[m].data;
+                    size_t remaining = messages[m].length;
+
+                    do {
+                        if (remaining <= MAX_PAYLOAD_SIZE) {
+                            this->sendHeaders[packetIndex] = ((uint16_t)remaining << 1) | (uint16_t)1;
+                            packetSize = remaining;
+                        } else {
+                            this->sendHeaders[packetIndex] = (uint16_t)MAX_PAYLOAD_SIZE << 1;
+                            packetSize = MAX_PAYLOAD_SIZE;
+                        }
+
+                        this->sendVectors[vectorCount].iov_base = &this->sendHeaders[packetIndex];
+                        this->sendVectors[vectorCount].iov_len = 2;
+                        vectorCount++;
+                        packetIndex++;
+
+                        if (packetSize > 0) {
+                            this->sendVectors[vectorCount].iov_base = (void*)pos;
+                            this->sendVectors[vectorCount].iov_len = packetSize;
+                            vectorCount++;
+                        }
+
+                        remaining -= packetSize;
+                        pos += packetSize;
+                    } while (remaining > 0);
+                }
+
+                this->stats.messagesSent += count;
+                this->stats.packetsSent += packetCount;
+
+                return vectorCount;
+            }
+
+            /**
+             * @brief Split a message into packets. (See: FrameMessages)
+             * 
+             * @param message The message to be sent.
+             * @return size_t The number of vectors generated.
+             */
+            size_t FrameMessage(StringView message) {
+                return this->FrameMessages(&message, 1);
+            }
+
+            /**
+             * @brief Make sure that the arena can hold at least
+             * the specified number of bytes. Grows geometrically,
+             * keeping the already received part of the message.
+             * 
+             * @param required The required capacity in bytes.
+             */
+            void ReserveArena(size_t required) {
+                if (required <= this->arenaCapacity) {
+                    return;
+                }
+
+                size_t newCapacity = this->arenaCapacity > 0 ? this->arenaCapacity : ARENA_INITIAL_SIZE;
+                while (newCapacity < required) {
+                    newCapacity *= 2;
+                }
+
+                char *newArena = (char*)realloc(this->arena, newCapacity);
+                if (newArena == nullptr) {
+                    throw std::runtime_error("Connection::ReserveArena(): Failed to allocate "
+                        + std::to_string(newCapacity) + " bytes for the receive arena.");
+                }
+
+                if (this->arenaCapacity > 0) {
+                    // Upper estimate: realloc might have extended in place.
+                    this->stats.bytesCopied += this->arenaLength;
+                    this->stats.arenaGrowths++;
+                }
+
+                this->arena = newArena;
+                this->arenaCapacity = newCapacity;
+            }
+
             /**
              * @brief Blocks until the exact number of bytes
              * is written to the server.
@@ -91,25 +590,11 @@ namespace MonetExplorer {
                         "than the buffer size.");
                 }
 
-                char *startPos = this->buffer;
-                int remaining = byteCount;
-                int result;
+                struct iovec iov;
+                iov.iov_base = this->buffer;
+                iov.iov_len = byteCount;
 
-                do {
-                    result = write(this->clientSocket, startPos, remaining);
-                    if (result < 1) {
-                        if (errno != 0) {
-                            throw std::runtime_error("Failed to write to server. Error: '"
-                                + std::string(strerror(errno)) + "' (" + std::to_string(errno) + ")");
-                        } else if (remaining > 0) {
-                            usleep(100000);
-                            continue;
-                        }
-                    }
-
-                    remaining -= result;
-                    startPos += result;
-                } while (remaining > 0);
+                this->WriteVectors(&iov, 1);
             }
 
         public:
@@ -118,6 +603,7 @@ namespace MonetExplorer {
              */
             Connection() {
                 this->buffer = new char[BUFFER_SIZE];
+                this->SetReadAheadSize(65536);
             }
 
             /**
@@ -127,6 +613,30 @@ namespace MonetExplorer {
                 this->Disconnect();
 
                 delete[] this->buffer;
+                free(this->arena);
+                delete[] this->readAhead;
+            }
+
+            /**
+             * @brief Set the size of the read-ahead buffer. Larger
+             * sizes mean fewer system calls for large responses, at
+             * the cost of copying the payloads out of the buffer.
+             * Can only be changed while the buffer is empty.
+             * 
+             * @param size Size in bytes. 0 disables reading ahead, then
+             * every packet header and payload is read separately.
+             */
+            void SetReadAheadSize(size_t size) {
+                if (this->readAheadEnd > this->readAheadStart) {
+                    throw std::runtime_error("Connection::SetReadAheadSize(): The read-ahead buffer "
+                        "still contains unprocessed data.");
+                }
+
+                delete[] this->readAhead;
+                this->readAhead = size > 0 ? new char[size] : nullptr;
+                this->readAheadCapacity = size;
+                this->readAheadStart = 0;
+                this->readAheadEnd = 0;
             }
 
             /**
@@ -139,6 +649,8 @@ namespace MonetExplorer {
                     return;
                 }
 
+                this->BeginOperation();
+
                 if (clientSocket > -1) {
                     // Close the outgoing channel
                     shutdown(this->clientSocket, SHUT_WR);
@@ -146,14 +658,13 @@ namespace MonetExplorer {
                     /*
                         After the server noticed that the client
                         closed its outgoing channel, it will also
-                        do so. Read until that is detected.
+                        do so. Read until that is detected, or
+                        until the deadline.
                     */
-                    while(this->ReadExact(BUFFER_SIZE, false) > 0);
-                    close(this->clientSocket);
+                    while(this->ReadExact(this->buffer, BUFFER_SIZE, false) > 0);
                 }
 
-                this->clientSocket = -1;
-                this->connected = false;
+                this->Abort();
             }
 
             /**
@@ -171,12 +682,17 @@ namespace MonetExplorer {
                 /*
                     Connect through TCP/IP.
                 */
+                this->BeginOperation();
                 this->clientSocket = socket(AF_INET, SOCK_STREAM, 0);
                 if (this->clientSocket == -1) {
                     throw std::runtime_error("Failed to create socket. Error: '" + std::string(strerror(errno))
                         + "' (" + std::to_string(errno) + ")");
                 }
 
+                this->tcpSocket = true;
+                this->tuning.Apply(this->clientSocket, true);
+                this->ApplyNonBlocking();
+
                 struct sockaddr_in serverAddress;
                 bzero(&serverAddress, sizeof(serverAddress));
 
@@ -184,9 +700,10 @@ namespace MonetExplorer {
                 serverAddress.sin_addr.s_addr = inet_addr(host.c_str());
                 serverAddress.sin_port = htons(port);
 
-                if (connect(this->clientSocket, (sockaddr*)&serverAddress, sizeof(serverAddress)) != 0) {
-                    throw std::runtime_error("Failed to connect to the server. Error: '"
-                        + std::string(strerror(errno)) + "' (" + std::to_string(errno) + ")");
+                this->ConnectSocket((sockaddr*)&serverAddress, sizeof(serverAddress));
+
+                if (!this->nonBlocking) {
+                    this->tuning.OnConnected(this->clientSocket);
                 }
 
                 this->connected = true;
@@ -206,24 +723,24 @@ namespace MonetExplorer {
                         "(Method is called twice.)");
                 }
 
+                this->BeginOperation();
                 this->clientSocket = socket(AF_UNIX, SOCK_STREAM, 0);
                 if (this->clientSocket == -1) {
                     throw std::runtime_error("Failed to create socket. Error: '" + std::string(strerror(errno))
                         + "' (" + std::to_string(errno) + ")");
                 }
 
+                this->tcpSocket = false;
+                this->tuning.Apply(this->clientSocket, false);
+                this->ApplyNonBlocking();
+
                 struct sockaddr_un serverAddress;
                 bzero(&serverAddress, sizeof(serverAddress));
                 serverAddress.sun_family = AF_UNIX;
                 std::memcpy(serverAddress.sun_path, socketFilePath.c_str(), socketFilePath.length() + 1);
 
-                if (connect(this->clientSocket, (sockaddr*)&serverAddress, sizeof(serverAddress)) == 0) {
-                    this->connected = true;
-                    return;
-                }
-
-                throw std::runtime_error("Failed to connect to the server. Error: '"
-                    + std::string(strerror(errno)) + "' (" + std::to_string(errno) + ")");
+                this->ConnectSocket((sockaddr*)&serverAddress, sizeof(serverAddress));
+                this->connected = true;
             }
 
             /**
@@ -233,6 +750,7 @@ namespace MonetExplorer {
              * See: https://github.com/MonetDB/MonetDB/blob/1f1bbdbd3340fdb74345723e8c98c120dcaf2ead/clients/mapilib/mapi.c#L2416
              */
             void SendUnixDomainSocketInitByte() {
+                this->BeginOperation();
                 this->buffer[0] = '0';
                 this->WriteExact(1);
             }
@@ -248,79 +766,534 @@ namespace MonetExplorer {
             }
 
             /**
-             * @brief Receive a message from the MonetDB server.
+             * @brief Receive a single packet, appending its payload
+             * to the end of the arena.
              * 
-             * @return std::string 
+             * @return int 1 if this was the last packet of the message,
+             * 0 if more packets follow, -1 if the server closed the connection.
              */
-            std::string ReceiveMessage() {
+            int ReceivePacket() {
                 int response;
                 uint16_t header;
-                bool isLastPacket;
                 int payloadSize;
-                std::stringstream message;
+                size_t buffered;
 
-                do {
-                    /*
-                        Read header
-                    */
-                    response = this->ReadExact(2, true);
+                /*
+                    Read header
+                */
+                response = this->ReadBuffered((char*)&header, 2);
+                if (response == 0) {
+                    // Server closed the connection.
+                    this->Disconnect();
+                    return -1;
+                }
+
+                payloadSize = header >> 1;
+                if (payloadSize > BUFFER_SIZE - 2) {
+                    throw std::runtime_error("A packet returned from the server had larger than "
+                        + std::to_string(BUFFER_SIZE - 2) + " bytes payload. " + std::to_string(payloadSize));
+                }
+
+                /*
+                    Read payload into its final position
+                */
+                if (payloadSize > 0) {
+                    this->ReserveArena(this->arenaLength + payloadSize);
+                    buffered = std::min((size_t)payloadSize, this->readAheadEnd - this->readAheadStart);
+
+                    response = this->ReadBuffered(this->arena + this->arenaLength, payloadSize);
                     if (response == 0) {
                         // Server closed the connection.
                         this->Disconnect();
-                        return message.str();
+                        return -1;
+                    }
+
+                    this->arenaLength += payloadSize;
+                    this->stats.bytesReceived += payloadSize;
+                    this->stats.bytesCopied += buffered;
+                }
+
+                this->stats.packetsReceived++;
+
+                return header & (uint16_t)1;
+            }
+
+            /**
+             * @brief Receive a message from the MonetDB server.
+             * The payloads are read directly into the receive arena,
+             * (or copied there from the read-ahead buffer) and the
+             * returned view points into that.
+             * 
+             * @return StringView The message. It stays valid only until
+             * the next receive or the destruction of the connection.
+             */
+            StringView ReceiveMessageView() {
+                int response;
+
+                if (this->lineStreamActive) {
+                    throw std::runtime_error("Connection::ReceiveMessageView(): The previous message "
+                        "is still being received line by line.");
+                }
+
+                this->BeginOperation();
+                this->arenaLength = 0;
+
+                bool measure = this->tcpSocket && this->tuning.profile == TuningProfile::Auto;
+                bool firstPacketReceived = false;
+                std::chrono::steady_clock::time_point firstPacket;
+
+                do {
+                    response = this->ReceivePacket();
+                    if (response < 0) {
+                        return StringView(this->arena, this->arenaLength);
+                    }
+
+                    if (measure && !firstPacketReceived) {
+                        firstPacket = std::chrono::steady_clock::now();
+                        firstPacketReceived = true;
+                    }
+                } while (response == 0);
+
+                this->stats.messagesReceived++;
+
+                if (measure) {
+                    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - firstPacket;
+                    this->tuning.OnTransfer(this->clientSocket, this->arenaLength, elapsed.count());
+                }
+
+                return StringView(this->arena, this->arenaLength);
+            }
+
+            /**
+             * @brief Receive the next line of a message from the MonetDB
+             * server, as soon as it is complete. Call it repeatedly until
+             * it returns false, which marks the end of the message. Only
+             * one packet and the current line are kept in memory.
+             * 
+             * The lines are only split at '\n' characters, which are never
+             * part of a multi-byte UTF-8 sequence. So the sequences cut in
+             * half at the end of a packet are carried over together with
+             * the partial line they belong to.
+             * 
+             * @param line Output: the line without the terminating '\n'. The last
+             * line of the message is returned even if it is not terminated.
+             * It stays valid only until the next receive call.
+             * @return bool False when the end of the message is reached. Then
+             * the line is not set.
+             */
+            bool ReceiveLine(StringView &line) {
+                char *lineStart;
+                char *lineEnd;
+                size_t available;
+                int response;
+
+                this->BeginOperation();
+
+                if (!this->lineStreamActive) {
+                    this->lineStreamActive = true;
+                    this->lineStreamLastPacket = false;
+                    this->linePosition = 0;
+                    this->arenaLength = 0;
+                }
+
+                while (true) {
+                    lineStart = this->arena + this->linePosition;
+                    available = this->arenaLength - this->linePosition;
+
+                    lineEnd = available > 0 ? (char*)memchr(lineStart, '\n', available) : nullptr;
+                    if (lineEnd != nullptr) {
+                        line = StringView(lineStart, lineEnd - lineStart);
+                        this->linePosition += lineEnd - lineStart + 1;
+                        return true;
                     }
 
-                    header = *((uint16_t*)this->buffer);
-                    isLastPacket = header & (uint16_t)1;
-                    payloadSize = header >> 1;
-                    if (payloadSize > BUFFER_SIZE - 2) {
-                        throw std::runtime_error("A packet returned from the server had larger than "
-                            + std::to_string(BUFFER_SIZE - 2) + " bytes payload. " + std::to_string(payloadSize));
+                    if (this->lineStreamLastPacket) {
+                        if (available > 0) {
+                            // Not terminated last line
+                            line = StringView(lineStart, available);
+                            this->linePosition = this->arenaLength;
+                            return true;
+                        }
+
+                        this->lineStreamActive = false;
+                        this->stats.messagesReceived++;
+                        return false;
                     }
 
                     /*
-                        Read payload
+                        Carry the partial line over to the beginning
+                        of the arena, then append the next packet.
                     */
-                    if (payloadSize > 0) {
-                        response = this->ReadExact(payloadSize, true);
+                    if (this->linePosition > 0) {
+                        std::memmove(this->arena, lineStart, available);
+                        this->stats.bytesCopied += available;
+                        this->arenaLength = available;
+                        this->linePosition = 0;
+                    }
+
+                    response = this->ReceivePacket();
+                    this->lineStreamLastPacket = response != 0;
+                }
+            }
+
+            /**
+             * @brief Receive a message from the MonetDB server.
+             * Returns a copy of the message. Prefer ReceiveMessageView()
+             * for large responses.
+             * 
+             * @return std::string 
+             */
+            std::string ReceiveMessage() {
+                StringView message = this->ReceiveMessageView();
+                this->stats.bytesCopied += message.length;
+
+                return message.ToString();
+            }
+
+            /**
+             * @brief Get the transfer counters of the connection.
+             * 
+             * @return const TransferStats& 
+             */
+            const TransferStats &GetStats() const {
+                return this->stats;
+            }
+
+            /**
+             * @brief Send a message to the MonetDB server.
+             * The packet headers are generated into a separate array,
+             * then the headers and the payloads are written using
+             * vectored I/O, without copying the payloads.
+             * 
+             * @param message 
+             */
+            void SendMessage(StringView message) {
+                this->BeginOperation();
+                size_t vectorCount = this->FrameMessage(message);
+
+                this->WriteVectors(this->sendVectors.data(), vectorCount);
+            }
+
+            /**
+             * @brief Send multiple messages with a single vectored write,
+             * without waiting for the responses in between. (Pipelining.)
+             * The responses have to be received in the same order.
+             * 
+             * @param messages
+             * @param count
+             */
+            void SendMessages(const StringView *messages, size_t count) {
+                this->BeginOperation();
+                size_t vectorCount = this->FrameMessages(messages, count);
+
+                this->WriteVectors(this->sendVectors.data(), vectorCount);
+            }
+
+            /**
+             * @brief Select the transport used by the blocking mode.
+             * Can only be changed while disconnected.
+             * 
+             * @param transport Must outlive the connection. The default
+             * is the shared SocketTransport instance.
+             */
+            void SetTransport(Transport &transport) {
+                if (this->connected) {
+                    throw std::runtime_error("Connection::SetTransport(): The transport cannot be "
+                        "changed while connected.");
+                }
+
+                this->transport = &transport;
+            }
+
+            /**
+             * @brief Set the time limit of the individual blocking operations.
+             * (Connect, sending a message, receiving a message or a line.)
+             * On timeout a TimeoutError is thrown, and the connection is closed.
+             * 
+             * @param milliseconds Negative: no limit. (default)
+             */
+            void SetTimeout(int milliseconds) {
+                this->timeoutMs = milliseconds;
+            }
+
+            /**
+             * @brief Get the time limit of the individual blocking operations.
+             * 
+             * @return int Negative: no limit.
+             */
+            int GetTimeout() const {
+                return this->timeoutMs;
+            }
+
+            /**
+             * @brief Set a deadline that spans multiple operations, for example
+             * the whole connect and authentication. The operations have to complete
+             * before both the deadline and their own timeout. On timeout a
+             * TimeoutError is thrown, and the connection is closed.
+             * 
+             * @param deadline Deadline::Never() removes it.
+             */
+            void SetDeadline(const Deadline &deadline) {
+                this->deadline = deadline;
+            }
+
+            /**
+             * @brief Set the socket options. They are applied
+             * on the next connect.
+             * 
+             * @param tuning
+             */
+            void SetSocketTuning(const SocketTuning &tuning) {
+                this->tuning = tuning;
+            }
+
+            /**
+             * @brief Get the socket options. The auto profile
+             * updates them with its measurements.
+             * 
+             * @return const SocketTuning& 
+             */
+            const SocketTuning &GetSocketTuning() const {
+                return this->tuning;
+            }
+
+            /**
+             * @brief Get the transport used by the blocking mode.
+             * 
+             * @return Transport& 
+             */
+            Transport &GetTransport() const {
+                return *this->transport;
+            }
+
+            /**
+             * @brief Select between the blocking and the non-blocking mode.
+             * In non-blocking mode the connect methods return immediately,
+             * and only TryReceiveMessage(), QueueMessage() and TryFlush()
+             * can be used for the communication. The caller is responsible
+             * for waiting for the readiness of the socket. (See: Reactor)
+             * 
+             * @param enable True = non-blocking, False = blocking (default).
+             */
+            void SetNonBlocking(bool enable) {
+                this->nonBlocking = enable;
+                this->ApplyNonBlocking();
+            }
+
+            /**
+             * @brief Returns true if the connection is in non-blocking mode.
+             * 
+             * @return bool
+             */
+            bool IsNonBlocking() const {
+                return this->nonBlocking;
+            }
+
+            /**
+             * @brief Get the file descriptor of the socket.
+             * 
+             * @return int -1 if not connected.
+             */
+            int GetSocket() const {
+                return this->clientSocket;
+            }
+
+            /**
+             * @brief In non-blocking mode, the connect methods return before
+             * the connection is established. Call this after the socket
+             * became writable, to check whether the connection succeeded.
+             * 
+             * @return int 0 on success, otherwise an errno value.
+             */
+            int GetConnectError() {
+                int error = 0;
+                socklen_t length = sizeof(error);
+
+                if (getsockopt(this->clientSocket, SOL_SOCKET, SO_ERROR, &error, &length) != 0) {
+                    return errno;
+                }
+
+                return error;
+            }
+
+            /**
+             * @brief Non-blocking mode: Read all the data available on the
+             * socket, and parse the packets from it incrementally. Can be
+             * called again after it returned 0, even if the previous
+             * call stopped in the middle of a packet header.
+             * 
+             * @param message Output: the complete message, if 1 is returned.
+             * It stays valid only until the next receive call.
+             * @return int 1 if a complete message was received, 0 if more
+             * data is required, -1 if the server closed the connection.
+             */
+            int TryReceiveMessage(StringView &message) {
+                size_t available;
+                size_t count;
+                ssize_t response;
+
+                if (this->readAheadCapacity == 0) {
+                    throw std::runtime_error("Connection::TryReceiveMessage(): The read-ahead buffer "
+                        "is required for the non-blocking receive.");
+                }
+
+                if (!this->messageInProgress) {
+                    this->messageInProgress = true;
+                    this->partialHeaderBytes = 0;
+                    this->payloadRemaining = 0;
+                    this->arenaLength = 0;
+                }
+
+                while (true) {
+                    /*
+                        Packet complete?
+                    */
+                    if (this->partialHeaderBytes == 2 && this->payloadRemaining == 0) {
+                        this->partialHeaderBytes = 0;
+                        this->stats.packetsReceived++;
+
+                        if (this->partialHeader & (uint16_t)1) {
+                            this->messageInProgress = false;
+                            this->stats.messagesReceived++;
+                            message = StringView(this->arena, this->arenaLength);
+                            return 1;
+                        }
+                    }
+
+                    /*
+                        Refill the read-ahead buffer
+                    */
+                    available = this->readAheadEnd - this->readAheadStart;
+                    if (available == 0) {
+                        this->readAheadStart = 0;
+                        this->readAheadEnd = 0;
+
+                        struct iovec iov;
+                        iov.iov_base = this->readAhead;
+                        iov.iov_len = this->readAheadCapacity;
+                        response = this->SocketRead(&iov, 1);
+
                         if (response == 0) {
                             // Server closed the connection.
                             this->Disconnect();
-                            return message.str();
+                            return -1;
+                        } else if (response < 0) {
+                            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                                return 0;
+                            } else if (errno == EINTR) {
+                                continue;
+                            }
+
+                            throw std::runtime_error("Failed to read from the server. Error: '"
+                                + std::string(strerror(errno)) + "' (" + std::to_string(errno) + ")");
                         }
 
-                        message.write(this->buffer, payloadSize);
+                        this->readAheadEnd = response;
+                        continue;
                     }
-                } while (!isLastPacket);
 
-                return message.str();
+                    /*
+                        Header
+                    */
+                    if (this->partialHeaderBytes < 2) {
+                        count = std::min(available, 2 - this->partialHeaderBytes);
+                        std::memcpy((char*)&this->partialHeader + this->partialHeaderBytes,
+                            this->readAhead + this->readAheadStart, count);
+
+                        this->partialHeaderBytes += count;
+                        this->readAheadStart += count;
+
+                        if (this->partialHeaderBytes == 2) {
+                            this->payloadRemaining = this->partialHeader >> 1;
+                            if (this->payloadRemaining > MAX_PAYLOAD_SIZE) {
+                                throw std::runtime_error("A packet returned from the server had larger than "
+                                    + std::to_string(MAX_PAYLOAD_SIZE) + " bytes payload. "
+                                    + std::to_string(this->payloadRemaining));
+                            }
+
+                            this->ReserveArena(this->arenaLength + this->payloadRemaining);
+                        }
+
+                        continue;
+                    }
+
+                    /*
+                        Payload
+                    */
+                    count = std::min(available, this->payloadRemaining);
+                    std::memcpy(this->arena + this->arenaLength, this->readAhead + this->readAheadStart, count);
+
+                    this->arenaLength += count;
+                    this->readAheadStart += count;
+                    this->payloadRemaining -= count;
+                    this->stats.bytesReceived += count;
+                    this->stats.bytesCopied += count;
+                }
             }
 
             /**
-             * @brief Send a message to the MonetDB server.
+             * @brief Non-blocking mode: Frame a message into packets and append
+             * it to the outgoing queue. The message is copied, so it doesn't
+             * have to outlive the call. Use TryFlush() to send the queue.
              * 
              * @param message 
              */
-            void SendMessage(const std::string &message) {
-                const char *pos = message.c_str();
-                int remaining = message.length();
-                int packetSize;
+            void QueueMessage(StringView message) {
+                size_t vectorCount = this->FrameMessage(message);
 
-                do {
-                    if (remaining < BUFFER_SIZE - 2) {
-                        *((uint16_t*)this->buffer) = ((uint16_t)remaining << 1) | (uint16_t)1;
-                        packetSize = remaining;
-                    } else {
-                        *((uint16_t*)this->buffer) = ((uint16_t)BUFFER_SIZE - (uint16_t)2) << 1;
-                        packetSize = BUFFER_SIZE - 2;
+                if (this->outgoingPosition >= this->outgoing.length()) {
+                    this->outgoing.clear();
+                    this->outgoingPosition = 0;
+                }
+
+                for (size_t i = 0; i < vectorCount; i++) {
+                    this->outgoing.append((const char*)this->sendVectors[i].iov_base, this->sendVectors[i].iov_len);
+                }
+            }
+
+            /**
+             * @brief Returns true if the outgoing queue has unsent data.
+             * 
+             * @return bool
+             */
+            bool HasPendingOutput() const {
+                return this->outgoingPosition < this->outgoing.length();
+            }
+
+            /**
+             * @brief Non-blocking mode: Write as much of the outgoing
+             * queue as the socket accepts.
+             * 
+             * @return bool True if the queue became empty.
+             */
+            bool TryFlush() {
+                ssize_t result;
+
+                struct iovec iov;
+
+                while (this->outgoingPosition < this->outgoing.length()) {
+                    iov.iov_base = (void*)(this->outgoing.data() + this->outgoingPosition);
+                    iov.iov_len = this->outgoing.length() - this->outgoingPosition;
+                    result = this->SocketWrite(&iov, 1);
+
+                    if (result < 0) {
+                        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                            return false;
+                        } else if (errno == EINTR) {
+                            continue;
+                        }
+
+                        throw std::runtime_error("Failed to write to server. Error: '"
+                            + std::string(strerror(errno)) + "' (" + std::to_string(errno) + ")");
                     }
 
-                    std::memcpy(this->buffer + 2, pos, packetSize);
-                    this->WriteExact(packetSize + 2);
+                    this->outgoingPosition += result;
+                }
 
-                    remaining -= packetSize;
-                    pos += packetSize;
-                } while (remaining > 0);
+                this->outgoing.clear();
+                this->outgoingPosition = 0;
+
+                return true;
             }
     };
 }
@@ -0,0 +1,530 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include "Connection.hpp"
+#include "ConnectionSettings.hpp"
+#include "Deadline.hpp"
+#include "Handshake.hpp"
+#include "StringView.hpp"
+
+
+namespace MonetExplorer {
+    class ConnectionPool;
+
+    /**
+     * @brief The limits and policies of a connection pool.
+     */
+    struct PoolSettings {
+        size_t minIdle = 1;                 // Authenticated sessions kept warm
+        size_t maxSize = 8;                 // Idle + borrowed sessions
+        int acquireTimeoutMs = 5000;        // Bounded wait for a free session
+        int maxIdleMs = 300000;             // Idle sessions above minIdle are closed after this
+        int validateAfterIdleMs = 30000;    // Health check on acquire, if idle for longer. 0: always
+        int maintenanceIntervalMs = 1000;   // Period of the background eviction/refill. 0: no thread
+        std::string validationQuery = "sselect 1;";
+    };
+
+    /**
+     * @brief Counters for evaluating the efficiency of the pool.
+     */
+    struct PoolStats {
+        uint64_t acquired = 0;
+        uint64_t reused = 0;                // Acquires served by an idle session
+        uint64_t opened = 0;                // Full connect + authentication
+        uint64_t validations = 0;
+        uint64_t validationFailures = 0;
+        uint64_t discarded = 0;             // Broken sessions closed on release
+        uint64_t evicted = 0;               // Idle sessions closed by the maintenance
+        uint64_t timeouts = 0;
+    };
+
+    /**
+     * @brief An authenticated connection borrowed from a pool.
+     * Returned to the pool when destroyed. If it is destroyed
+     * while an exception is in flight, or it was invalidated,
+     * then the connection is closed instead of being reused.
+     */
+    class PooledConnection {
+        friend class ConnectionPool;
+
+        private:
+            ConnectionPool *pool = nullptr;
+            std::unique_ptr<Connection> connection;
+            bool broken = false;
+
+            PooledConnection(ConnectionPool *pool, std::unique_ptr<Connection> connection)
+                : pool(pool), connection(std::move(connection)) { }
+
+        public:
+            PooledConnection() { }
+            PooledConnection(PooledConnection &&other) : pool(other.pool),
+                connection(std::move(other.connection)), broken(other.broken) {
+                other.pool = nullptr;
+            }
+
+            PooledConnection(const PooledConnection&) = delete;
+            PooledConnection &operator=(const PooledConnection&) = delete;
+
+            inline PooledConnection &operator=(PooledConnection &&other);
+            inline ~PooledConnection();
+
+            /**
+             * @brief Send a message and receive the response. If the
+             * response is an error, then the connection is invalidated,
+             * because the server drops the state of the session.
+             *
+             * @param message
+             * @return StringView Valid until the next receive.
+             */
+            StringView Query(StringView message) {
+                try {
+                    this->connection->SendMessage(message);
+                    StringView response = this->connection->ReceiveMessageView();
+
+                    if (response.StartsWith("!") || !this->connection->IsConnected()) {
+                        this->broken = true;
+                    }
+
+                    return response;
+                } catch (...) {
+                    this->broken = true;
+                    throw;
+                }
+            }
+
+            /**
+             * @brief Mark the connection as unusable, so that
+             * it will be closed instead of returned to the pool.
+             */
+            void Invalidate() {
+                this->broken = true;
+            }
+
+            /**
+             * @brief Return the connection to the pool before
+             * the destruction of this object.
+             */
+            inline void Release();
+
+            /**
+             * @brief Get the underlying connection.
+             *
+             * @return Connection&
+             */
+            Connection &GetConnection() {
+                return *this->connection;
+            }
+
+            Connection *operator->() {
+                return this->connection.get();
+            }
+
+            /**
+             * @brief Returns true if a connection is held.
+             *
+             * @return bool
+             */
+            bool IsValid() const {
+                return this->connection != nullptr;
+            }
+    };
+
+    /**
+     * @brief A thread-safe pool of authenticated connections. The
+     * connect and the challenge/response authentication are done
+     * only when no idle session is available, so the handshake
+     * round trips are not paid for each request.
+     * All the borrowed connections must be returned before the
+     * pool is destroyed.
+     */
+    class ConnectionPool {
+        friend class PooledConnection;
+
+        private:
+            /**
+             * @brief An authenticated session waiting in the pool.
+             */
+            struct IdleEntry {
+                std::unique_ptr<Connection> connection;
+                std::chrono::steady_clock::time_point since;
+            };
+
+            ConnectionSettings settings;
+            PoolSettings poolSettings;
+            std::mutex mutex;
+            std::condition_variable available;
+            std::condition_variable stopping;
+            std::deque<IdleEntry> idle;         // The most recently used at the back
+            size_t total = 0;                   // Idle, borrowed and opening connections
+            bool closed = false;
+            PoolStats stats;
+            std::thread maintenance;
+
+            /**
+             * @brief Connect and authenticate a new session.
+             * Called without holding the lock.
+             *
+             * @return std::unique_ptr<Connection>
+             */
+            std::unique_ptr<Connection> Open() {
+                std::unique_ptr<Connection> connection(new Connection());
+                connection->SetSocketTuning(this->settings.tuning);
+                connection->SetTimeout(this->settings.timeoutMs);
+                connection->SetDeadline(Deadline::After(this->settings.connectTimeoutMs));
+
+                if (this->settings.unixDomainSocket) {
+                    connection->ConnectUnix(this->settings.GetSocketFilePath());
+                    connection->SendUnixDomainSocketInitByte();
+                } else {
+                    connection->ConnectTCP(this->settings.host, this->settings.port);
+                }
+
+                Handshake handshake(this->settings);
+                std::string reply;
+
+                while (true) {
+                    HandshakeStep step = handshake.Process(connection->ReceiveMessageView(), reply);
+
+                    if (step == HandshakeStep::Authenticated) {
+                        break;
+                    } else if (step == HandshakeStep::SendReply) {
+                        connection->SendMessage(reply);
+                    }
+                }
+
+                connection->SetDeadline(Deadline::Never());
+
+                return connection;
+            }
+
+            /**
+             * @brief Send the validation query. Called without holding the lock.
+             *
+             * @param connection
+             * @return bool True if the session is usable.
+             */
+            bool Validate(Connection &connection) {
+                try {
+                    connection.SendMessage(this->poolSettings.validationQuery);
+                    StringView response = connection.ReceiveMessageView();
+
+                    return connection.IsConnected() && !response.StartsWith("!");
+                } catch (std::runtime_error&) {
+                    return false;
+                }
+            }
+
+            /**
+             * @brief Take back a borrowed connection.
+             *
+             * @param connection
+             * @param broken If true, then the connection is closed.
+             */
+            void Release(std::unique_ptr<Connection> connection, bool broken) {
+                if (broken || !connection->IsConnected()) {
+                    connection.reset();
+
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    this->stats.discarded++;
+                    this->total--;
+                    this->available.notify_one();
+                    return;
+                }
+
+                std::lock_guard<std::mutex> lock(this->mutex);
+                IdleEntry entry;
+                entry.connection = std::move(connection);
+                entry.since = std::chrono::steady_clock::now();
+                this->idle.push_back(std::move(entry));
+                this->available.notify_one();
+            }
+
+            /**
+             * @brief The loop of the background thread.
+             */
+            void MaintenanceLoop() {
+                std::chrono::milliseconds interval(this->poolSettings.maintenanceIntervalMs);
+                std::unique_lock<std::mutex> lock(this->mutex);
+
+                while (!this->closed) {
+                    this->stopping.wait_for(lock, interval);
+                    if (this->closed) {
+                        break;
+                    }
+
+                    lock.unlock();
+
+                    try {
+                        this->Maintain();
+                    } catch (std::runtime_error&) {
+                        // The server is unavailable. Retried in the next round.
+                    }
+
+                    lock.lock();
+                }
+            }
+
+        public:
+            /**
+             * @brief Construct a new ConnectionPool object. Opens
+             * the minimal number of idle sessions.
+             *
+             * @param settings The parameters of the sessions.
+             * @param poolSettings The limits of the pool.
+             * @throw runtime_error If the first sessions cannot be opened.
+             */
+            ConnectionPool(const ConnectionSettings &settings, const PoolSettings &poolSettings = PoolSettings())
+                : settings(settings), poolSettings(poolSettings) {
+
+                if (poolSettings.maxSize == 0 || poolSettings.minIdle > poolSettings.maxSize) {
+                    throw std::runtime_error("ConnectionPool: The max size must be positive "
+                        "and not smaller than the min idle count.");
+                }
+
+                this->Maintain();
+
+                if (poolSettings.maintenanceIntervalMs > 0) {
+                    this->maintenance = std::thread(&ConnectionPool::MaintenanceLoop, this);
+                }
+            }
+
+            /**
+             * @brief Destroy the ConnectionPool object.
+             * Closes the idle connections.
+             */
+            ~ConnectionPool() {
+                {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    this->closed = true;
+                    this->stopping.notify_all();
+                    this->available.notify_all();
+                }
+
+                if (this->maintenance.joinable()) {
+                    this->maintenance.join();
+                }
+
+                this->idle.clear();
+            }
+
+            /**
+             * @brief Borrow an authenticated connection. Reuses an idle
+             * one if possible (validating it if it was idle for long),
+             * otherwise opens a new one, if the pool is not full.
+             *
+             * @param timeoutMs Maximal time to wait for a free session.
+             * Negative: use the value of the pool settings.
+             * @return PooledConnection
+             * @throw runtime_error On timeout, or if a new session
+             * cannot be opened.
+             */
+            PooledConnection Acquire(int timeoutMs = -1) {
+                if (timeoutMs < 0) {
+                    timeoutMs = this->poolSettings.acquireTimeoutMs;
+                }
+
+                auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+                std::unique_lock<std::mutex> lock(this->mutex);
+
+                while (true) {
+                    if (this->closed) {
+                        throw std::runtime_error("ConnectionPool::Acquire(): The pool is closed.");
+                    }
+
+                    if (!this->idle.empty()) {
+                        IdleEntry entry = std::move(this->idle.back());
+                        this->idle.pop_back();
+                        lock.unlock();
+
+                        auto idleTime = std::chrono::steady_clock::now() - entry.since;
+                        bool check = idleTime >= std::chrono::milliseconds(this->poolSettings.validateAfterIdleMs);
+                        bool valid = !check || this->Validate(*entry.connection);
+
+                        if (!valid) {
+                            entry.connection.reset();
+                        }
+
+                        lock.lock();
+
+                        if (check) {
+                            this->stats.validations++;
+                        }
+
+                        if (!valid) {
+                            this->stats.validationFailures++;
+                            this->total--;
+                            continue;
+                        }
+
+                        this->stats.acquired++;
+                        this->stats.reused++;
+
+                        return PooledConnection(this, std::move(entry.connection));
+                    }
+
+                    if (this->total < this->poolSettings.maxSize) {
+                        this->total++;
+                        lock.unlock();
+
+                        std::unique_ptr<Connection> connection;
+                        try {
+                            connection = this->Open();
+                        } catch (...) {
+                            lock.lock();
+                            this->total--;
+                            this->available.notify_one();
+                            throw;
+                        }
+
+                        lock.lock();
+                        this->stats.acquired++;
+                        this->stats.opened++;
+
+                        return PooledConnection(this, std::move(connection));
+                    }
+
+                    if (this->available.wait_until(lock, deadline) == std::cv_status::timeout
+                        && this->idle.empty() && this->total >= this->poolSettings.maxSize) {
+
+                        this->stats.timeouts++;
+                        throw TimeoutError("ConnectionPool::Acquire(): Timed out after "
+                            + std::to_string(timeoutMs) + " ms, all the "
+                            + std::to_string(this->poolSettings.maxSize) + " sessions are in use.");
+                    }
+                }
+            }
+
+            /**
+             * @brief Close the sessions that were idle for too long (keeping
+             * the minimal idle count), then open new ones until the minimal
+             * idle count is reached. Called periodically by the background
+             * thread, if there is one.
+             *
+             * @throw runtime_error If a new session cannot be opened.
+             */
+            void Maintain() {
+                std::deque<IdleEntry> expired;
+                std::unique_lock<std::mutex> lock(this->mutex);
+                auto limit = std::chrono::steady_clock::now() - std::chrono::milliseconds(this->poolSettings.maxIdleMs);
+
+                while (this->idle.size() > this->poolSettings.minIdle && this->idle.front().since < limit) {
+                    expired.push_back(std::move(this->idle.front()));
+                    this->idle.pop_front();
+                    this->total--;
+                    this->stats.evicted++;
+                }
+
+                while (!this->closed && this->idle.size() < this->poolSettings.minIdle
+                    && this->total < this->poolSettings.maxSize) {
+
+                    this->total++;
+                    lock.unlock();
+
+                    IdleEntry entry;
+                    try {
+                        entry.connection = this->Open();
+                    } catch (...) {
+                        lock.lock();
+                        this->total--;
+                        throw;
+                    }
+
+                    lock.lock();
+
+                    // Under the lock, so that the idle sessions stay ordered by
+                    // their 'since' times, which the eviction above relies on.
+                    entry.since = std::chrono::steady_clock::now();
+                    this->stats.opened++;
+                    this->idle.push_back(std::move(entry));
+                    this->available.notify_one();
+                }
+
+                lock.unlock();
+                expired.clear();
+            }
+
+            /**
+             * @brief Get a snapshot of the counters.
+             *
+             * @return PoolStats
+             */
+            PoolStats GetStats() {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                return this->stats;
+            }
+
+            /**
+             * @brief Get the number of idle sessions.
+             *
+             * @return size_t
+             */
+            size_t GetIdleCount() {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                return this->idle.size();
+            }
+
+            /**
+             * @brief Get the number of idle and borrowed sessions.
+             *
+             * @return size_t
+             */
+            size_t GetSize() {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                return this->total;
+            }
+    };
+
+    inline PooledConnection &PooledConnection::operator=(PooledConnection &&other) {
+        if (this != &other) {
+            this->Release();
+            this->pool = other.pool;
+            this->connection = std::move(other.connection);
+            this->broken = other.broken;
+            other.pool = nullptr;
+        }
+
+        return *this;
+    }
+
+    inline PooledConnection::~PooledConnection() {
+        if (std::uncaught_exception()) {
+            this->broken = true;
+        }
+
+        this->Release();
+    }
+
+    inline void PooledConnection::Release() {
+        if (this->pool != nullptr && this->connection != nullptr) {
+            this->pool->Release(std::move(this->connection), this->broken);
+        }
+
+        this->pool = nullptr;
+        this->connection.reset();
+        this->broken = false;
+    }
+}
@@ -0,0 +1,78 @@
+/*
+    Copyright 2020 Tamas Bolner
+    
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+    
+      http://www.apache.org/licenses/LICENSE-2.0
+    
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+#include <string>
+#include "CommandLine.hpp"
+#include "SocketTuning.hpp"
+
+
+namespace MonetExplorer {
+    /**
+     * @brief The parameters required for opening
+     * and authenticating a session.
+     */
+    struct ConnectionSettings {
+        std::string host = "127.0.0.1";
+        int port = 50000;
+        bool unixDomainSocket = false;
+        std::string user = "monetdb";
+        std::string password = "monetdb";
+        std::string database;
+        std::string authAlgo = "SHA1";
+        bool fileTransfer = false;
+        SocketTuning tuning;
+        int timeoutMs = -1;             // Limit of the individual operations. Negative: none
+        int connectTimeoutMs = -1;      // Limit of the connect and the authentication together
+
+        /**
+         * @brief Get the path of the Unix domain socket file,
+         * which belongs to the configured port.
+         * 
+         * @return std::string 
+         */
+        std::string GetSocketFilePath() const {
+            return "/tmp/.s.monetdb." + std::to_string(this->port);
+        }
+
+        /**
+         * @brief Create the settings from the command line arguments.
+         * 
+         * @param args Command line arguments.
+         * @return ConnectionSettings 
+         */
+        static ConnectionSettings FromArguments(CommandLine::Arguments &args) {
+            ConnectionSettings settings;
+
+            settings.host = args.GetStringValue("host");
+            settings.port = args.GetIntValue("port");
+            settings.unixDomainSocket = args.IsOptionSet("unix-domain-socket");
+            settings.user = args.GetStringValue("user");
+            settings.password = args.GetStringValue("password");
+            settings.database = args.GetStringValue("database");
+            settings.authAlgo = args.GetStringValue("auth-algo");
+            settings.fileTransfer = args.IsOptionSet("file-transfer");
+            settings.tuning = SocketTuning::FromArguments(args);
+
+            int timeoutMs = args.GetIntValue("timeout");
+            int connectTimeoutMs = args.GetIntValue("connect-timeout");
+            settings.timeoutMs = timeoutMs > 0 ? timeoutMs : -1;
+            settings.connectTimeoutMs = connectTimeoutMs > 0 ? connectTimeoutMs : -1;
+
+            return settings;
+        }
+    };
+}
@@ -0,0 +1,131 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+#include <chrono>
+#include <stdexcept>
+#include <string>
+
+
+namespace MonetExplorer {
+    /**
+     * @brief Thrown when an operation did not complete before its deadline.
+     * The connection is closed at that point, because its position
+     * inside the message stream is lost.
+     */
+    class TimeoutError : public std::runtime_error {
+        public:
+            explicit TimeoutError(const std::string &message) : std::runtime_error(message) { }
+    };
+
+    /**
+     * @brief A point in time until an operation (or a sequence
+     * of operations) has to complete. Based on the monotonic
+     * clock, so it is not affected by changes of the system time.
+     */
+    class Deadline {
+        private:
+            bool infinite = true;
+            std::chrono::steady_clock::time_point at;
+
+        public:
+            /**
+             * @brief Construct a deadline that never expires.
+             */
+            Deadline() { }
+
+            /**
+             * @brief A deadline that never expires.
+             *
+             * @return Deadline
+             */
+            static Deadline Never() {
+                return Deadline();
+            }
+
+            /**
+             * @brief A deadline relative to the current time.
+             *
+             * @param milliseconds Negative values mean no deadline.
+             * @return Deadline
+             */
+            static Deadline After(int milliseconds) {
+                Deadline deadline;
+
+                if (milliseconds >= 0) {
+                    deadline.infinite = false;
+                    deadline.at = std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds);
+                }
+
+                return deadline;
+            }
+
+            /**
+             * @brief Get the one which expires first.
+             *
+             * @param first
+             * @param second
+             * @return Deadline
+             */
+            static Deadline Earliest(const Deadline &first, const Deadline &second) {
+                if (first.infinite) {
+                    return second;
+                } else if (second.infinite) {
+                    return first;
+                }
+
+                return first.at <= second.at ? first : second;
+            }
+
+            /**
+             * @brief Returns true if the deadline never expires.
+             *
+             * @return bool
+             */
+            bool IsInfinite() const {
+                return this->infinite;
+            }
+
+            /**
+             * @brief Returns true if the deadline has passed.
+             *
+             * @return bool
+             */
+            bool IsExpired() const {
+                return !this->infinite && std::chrono::steady_clock::now() >= this->at;
+            }
+
+            /**
+             * @brief Get the remaining time in the format of the poll() timeout.
+             *
+             * @return int -1 for no deadline, otherwise the remaining
+             * milliseconds, rounded up. (0 if expired)
+             */
+            int GetRemainingMs() const {
+                if (this->infinite) {
+                    return -1;
+                }
+
+                auto remaining = this->at - std::chrono::steady_clock::now();
+                if (remaining <= std::chrono::steady_clock::duration::zero()) {
+                    return 0;
+                }
+
+                return (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+                    remaining + std::chrono::milliseconds(1) - std::chrono::nanoseconds(1)).count();
+            }
+    };
+}
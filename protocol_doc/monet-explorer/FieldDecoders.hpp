@@ -0,0 +1,145 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include "ColumnarResult.hpp"
+#include "StringView.hpp"
+#include "ValueParser.hpp"
+
+
+namespace MonetExplorer {
+    /**
+     * @brief The compile-time description of the fixed-width storage
+     * types: the C++ type of the values, and the parser of the fields.
+     * One specialization per type, so the decoder loops instantiated
+     * from them contain the parser inlined, without any dispatching.
+     *
+     * @tparam Type
+     */
+    template<ColumnType Type>
+    struct FieldDecoder;
+
+    /**
+     * @brief Common part of the integer decoders, with range checking.
+     *
+     * @tparam T The storage type.
+     */
+    template<typename T>
+    struct IntegerFieldDecoder {
+        typedef T Value;
+
+        static inline bool Decode(StringView field, int &, Value &value) {
+            int64_t result;
+
+            if (!ValueParser::ParseInt64(field, result) || result < std::numeric_limits<T>::min()
+                || result > std::numeric_limits<T>::max()) {
+
+                return false;
+            }
+
+            value = (T)result;
+            return true;
+        }
+    };
+
+    template<>
+    struct FieldDecoder<ColumnType::Boolean> {
+        typedef bool Value;
+
+        static inline bool Decode(StringView field, int &, Value &value) {
+            return ValueParser::ParseBoolean(field, value);
+        }
+    };
+
+    template<>
+    struct FieldDecoder<ColumnType::TinyInt> : IntegerFieldDecoder<int8_t> { };
+
+    template<>
+    struct FieldDecoder<ColumnType::SmallInt> : IntegerFieldDecoder<int16_t> { };
+
+    template<>
+    struct FieldDecoder<ColumnType::Int> : IntegerFieldDecoder<int32_t> { };
+
+    template<>
+    struct FieldDecoder<ColumnType::BigInt> {
+        typedef int64_t Value;
+
+        static inline bool Decode(StringView field, int &, Value &value) {
+            // The oid values are also stored as BigInt. They are sent with a '@0' suffix.
+            if (field.length > 2 && field.data[field.length - 1] == '0' && field.data[field.length - 2] == '@') {
+                field.length -= 2;
+            }
+
+            return ValueParser::ParseInt64(field, value);
+        }
+    };
+
+    template<>
+    struct FieldDecoder<ColumnType::HugeInt> {
+        typedef HugeInt Value;
+
+        static inline bool Decode(StringView field, int &, Value &value) {
+            return ValueParser::ParseHugeInt(field, value);
+        }
+    };
+
+    template<>
+    struct FieldDecoder<ColumnType::Decimal> {
+        typedef HugeInt Value;
+
+        static inline bool Decode(StringView field, int &scale, Value &value) {
+            return ValueParser::ParseDecimal(field, scale, value);
+        }
+    };
+
+    template<>
+    struct FieldDecoder<ColumnType::Double> {
+        typedef double Value;
+
+        static inline bool Decode(StringView field, int &, Value &value) {
+            return ValueParser::ParseDouble(field, value);
+        }
+    };
+
+    template<>
+    struct FieldDecoder<ColumnType::Date> {
+        typedef int32_t Value;
+
+        static inline bool Decode(StringView field, int &, Value &value) {
+            return ValueParser::ParseDate(field, value);
+        }
+    };
+
+    template<>
+    struct FieldDecoder<ColumnType::Time> {
+        typedef int64_t Value;
+
+        static inline bool Decode(StringView field, int &, Value &value) {
+            return ValueParser::ParseTime(field, value);
+        }
+    };
+
+    template<>
+    struct FieldDecoder<ColumnType::Timestamp> {
+        typedef int64_t Value;
+
+        static inline bool Decode(StringView field, int &, Value &value) {
+            return ValueParser::ParseTimestamp(field, value);
+        }
+    };
+}
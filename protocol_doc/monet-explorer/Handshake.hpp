@@ -0,0 +1,97 @@
+/*
+    Copyright 2020 Tamas Bolner
+    
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+    
+      http://www.apache.org/licenses/LICENSE-2.0
+    
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+#include <stdexcept>
+#include <string>
+#include "ConnectionSettings.hpp"
+#include "ServerChallenge.hpp"
+#include "StringView.hpp"
+
+
+namespace MonetExplorer {
+    /**
+     * @brief What the client has to do after a message
+     * was processed by the handshake.
+     */
+    enum class HandshakeStep : int {
+        SendReply = 1,      // Send the reply, then read the next message
+        ReadAgain = 2,      // Read the next message (Merovingian redirect)
+        Authenticated = 3
+    };
+
+    /**
+     * @brief The state machine of the authentication.
+     * It does no I/O, so it can be driven by both
+     * blocking and non-blocking connections.
+     * See: protocol_doc chapter 3.
+     */
+    class Handshake {
+        private:
+            ConnectionSettings settings;
+            int redirectCount = 0;
+
+        public:
+            /**
+             * @brief The maximal number of Merovingian redirects
+             * before the authentication is considered failed.
+             */
+            static const int MAX_REDIRECTS = 10;
+
+            /**
+             * @brief Construct a new Handshake object
+             * 
+             * @param settings The user name, password, etc. to authenticate with.
+             */
+            Handshake(const ConnectionSettings &settings) : settings(settings) { }
+
+            /**
+             * @brief Process a message received from the server
+             * during the authentication.
+             * 
+             * @param msg The received message.
+             * @param reply Output: the message to be sent to the server,
+             * if the returned step is SendReply.
+             * @return HandshakeStep 
+             * @throw runtime_error If the authentication failed.
+             */
+            HandshakeStep Process(StringView msg, std::string &reply) {
+                if (msg.StartsWith("^mapi:merovingian:")) {
+                    this->redirectCount++;
+                    if (this->redirectCount > MAX_REDIRECTS) {
+                        throw std::runtime_error("Authentication failed: Too many Merovingian redirects.");
+                    }
+
+                    return HandshakeStep::ReadAgain;
+                } else if (msg.IsEmpty()) {
+                    return HandshakeStep::Authenticated;
+                } else if (msg.StartsWith("!")) {
+                    throw std::runtime_error("Authentication failed: " + msg.ToString());
+                }
+
+                ServerChallenge challenge(msg.ToString());
+                reply = challenge.Authenticate(
+                    this->settings.user,
+                    this->settings.password,
+                    this->settings.database,
+                    this->settings.authAlgo,
+                    this->settings.fileTransfer
+                );
+
+                return HandshakeStep::SendReply;
+            }
+    };
+}
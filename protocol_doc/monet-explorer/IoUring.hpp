@@ -0,0 +1,611 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+/*
+    The io_uring transport is compiled only if the kernel headers
+    support multishot receives with provided buffer rings. (Linux 6.0+)
+*/
+#if defined(__linux__) && defined(__has_include)
+    #if __has_include(<linux/io_uring.h>)
+        #include <linux/io_uring.h>
+        // Added in Linux 6.0, after the provided buffer rings. (5.19)
+        #ifdef IORING_RECV_MULTISHOT
+            #define MONET_EXPLORER_IO_URING 1
+        #endif
+    #endif
+#endif
+
+#ifdef MONET_EXPLORER_IO_URING
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include "Deadline.hpp"
+#include "Transport.hpp"
+
+
+namespace MonetExplorer {
+    /**
+     * @brief A transport based on io_uring. Each socket gets a multishot
+     * receive, which keeps filling buffers from a registered (provided)
+     * buffer ring as the data arrives, without further submissions.
+     * The reads are then served from the completed buffers, and only
+     * wait in the kernel if no data is there yet. A single instance can
+     * serve many connections, but only from a single thread.
+     */
+    class UringTransport : public Transport {
+        private:
+            // Tags in the user data of the submissions
+            static const uint64_t WRITE_TAG = 1ULL << 63;
+            static const uint64_t CANCEL_TAG = 1ULL << 62;
+            static const uint16_t BUFFER_GROUP = 0;
+
+            /**
+             * @brief A received piece of data inside a provided buffer.
+             */
+            struct Chunk {
+                uint16_t bufferId;
+                uint32_t offset;
+                uint32_t length;
+            };
+
+            /**
+             * @brief The receive state of a socket.
+             */
+            struct Stream {
+                uint32_t generation = 0;    // Distinguishes sockets that reuse the same descriptor
+                bool armed = false;         // The multishot receive is active
+                bool ended = false;
+                int error = 0;
+                std::deque<Chunk> chunks;
+            };
+
+            int ringFd = -1;
+
+            // Submission queue
+            void *sqRing = MAP_FAILED;
+            size_t sqRingSize = 0;
+            unsigned *sqHead = nullptr;
+            unsigned *sqTail = nullptr;
+            unsigned *sqMask = nullptr;
+            unsigned *sqArray = nullptr;
+            unsigned sqEntries = 0;
+            struct io_uring_sqe *sqes = (struct io_uring_sqe*)MAP_FAILED;
+            size_t sqesSize = 0;
+            unsigned pendingSubmissions = 0;
+
+            // Completion queue
+            void *cqRing = MAP_FAILED;
+            size_t cqRingSize = 0;
+            unsigned *cqHead = nullptr;
+            unsigned *cqTail = nullptr;
+            unsigned *cqMask = nullptr;
+            struct io_uring_cqe *cqes = nullptr;
+
+            // Provided buffers
+            struct io_uring_buf_ring *bufferRing = (struct io_uring_buf_ring*)MAP_FAILED;
+            size_t bufferRingSize = 0;
+            char *bufferArea = (char*)MAP_FAILED;
+            unsigned bufferCount = 0;
+            unsigned bufferSize = 0;
+            uint16_t bufferTail = 0;
+
+            std::unordered_map<int, Stream> streams;
+            uint32_t nextGeneration = 1;
+            bool writeDone = false;
+            int writeResult = 0;
+
+            /**
+             * @brief Throw an exception with the details of errno,
+             * after releasing the resources.
+             *
+             * @param message
+             */
+            void Fail(const std::string &message) {
+                int error = errno;
+                this->Cleanup();
+
+                throw std::runtime_error(message + " Error: '" + std::string(strerror(error))
+                    + "' (" + std::to_string(error) + ")");
+            }
+
+            /**
+             * @brief Release the mapped memory and the ring.
+             */
+            void Cleanup() {
+                if (this->bufferArea != MAP_FAILED) {
+                    munmap(this->bufferArea, (size_t)this->bufferCount * this->bufferSize);
+                    this->bufferArea = (char*)MAP_FAILED;
+                }
+
+                if (this->bufferRing != MAP_FAILED) {
+                    munmap(this->bufferRing, this->bufferRingSize);
+                    this->bufferRing = (struct io_uring_buf_ring*)MAP_FAILED;
+                }
+
+                if (this->sqes != MAP_FAILED) {
+                    munmap(this->sqes, this->sqesSize);
+                    this->sqes = (struct io_uring_sqe*)MAP_FAILED;
+                }
+
+                if (this->cqRing != MAP_FAILED && this->cqRing != this->sqRing) {
+                    munmap(this->cqRing, this->cqRingSize);
+                }
+
+                this->cqRing = MAP_FAILED;
+
+                if (this->sqRing != MAP_FAILED) {
+                    munmap(this->sqRing, this->sqRingSize);
+                    this->sqRing = MAP_FAILED;
+                }
+
+                if (this->ringFd > -1) {
+                    close(this->ringFd);
+                    this->ringFd = -1;
+                }
+            }
+
+            /**
+             * @brief Give a buffer back to the kernel, so
+             * that it can be filled again.
+             *
+             * @param bufferId
+             */
+            void RecycleBuffer(uint16_t bufferId) {
+                /*
+                    Not using bufferRing->bufs, because __DECLARE_FLEX_ARRAY
+                    adds an empty struct before it, which takes space in C++.
+                */
+                struct io_uring_buf *buffer = (struct io_uring_buf*)this->bufferRing
+                    + (this->bufferTail & (this->bufferCount - 1));
+
+                buffer->addr = (uint64_t)(uintptr_t)(this->bufferArea + (size_t)bufferId * this->bufferSize);
+                buffer->len = this->bufferSize;
+                buffer->bid = bufferId;
+
+                this->bufferTail++;
+                __atomic_store_n(&this->bufferRing->tail, this->bufferTail, __ATOMIC_RELEASE);
+            }
+
+            /**
+             * @brief Get the next free submission queue entry.
+             * Submits the queue first if it is full.
+             *
+             * @return struct io_uring_sqe*
+             */
+            struct io_uring_sqe *GetSubmission() {
+                unsigned tail = *this->sqTail;
+
+                if (tail - __atomic_load_n(this->sqHead, __ATOMIC_ACQUIRE) >= this->sqEntries) {
+                    this->Enter(0);
+                    tail = *this->sqTail;
+                }
+
+                unsigned index = tail & *this->sqMask;
+                struct io_uring_sqe *sqe = &this->sqes[index];
+                std::memset(sqe, 0, sizeof(*sqe));
+                this->sqArray[index] = index;
+
+                return sqe;
+            }
+
+            /**
+             * @brief Make the last entry returned by GetSubmission()
+             * visible to the kernel.
+             */
+            void CommitSubmission() {
+                __atomic_store_n(this->sqTail, *this->sqTail + 1, __ATOMIC_RELEASE);
+                this->pendingSubmissions++;
+            }
+
+            /**
+             * @brief Submit the pending entries, and optionally
+             * wait for completions.
+             *
+             * @param minComplete The number of completions to wait for.
+             * @param timeoutMs The maximal time to wait. -1: no limit.
+             */
+            void Enter(unsigned minComplete, int timeoutMs = -1) {
+                struct __kernel_timespec timeout;
+                struct io_uring_getevents_arg extension;
+                unsigned flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+                void *argument = nullptr;
+                size_t argumentSize = 0;
+                int result;
+
+                if (minComplete > 0 && timeoutMs >= 0) {
+                    timeout.tv_sec = timeoutMs / 1000;
+                    timeout.tv_nsec = (timeoutMs % 1000) * 1000000LL;
+
+                    std::memset(&extension, 0, sizeof(extension));
+                    extension.ts = (uint64_t)(uintptr_t)&timeout;
+
+                    flags |= IORING_ENTER_EXT_ARG;
+                    argument = &extension;
+                    argumentSize = sizeof(extension);
+                }
+
+                do {
+                    result = syscall(__NR_io_uring_enter, this->ringFd, this->pendingSubmissions,
+                        minComplete, flags, argument, argumentSize);
+                    this->systemCalls++;
+                } while (result < 0 && errno == EINTR);
+
+                if (result < 0 && errno == ETIME) {
+                    // Timed out. The caller checks its deadline.
+                    return;
+                } else if (result < 0) {
+                    throw std::runtime_error("Failed to submit to io_uring. Error: '"
+                        + std::string(strerror(errno)) + "' (" + std::to_string(errno) + ")");
+                }
+
+                this->pendingSubmissions -= std::min((unsigned)result, this->pendingSubmissions);
+            }
+
+            /**
+             * @brief Arm the multishot receive of a socket.
+             *
+             * @param fd
+             * @param stream
+             */
+            void ArmReceive(int fd, Stream &stream) {
+                struct io_uring_sqe *sqe = this->GetSubmission();
+
+                sqe->opcode = IORING_OP_RECV;
+                sqe->fd = fd;
+                sqe->ioprio = IORING_RECV_MULTISHOT;
+                sqe->flags = IOSQE_BUFFER_SELECT;
+                sqe->buf_group = BUFFER_GROUP;
+                sqe->user_data = ((uint64_t)stream.generation << 32) | (uint32_t)fd;
+
+                this->CommitSubmission();
+                stream.armed = true;
+            }
+
+            /**
+             * @brief Process all the available completions.
+             *
+             * @return int The number of completions processed.
+             */
+            int ReapCompletions() {
+                unsigned head = *this->cqHead;
+                unsigned tail = __atomic_load_n(this->cqTail, __ATOMIC_ACQUIRE);
+                int count = 0;
+
+                for (; head != tail; head++, count++) {
+                    this->Dispatch(this->cqes[head & *this->cqMask]);
+                }
+
+                __atomic_store_n(this->cqHead, head, __ATOMIC_RELEASE);
+
+                return count;
+            }
+
+            /**
+             * @brief Process a single completion.
+             *
+             * @param cqe
+             */
+            void Dispatch(const struct io_uring_cqe &cqe) {
+                if (cqe.user_data & WRITE_TAG) {
+                    this->writeDone = true;
+                    this->writeResult = cqe.res;
+                    return;
+                } else if (cqe.user_data & CANCEL_TAG) {
+                    return;
+                }
+
+                bool hasBuffer = (cqe.flags & IORING_CQE_F_BUFFER) != 0;
+                uint16_t bufferId = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+                auto item = this->streams.find((int)(uint32_t)cqe.user_data);
+
+                if (item == this->streams.end() || item->second.generation != (uint32_t)(cqe.user_data >> 32)) {
+                    // Completion of a released socket
+                    if (hasBuffer) {
+                        this->RecycleBuffer(bufferId);
+                    }
+
+                    return;
+                }
+
+                Stream &stream = item->second;
+
+                if ((cqe.flags & IORING_CQE_F_MORE) == 0) {
+                    // The multishot receive terminated. Re-armed by the next read if required.
+                    stream.armed = false;
+                }
+
+                if (cqe.res > 0 && hasBuffer) {
+                    Chunk chunk;
+                    chunk.bufferId = bufferId;
+                    chunk.offset = 0;
+                    chunk.length = cqe.res;
+                    stream.chunks.push_back(chunk);
+                } else if (cqe.res == 0) {
+                    stream.ended = true;
+                } else if (cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {
+                    stream.error = -cqe.res;
+                }
+            }
+
+        public:
+            /**
+             * @brief Construct a new UringTransport object
+             *
+             * @param entries The size of the submission queue.
+             * @param bufferCount The number of receive buffers. Must be a power of 2.
+             * @param bufferSize The size of a receive buffer in bytes.
+             * @throw runtime_error If io_uring is not available.
+             */
+            UringTransport(unsigned entries = 256, unsigned bufferCount = 256, unsigned bufferSize = 65536) {
+                if (bufferCount == 0 || bufferCount > 32768 || (bufferCount & (bufferCount - 1)) != 0) {
+                    throw std::runtime_error("UringTransport: The buffer count must be a power of 2, "
+                        "not larger than 32768.");
+                }
+
+                struct io_uring_params params;
+                std::memset(&params, 0, sizeof(params));
+
+                this->ringFd = syscall(__NR_io_uring_setup, entries, &params);
+                if (this->ringFd < 0) {
+                    this->Fail("Failed to create io_uring instance.");
+                }
+
+                /*
+                    Map the rings
+                */
+                this->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+                this->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+                if (params.features & IORING_FEAT_SINGLE_MMAP) {
+                    this->sqRingSize = std::max(this->sqRingSize, this->cqRingSize);
+                    this->cqRingSize = this->sqRingSize;
+                }
+
+                this->sqRing = mmap(nullptr, this->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    this->ringFd, IORING_OFF_SQ_RING);
+                if (this->sqRing == MAP_FAILED) {
+                    this->Fail("Failed to map the io_uring submission queue.");
+                }
+
+                if (params.features & IORING_FEAT_SINGLE_MMAP) {
+                    this->cqRing = this->sqRing;
+                } else {
+                    this->cqRing = mmap(nullptr, this->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        this->ringFd, IORING_OFF_CQ_RING);
+                    if (this->cqRing == MAP_FAILED) {
+                        this->Fail("Failed to map the io_uring completion queue.");
+                    }
+                }
+
+                this->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+                this->sqes = (struct io_uring_sqe*)mmap(nullptr, this->sqesSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, this->ringFd, IORING_OFF_SQES);
+                if (this->sqes == MAP_FAILED) {
+                    this->Fail("Failed to map the io_uring submission entries.");
+                }
+
+                char *sq = (char*)this->sqRing;
+                this->sqHead = (unsigned*)(sq + params.sq_off.head);
+                this->sqTail = (unsigned*)(sq + params.sq_off.tail);
+                this->sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+                this->sqArray = (unsigned*)(sq + params.sq_off.array);
+                this->sqEntries = params.sq_entries;
+
+                char *cq = (char*)this->cqRing;
+                this->cqHead = (unsigned*)(cq + params.cq_off.head);
+                this->cqTail = (unsigned*)(cq + params.cq_off.tail);
+                this->cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+                this->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+                /*
+                    Register the provided buffer ring
+                */
+                this->bufferCount = bufferCount;
+                this->bufferSize = bufferSize;
+                this->bufferRingSize = bufferCount * sizeof(struct io_uring_buf);
+
+                this->bufferRing = (struct io_uring_buf_ring*)mmap(nullptr, this->bufferRingSize,
+                    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (this->bufferRing == MAP_FAILED) {
+                    this->Fail("Failed to allocate the io_uring buffer ring.");
+                }
+
+                this->bufferArea = (char*)mmap(nullptr, (size_t)bufferCount * bufferSize,
+                    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (this->bufferArea == MAP_FAILED) {
+                    this->Fail("Failed to allocate the io_uring receive buffers.");
+                }
+
+                struct io_uring_buf_reg registration;
+                std::memset(&registration, 0, sizeof(registration));
+                registration.ring_addr = (uint64_t)(uintptr_t)this->bufferRing;
+                registration.ring_entries = bufferCount;
+                registration.bgid = BUFFER_GROUP;
+
+                if (syscall(__NR_io_uring_register, this->ringFd, IORING_REGISTER_PBUF_RING, &registration, 1) != 0) {
+                    this->Fail("Failed to register the io_uring buffer ring.");
+                }
+
+                for (unsigned i = 0; i < bufferCount; i++) {
+                    this->RecycleBuffer(i);
+                }
+            }
+
+            /**
+             * @brief Destroy the UringTransport object. The connections
+             * using it must be closed first.
+             */
+            ~UringTransport() {
+                this->Cleanup();
+            }
+
+            ssize_t Read(int fd, const struct iovec *vectors, int count, int timeoutMs) override {
+                Deadline deadline = Deadline::After(timeoutMs);
+                auto item = this->streams.find(fd);
+                if (item == this->streams.end()) {
+                    item = this->streams.insert({ fd, Stream() }).first;
+                    item->second.generation = this->nextGeneration;
+                    this->nextGeneration = (this->nextGeneration + 1) & 0x3FFFFFFF;
+                }
+
+                Stream &stream = item->second;
+
+                /*
+                    Wait for data
+                */
+                while (stream.chunks.empty()) {
+                    if (stream.error != 0) {
+                        errno = stream.error;
+                        stream.error = 0;
+                        return -1;
+                    } else if (stream.ended) {
+                        return 0;
+                    }
+
+                    if (!stream.armed) {
+                        this->ArmReceive(fd, stream);
+                    }
+
+                    if (this->ReapCompletions() == 0) {
+                        if (deadline.IsExpired()) {
+                            // The receive stays armed, the data arriving later is kept.
+                            errno = ETIMEDOUT;
+                            return -1;
+                        }
+
+                        this->Enter(1, deadline.GetRemainingMs());
+                    }
+                }
+
+                /*
+                    Copy from the received buffers
+                */
+                ssize_t total = 0;
+                size_t vectorOffset = 0;
+                int vector = 0;
+
+                while (vector < count && !stream.chunks.empty()) {
+                    Chunk &chunk = stream.chunks.front();
+                    size_t size = std::min((size_t)chunk.length, vectors[vector].iov_len - vectorOffset);
+
+                    std::memcpy((char*)vectors[vector].iov_base + vectorOffset,
+                        this->bufferArea + (size_t)chunk.bufferId * this->bufferSize + chunk.offset, size);
+
+                    chunk.offset += size;
+                    chunk.length -= size;
+                    vectorOffset += size;
+                    total += size;
+
+                    if (chunk.length == 0) {
+                        this->RecycleBuffer(chunk.bufferId);
+                        stream.chunks.pop_front();
+                    }
+
+                    if (vectorOffset == vectors[vector].iov_len) {
+                        vector++;
+                        vectorOffset = 0;
+                    }
+                }
+
+                return total;
+            }
+
+            ssize_t Write(int fd, const struct iovec *vectors, int count, int timeoutMs) override {
+                Deadline deadline = Deadline::After(timeoutMs);
+                bool cancelled = false;
+                struct io_uring_sqe *sqe = this->GetSubmission();
+
+                sqe->opcode = IORING_OP_WRITEV;
+                sqe->fd = fd;
+                sqe->addr = (uint64_t)(uintptr_t)vectors;
+                sqe->len = count;
+                sqe->user_data = WRITE_TAG;
+
+                this->CommitSubmission();
+                this->writeDone = false;
+
+                while (!this->writeDone) {
+                    if (this->ReapCompletions() > 0) {
+                        continue;
+                    }
+
+                    if (!cancelled && deadline.IsExpired()) {
+                        // The vectors must stay valid until the write completes.
+                        sqe = this->GetSubmission();
+                        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                        sqe->addr = WRITE_TAG;
+                        sqe->user_data = CANCEL_TAG;
+
+                        this->CommitSubmission();
+                        cancelled = true;
+                    }
+
+                    this->Enter(1, cancelled ? -1 : deadline.GetRemainingMs());
+                }
+
+                if (cancelled && (this->writeResult == -ECANCELED || this->writeResult == -EINTR)) {
+                    errno = ETIMEDOUT;
+                    return -1;
+                } else if (this->writeResult < 0) {
+                    errno = -this->writeResult;
+                    return -1;
+                }
+
+                return this->writeResult;
+            }
+
+            void Release(int fd) override {
+                auto item = this->streams.find(fd);
+                if (item == this->streams.end()) {
+                    return;
+                }
+
+                Stream &stream = item->second;
+
+                if (stream.armed) {
+                    struct io_uring_sqe *sqe = this->GetSubmission();
+
+                    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                    sqe->addr = ((uint64_t)stream.generation << 32) | (uint32_t)fd;
+                    sqe->user_data = CANCEL_TAG;
+
+                    this->CommitSubmission();
+                    this->Enter(0);
+                }
+
+                for (const Chunk &chunk : stream.chunks) {
+                    this->RecycleBuffer(chunk.bufferId);
+                }
+
+                this->streams.erase(item);
+            }
+
+            const char *GetName() const override {
+                return "io_uring";
+            }
+    };
+}
+
+#endif
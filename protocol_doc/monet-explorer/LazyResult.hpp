@@ -0,0 +1,317 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "ColumnarDecoder.hpp"
+#include "ColumnarResult.hpp"
+#include "FieldDecoders.hpp"
+#include "ResponseParser.hpp"
+#include "StringArena.hpp"
+#include "StringView.hpp"
+#include "TupleSplitter.hpp"
+#include "Unescaper.hpp"
+#include "ValueParser.hpp"
+
+
+namespace MonetExplorer {
+    /**
+     * @brief When the tuples of a result are decoded.
+     */
+    enum class MaterializationPolicy : int {
+        Eager = 1,  // All of them at once, into typed columns. (ColumnarDecoder) Best for full scans.
+        Lazy = 2    // Each row when it is first accessed. (LazyResult) Best for sparse access.
+    };
+
+    /**
+     * @brief Parse the name of a policy.
+     *
+     * @param name "eager" or "lazy".
+     * @return MaterializationPolicy
+     * @throw runtime_error If the name is invalid.
+     */
+    inline MaterializationPolicy ParseMaterializationPolicy(const std::string &name) {
+        if (name == "eager") {
+            return MaterializationPolicy::Eager;
+        } else if (name == "lazy") {
+            return MaterializationPolicy::Lazy;
+        }
+
+        throw std::runtime_error("Invalid materialization policy: '" + name + "'. "
+            "The supported values are: eager, lazy.");
+    }
+
+    /**
+     * @brief Counters of the lazy materialization.
+     */
+    struct LazyStats {
+        uint64_t rowsParsed = 0;
+        uint64_t stringsUnescaped = 0;
+    };
+
+    /**
+     * @brief A result whose rows are only decoded when accessed. Loading
+     * it just indexes the line starts in one memchr() pass. The first
+     * access to a row splits it into fields, and the first access to an
+     * escaped string value unescapes it into an arena. Both are cached,
+     * so the repeated accesses are cheap. The numeric values are parsed
+     * on each access, because that costs about as much as a lookup.
+     * The tuples are referenced, not copied: the received message must
+     * outlive the object (or the next Load() call).
+     */
+    class LazyResult {
+        private:
+            static const uint32_t NOT_PARSED = UINT32_MAX;
+
+            StringView tuples;
+            std::vector<std::string> names;
+            std::vector<ColumnType> types;
+            std::vector<int> scales;
+            std::vector<uint32_t> lineStarts;   // One more item than the rows: the end of the last one
+            std::vector<uint32_t> rowCells;     // The index of the first cell of each row, or NOT_PARSED
+            std::vector<FieldSpan> cells;       // The fields of the parsed rows. Offsets relative to 'tuples'.
+            std::vector<StringView> strings;    // The unescaped values, for the cells which have one
+            std::vector<bool> hasString;
+            TupleSplitter splitter;
+            Unescaper unescaper;
+            SplitPage page;
+            StringArena arena;
+            LazyStats stats;
+
+            /**
+             * @brief Check the position of a cell.
+             *
+             * @param row
+             * @param column
+             */
+            void CheckIndex(size_t row, size_t column) const {
+                if (row >= this->GetRowCount() || column >= this->types.size()) {
+                    throw std::runtime_error("LazyResult: Cell index out of range: row " + std::to_string(row)
+                        + ", column " + std::to_string(column) + ".");
+                }
+            }
+
+            /**
+             * @brief Get the index of a cell, parsing its row at the first access.
+             *
+             * @param row
+             * @param column
+             * @return size_t
+             */
+            size_t GetCell(size_t row, size_t column) {
+                this->CheckIndex(row, column);
+
+                if (this->rowCells[row] != NOT_PARSED) {
+                    return this->rowCells[row] + column;
+                }
+
+                uint32_t start = this->lineStarts[row];
+                StringView line(this->tuples.data + start, this->lineStarts[row + 1] - start);
+                this->splitter.Split(line, this->types.size(), this->page);
+
+                size_t first = this->cells.size();
+                for (const FieldSpan &span : this->page.fields) {
+                    FieldSpan cell = span;
+                    cell.offset += start;
+                    this->cells.push_back(cell);
+                }
+
+                this->strings.resize(this->cells.size());
+                this->hasString.resize(this->cells.size(), false);
+                this->rowCells[row] = (uint32_t)first;
+                this->stats.rowsParsed++;
+
+                return first + column;
+            }
+
+        public:
+            /**
+             * @brief Construct a new LazyResult object
+             *
+             * @param kernel The SIMD kernel of the splitting and unescaping.
+             */
+            LazyResult(SimdKernel kernel = GetBestKernel()) : splitter(kernel), unescaper(kernel) { }
+
+            /**
+             * @brief Index the rows of a result. The previous content is
+             * discarded, but the allocations are reused.
+             *
+             * @param result A parsed &1 response or &6 block, with the
+             * columns from the header of the result.
+             */
+            void Load(const ParsedResult &result) {
+                if (result.tuples.length > UINT32_MAX) {
+                    throw std::runtime_error("LazyResult::Load(): The page is larger than 4 GiB.");
+                }
+
+                this->tuples = result.tuples;
+                this->names.resize(result.columns.size());
+                this->types.resize(result.columns.size());
+                this->scales.resize(result.columns.size());
+
+                for (size_t i = 0; i < result.columns.size(); i++) {
+                    this->names[i] = result.columns[i].name.ToString();
+                    this->types[i] = MonetExplorer::GetColumnType(result.columns[i], this->scales[i]);
+                }
+
+                this->lineStarts.clear();
+                this->cells.clear();
+                this->strings.clear();
+                this->hasString.clear();
+                this->arena.Clear();
+
+                const char *position = this->tuples.data;
+                const char *end = this->tuples.data + this->tuples.length;
+
+                while (position < end) {
+                    this->lineStarts.push_back((uint32_t)(position - this->tuples.data));
+
+                    const char *newLine = (const char*)memchr(position, '\n', end - position);
+                    position = newLine == nullptr ? end : newLine + 1;
+                }
+
+                this->lineStarts.push_back((uint32_t)this->tuples.length);
+                this->rowCells.assign(this->lineStarts.size() - 1, (uint32_t)NOT_PARSED);
+            }
+
+            size_t GetRowCount() const {
+                return this->rowCells.size();
+            }
+
+            size_t GetColumnCount() const {
+                return this->types.size();
+            }
+
+            const std::string &GetColumnName(size_t column) const {
+                return this->names.at(column);
+            }
+
+            ColumnType GetColumnType(size_t column) const {
+                return this->types.at(column);
+            }
+
+            /**
+             * @brief Get a raw field. (Quoted and escaped, if it is a string.)
+             *
+             * @param row
+             * @param column
+             * @return StringView
+             */
+            StringView GetField(size_t row, size_t column) {
+                const FieldSpan &cell = this->cells[this->GetCell(row, column)];
+                return StringView(this->tuples.data + cell.offset, cell.length);
+            }
+
+            /**
+             * @brief Returns true if the value is NULL.
+             *
+             * @param row
+             * @param column
+             * @return bool
+             */
+            bool IsNull(size_t row, size_t column) {
+                return ResponseParser::IsNull(this->GetField(row, column));
+            }
+
+            /**
+             * @brief Get a value as text: the strings without the quotes
+             * and escape sequences, the other types as they were received.
+             *
+             * @param row
+             * @param column
+             * @return StringView Empty for NULL.
+             */
+            StringView GetString(size_t row, size_t column) {
+                size_t index = this->GetCell(row, column);
+
+                if (this->hasString[index]) {
+                    return this->strings[index];
+                }
+
+                const FieldSpan &cell = this->cells[index];
+                StringView field(this->tuples.data + cell.offset, cell.length);
+
+                if (ResponseParser::IsNull(field)) {
+                    return StringView();
+                }
+
+                if (!cell.escaped) {
+                    return ValueParser::Unquote(field);
+                }
+
+                this->strings[index] = this->unescaper.Unescape(field, this->arena);
+                this->hasString[index] = true;
+                this->stats.stringsUnescaped++;
+
+                return this->strings[index];
+            }
+
+            /**
+             * @brief Get a typed value.
+             *
+             * @tparam Type The storage type of the column.
+             * @param row
+             * @param column
+             * @param value Output. Unchanged for NULL.
+             * @return bool False for NULL.
+             * @throw runtime_error If the column has a different type, or the value is invalid.
+             */
+            template<ColumnType Type>
+            bool GetValue(size_t row, size_t column, typename FieldDecoder<Type>::Value &value) {
+                StringView field = this->GetField(row, column);
+
+                if (this->types[column] != Type) {
+                    throw std::runtime_error("Column '" + this->names[column] + "' stores "
+                        + GetColumnTypeName(this->types[column]) + " values, not " + GetColumnTypeName(Type) + ".");
+                }
+
+                if (ResponseParser::IsNull(field)) {
+                    return false;
+                }
+
+                field = ValueParser::Unquote(field);
+                if (!FieldDecoder<Type>::Decode(field, this->scales[column], value)) {
+                    throw std::runtime_error("Invalid value in column '" + this->names[column] + "': "
+                        + field.ToString());
+                }
+
+                return true;
+            }
+
+            /**
+             * @brief Get the scale of a decimal column. (-1 until known)
+             *
+             * @param column
+             * @return int
+             */
+            int GetScale(size_t column) const {
+                return this->scales.at(column);
+            }
+
+            /**
+             * @brief Get the counters of the materialization.
+             *
+             * @return const LazyStats&
+             */
+            const LazyStats &GetStats() const {
+                return this->stats;
+            }
+    };
+}
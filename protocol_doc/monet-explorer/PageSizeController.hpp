@@ -0,0 +1,204 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+
+namespace MonetExplorer {
+    /**
+     * @brief The goals of the adaptive page size.
+     */
+    struct PageSizeSettings {
+        size_t targetPageBytes = 1048576;       // The preferred size of a page
+        size_t maxBufferedBytes = 67108864;     // The ceiling of the copies of the pages held at once
+        double maxLatencyShare = 0.1;           // The round trip can be at most this part of the time of a page
+    };
+
+    /**
+     * @brief Picks the row count of the next Xexport command, so that
+     * the pages have about the target size in bytes, whatever the width
+     * of the rows is. The size of the rows is measured on the received
+     * pages. If the round trip of the connection is long compared to the
+     * time of the transfer, then the pages are enlarged, so that the
+     * round trips take at most a given part of the time. The pages never
+     * exceed the memory ceiling, divided by the number of the pages held
+     * at once.
+     * The estimates are moving averages, weighted towards the last page,
+     * and the growth per page is limited, so that the first, possibly
+     * small page cannot cause a huge request.
+     */
+    class PageSizeController {
+        private:
+            /**
+             * @brief The maximal growth of the row count from a page to the next.
+             */
+            static const size_t MAX_GROWTH = 8;
+
+            PageSizeSettings settings;
+            size_t pagesHeld = 1;
+            double bytesPerRow = 0;
+            double roundTrip = 0;           // Seconds. The smallest seen.
+            double throughput = 0;          // Bytes per second
+            size_t lastRows = 0;
+
+            /**
+             * @brief Update a moving average. The new sample has
+             * the same weight as all the previous ones together.
+             *
+             * @param average
+             * @param sample
+             */
+            static void Average(double &average, double sample) {
+                average = average == 0 ? sample : (average + sample) / 2;
+            }
+
+        public:
+            /**
+             * @brief Construct a new PageSizeController object
+             *
+             * @param settings
+             * @param pagesHeld The number of the copies of a page held in memory at once.
+             * @throw runtime_error If the settings are invalid.
+             */
+            PageSizeController(const PageSizeSettings &settings = PageSizeSettings(), size_t pagesHeld = 1)
+                : settings(settings), pagesHeld(std::max((size_t)1, pagesHeld)) {
+
+                if (settings.targetPageBytes == 0 || settings.maxBufferedBytes == 0) {
+                    throw std::runtime_error("PageSizeController: The page size limits cannot be 0.");
+                }
+
+                if (settings.maxLatencyShare <= 0 || settings.maxLatencyShare >= 1) {
+                    throw std::runtime_error("PageSizeController: The latency share must be between 0 and 1.");
+                }
+            }
+
+            /**
+             * @brief Forget the measurements of the previous result,
+             * except the round trip of the connection.
+             */
+            void Reset() {
+                this->bytesPerRow = 0;
+                this->throughput = 0;
+                this->lastRows = 0;
+            }
+
+            /**
+             * @brief Called with the time of a command with an empty response.
+             *
+             * @param seconds
+             */
+            void OnRoundTrip(double seconds) {
+                if (seconds > 0 && (this->roundTrip == 0 || seconds < this->roundTrip)) {
+                    this->roundTrip = seconds;
+                }
+            }
+
+            /**
+             * @brief Called after a page was received.
+             *
+             * @param rows From the status line of the page.
+             * @param bytes The size of the message.
+             * @param seconds The time from sending the request to receiving
+             * the last byte. 0: not known. (The &1 also includes the execution
+             * of the query.)
+             */
+            void OnPage(size_t rows, size_t bytes, double seconds) {
+                if (rows == 0) {
+                    return;
+                }
+
+                Average(this->bytesPerRow, (double)bytes / rows);
+                this->lastRows = rows;
+
+                double transfer = seconds - this->roundTrip;
+                if (seconds > 0 && transfer > 0) {
+                    Average(this->throughput, bytes / transfer);
+                }
+            }
+
+            /**
+             * @brief Get the size of the next page in bytes: the target
+             * size, enlarged if the round trips would take too long, and
+             * limited by the memory ceiling.
+             *
+             * @return size_t
+             */
+            size_t GetPageBytes() const {
+                double bytes = (double)this->settings.targetPageBytes;
+
+                if (this->roundTrip > 0 && this->throughput > 0) {
+                    double share = this->settings.maxLatencyShare;
+                    bytes = std::max(bytes, this->roundTrip * this->throughput * (1 - share) / share);
+                }
+
+                return (size_t)std::min(bytes, (double)(this->settings.maxBufferedBytes / this->pagesHeld));
+            }
+
+            /**
+             * @brief Get the row count of the next page.
+             *
+             * @param fallback Returned before the first measurement.
+             * @return size_t At least 1.
+             */
+            size_t GetNextRowCount(size_t fallback) const {
+                if (this->bytesPerRow == 0) {
+                    return std::max((size_t)1, fallback);
+                }
+
+                size_t rows = (size_t)(this->GetPageBytes() / this->bytesPerRow);
+                rows = std::min(rows, this->lastRows * MAX_GROWTH);
+
+                return std::max((size_t)1, rows);
+            }
+
+            /**
+             * @brief Get the average size of the rows in the pages, including
+             * the formatting. 0 before the first page.
+             *
+             * @return double
+             */
+            double GetBytesPerRow() const {
+                return this->bytesPerRow;
+            }
+
+            /**
+             * @brief Get the shortest round trip seen, in seconds.
+             *
+             * @return double
+             */
+            double GetRoundTrip() const {
+                return this->roundTrip;
+            }
+
+            /**
+             * @brief Get the throughput of the page transfers, without
+             * the round trips, in bytes per second.
+             *
+             * @return double
+             */
+            double GetThroughput() const {
+                return this->throughput;
+            }
+
+            const PageSizeSettings &GetSettings() const {
+                return this->settings;
+            }
+    };
+}
@@ -0,0 +1,294 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include "ColumnarDecoder.hpp"
+#include "ColumnarResult.hpp"
+#include "ResponseParser.hpp"
+#include "SimdKernel.hpp"
+#include "StringView.hpp"
+#include "WorkStealingPool.hpp"
+
+
+namespace MonetExplorer {
+    /**
+     * @brief A result decoded in parallel: a sequence of columnar
+     * segments, each holding a consecutive range of the rows. The
+     * segments are not merged, to avoid copying the decoded data.
+     * Row 'i' is row 'i - GetSegmentStart(s)' of segment 's = FindSegment(i)'.
+     */
+    class SegmentedResult {
+        friend class ParallelDecoder;
+
+        private:
+            std::vector<ColumnarResult> segments;   // Only the first 'segmentCount' are in use
+            std::vector<size_t> starts;             // The first row of each segment, and the row count at the end
+            size_t segmentCount = 0;
+
+        public:
+            size_t GetColumnCount() const {
+                return this->segmentCount == 0 ? 0 : this->segments[0].GetColumnCount();
+            }
+
+            size_t GetRowCount() const {
+                return this->starts.empty() ? 0 : this->starts.back();
+            }
+
+            size_t GetSegmentCount() const {
+                return this->segmentCount;
+            }
+
+            const ColumnarResult &GetSegment(size_t index) const {
+                if (index >= this->segmentCount) {
+                    throw std::runtime_error("SegmentedResult: Invalid segment index: " + std::to_string(index));
+                }
+
+                return this->segments[index];
+            }
+
+            /**
+             * @brief Get the first row of a segment.
+             *
+             * @param index
+             * @return size_t
+             */
+            size_t GetSegmentStart(size_t index) const {
+                return this->starts.at(index);
+            }
+
+            /**
+             * @brief Find the segment of a row.
+             *
+             * @param row
+             * @return size_t
+             */
+            size_t FindSegment(size_t row) const {
+                if (row >= this->GetRowCount()) {
+                    throw std::runtime_error("SegmentedResult: Row index out of range: " + std::to_string(row));
+                }
+
+                return std::upper_bound(this->starts.begin(), this->starts.begin() + this->segmentCount, row)
+                    - this->starts.begin() - 1;
+            }
+
+            /**
+             * @brief Get the number of NULL values in a column.
+             *
+             * @param column
+             * @return size_t
+             */
+            size_t GetNullCount(size_t column) const {
+                size_t total = 0;
+
+                for (size_t i = 0; i < this->segmentCount; i++) {
+                    total += this->segments[i].GetColumn(column).GetNullCount();
+                }
+
+                return total;
+            }
+
+            /**
+             * @brief Get the memory used by the decoded data.
+             *
+             * @return size_t
+             */
+            size_t GetMemoryUsage() const {
+                size_t total = 0;
+
+                for (size_t i = 0; i < this->segmentCount; i++) {
+                    total += this->segments[i].GetMemoryUsage();
+                }
+
+                return total;
+            }
+    };
+
+    /**
+     * @brief Decodes large pages on multiple threads. A page is cut
+     * at line boundaries into chunks, which are decoded into separate
+     * segments by the workers of a work-stealing pool, each with its
+     * own ColumnarDecoder. The segments are in the order of the rows.
+     * Small pages are decoded on the calling thread.
+     * Not thread safe: use one instance per thread.
+     */
+    class ParallelDecoder {
+        private:
+            /**
+             * @brief Pages below twice this size are not split.
+             */
+            static const size_t MIN_CHUNK_SIZE = 256 * 1024;
+
+            /**
+             * @brief The number of chunks per worker, so that there
+             * is something to steal when the chunks are uneven.
+             */
+            static const size_t CHUNKS_PER_WORKER = 4;
+
+            std::vector<std::unique_ptr<ColumnarDecoder>> decoders;     // One per worker
+            WorkStealingPool pool;
+            ParsedResult header;                    // The columns of the current result, without tuples
+            std::vector<StringView> chunks;
+
+            /**
+             * @brief Cut a page into chunks of complete lines.
+             *
+             * @param tuples
+             */
+            void Cut(StringView tuples) {
+                this->chunks.clear();
+
+                size_t target = std::max((size_t)MIN_CHUNK_SIZE,
+                    tuples.length / (this->pool.GetThreadCount() * CHUNKS_PER_WORKER) + 1);
+
+                const char *position = tuples.data;
+                const char *end = tuples.data + tuples.length;
+
+                while (position < end) {
+                    const char *next = end;
+
+                    if ((size_t)(end - position) >= target * 2) {
+                        const char *newLine = (const char*)memchr(position + target, '\n', end - position - target);
+                        next = newLine == nullptr ? end : newLine + 1;
+                    }
+
+                    this->chunks.push_back(StringView(position, next - position));
+                    position = next;
+                }
+            }
+
+        public:
+            /**
+             * @brief Construct a new ParallelDecoder object
+             *
+             * @param threadCount The number of the worker threads. 0: one per CPU core.
+             * @param kernel The SIMD kernel of the splitting and unescaping.
+             */
+            ParallelDecoder(size_t threadCount = 0, SimdKernel kernel = GetBestKernel())
+                : pool(threadCount == 0 ? std::max(1u, std::thread::hardware_concurrency()) : threadCount) {
+
+                for (size_t i = 0; i < this->pool.GetThreadCount(); i++) {
+                    this->decoders.emplace_back(new ColumnarDecoder(kernel));
+                }
+            }
+
+            /**
+             * @brief Get the number of the worker threads.
+             *
+             * @return size_t
+             */
+            size_t GetThreadCount() const {
+                return this->pool.GetThreadCount();
+            }
+
+            /**
+             * @brief Get the number of the chunks, which were decoded by
+             * another worker than the one they were assigned to.
+             *
+             * @return uint64_t
+             */
+            uint64_t GetStealCount() const {
+                return this->pool.GetStealCount();
+            }
+
+            /**
+             * @brief Enable the dictionary encoding of the string columns.
+             * Each segment has its own dictionaries.
+             *
+             * @param maxSize See: ColumnarDecoder::SetMaxDictionarySize()
+             */
+            void SetMaxDictionarySize(size_t maxSize) {
+                for (std::unique_ptr<ColumnarDecoder> &decoder : this->decoders) {
+                    decoder->SetMaxDictionarySize(maxSize);
+                }
+            }
+
+            /**
+             * @brief Set up the decoding of a result. The previous content
+             * of the output is discarded, but the allocations are reused.
+             *
+             * @param result A parsed &1 (or &5) response.
+             * @param output
+             */
+            void Begin(const ParsedResult &result, SegmentedResult &output) {
+                this->header.status = result.status;
+                this->header.columns = result.columns;
+                this->header.tuples = StringView();
+                this->header.tupleCount = 0;
+
+                output.segmentCount = 0;
+                output.starts.assign(1, 0);
+            }
+
+            /**
+             * @brief Decode a page of tuples, and append its segments.
+             *
+             * @param tuples The tuple lines of a &1 response or a &6 block.
+             * @param output Initialized by Begin(). Its content is unspecified
+             * after an exception.
+             * @throw runtime_error On invalid tuples or values.
+             */
+            void Append(StringView tuples, SegmentedResult &output) {
+                if (this->header.columns.empty() || tuples.IsEmpty()) {
+                    return;
+                }
+
+                this->Cut(tuples);
+
+                size_t first = output.segmentCount;
+                size_t count = this->chunks.size();
+
+                if (output.segments.size() < first + count) {
+                    output.segments.resize(first + count);
+                }
+
+                auto decode = [&](size_t task, size_t worker) {
+                    ColumnarDecoder &decoder = *this->decoders[worker];
+                    ColumnarResult &segment = output.segments[first + task];
+
+                    decoder.Begin(this->header, segment);
+                    decoder.Append(this->chunks[task], segment);
+                };
+
+                if (count == 1) {
+                    decode(0, 0);
+                } else {
+                    this->pool.Run(count, decode);
+                }
+
+                for (size_t i = first; i < first + count; i++) {
+                    output.starts.push_back(output.starts.back() + output.segments[i].GetRowCount());
+                }
+
+                output.segmentCount += count;
+            }
+
+            /**
+             * @brief Decode a complete result.
+             *
+             * @param result
+             * @param output
+             */
+            void Decode(const ParsedResult &result, SegmentedResult &output) {
+                this->Begin(result, output);
+                this->Append(result.tuples, output);
+            }
+    };
+}
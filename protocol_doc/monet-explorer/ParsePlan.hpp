@@ -0,0 +1,161 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+namespace MonetExplorer {
+    /**
+     * @brief The kinds of the client-side row filters.
+     */
+    enum class PredicateType : int {
+        Range = 1,      // low <= value <= high, on numeric, date and time columns. (Equality: low = high)
+        Prefix = 2      // The value starts with a string, on string columns
+    };
+
+    /**
+     * @brief A filter on a column. The values are given as text, in the
+     * format of the tuples, and parsed by the type of the column when
+     * the plan is bound to a result. The NULL values never match.
+     */
+    struct Predicate {
+        std::string column;
+        PredicateType type = PredicateType::Range;
+        std::string low;        // Range only. Empty: no lower bound.
+        std::string high;       // Range only. Empty: no upper bound.
+        std::string prefix;     // Prefix only
+    };
+
+    /**
+     * @brief Describes which part of a result is decoded: a subset of the
+     * columns, and the rows matching all the predicates. The fields of the
+     * other columns are only located by the tuple splitter, but never
+     * unescaped or converted, and the rejected rows are dropped before
+     * the decoding. (See: ColumnarDecoder::Begin())
+     * The columns are referenced by name.
+     */
+    class ParsePlan {
+        private:
+            std::vector<std::string> columns;
+            std::vector<Predicate> predicates;
+
+        public:
+            /**
+             * @brief Add a column to the output. The columns are decoded in
+             * the order of the calls. If never called, all the columns are decoded.
+             *
+             * @param name
+             */
+            void Select(const std::string &name) {
+                this->columns.push_back(name);
+            }
+
+            /**
+             * @brief Keep only the rows, where a column equals a value.
+             *
+             * @param name The name of a numeric, date or time column.
+             * @param value
+             */
+            void WhereEqual(const std::string &name, const std::string &value) {
+                this->WhereRange(name, value, value);
+            }
+
+            /**
+             * @brief Keep only the rows, where a column is inside a closed range.
+             *
+             * @param name The name of a numeric, date or time column.
+             * @param low Empty: no lower bound.
+             * @param high Empty: no upper bound.
+             */
+            void WhereRange(const std::string &name, const std::string &low, const std::string &high) {
+                Predicate predicate;
+                predicate.column = name;
+                predicate.type = PredicateType::Range;
+                predicate.low = low;
+                predicate.high = high;
+
+                this->predicates.push_back(predicate);
+            }
+
+            /**
+             * @brief Keep only the rows, where a string column starts with a prefix.
+             *
+             * @param name The name of a string column.
+             * @param prefix Unescaped.
+             */
+            void WherePrefix(const std::string &name, const std::string &prefix) {
+                Predicate predicate;
+                predicate.column = name;
+                predicate.type = PredicateType::Prefix;
+                predicate.prefix = prefix;
+
+                this->predicates.push_back(predicate);
+            }
+
+            /**
+             * @brief Add a predicate from its text form:
+             *      name=value          Equality
+             *      name=low..high      Range. One of the bounds can be empty.
+             *      name^=prefix        Prefix
+             *
+             * @param condition
+             * @throw runtime_error If the syntax is invalid.
+             */
+            void Where(const std::string &condition) {
+                size_t equals = condition.find('=');
+                if (equals == std::string::npos || equals == 0) {
+                    throw std::runtime_error("Invalid condition: '" + condition + "'. The supported forms are: "
+                        "name=value, name=low..high, name^=prefix.");
+                }
+
+                std::string value = condition.substr(equals + 1);
+
+                if (condition[equals - 1] == '^') {
+                    this->WherePrefix(condition.substr(0, equals - 1), value);
+                    return;
+                }
+
+                std::string name = condition.substr(0, equals);
+                size_t dots = value.find("..");
+
+                if (dots == std::string::npos) {
+                    this->WhereEqual(name, value);
+                } else {
+                    this->WhereRange(name, value.substr(0, dots), value.substr(dots + 2));
+                }
+            }
+
+            const std::vector<std::string> &GetColumns() const {
+                return this->columns;
+            }
+
+            const std::vector<Predicate> &GetPredicates() const {
+                return this->predicates;
+            }
+
+            /**
+             * @brief Returns true if the plan selects everything.
+             *
+             * @return bool
+             */
+            bool IsEmpty() const {
+                return this->columns.empty() && this->predicates.empty();
+            }
+    };
+}
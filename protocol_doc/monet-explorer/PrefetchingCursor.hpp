@@ -0,0 +1,625 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include "ColumnarDecoder.hpp"
+#include "ColumnarResult.hpp"
+#include "Connection.hpp"
+#include "PageSizeController.hpp"
+#include "ParsePlan.hpp"
+#include "ResponseParser.hpp"
+#include "ResultLifecycle.hpp"
+#include "ResultRegistry.hpp"
+#include "SimdKernel.hpp"
+#include "StringView.hpp"
+
+
+namespace MonetExplorer {
+    /**
+     * @brief Counters of a cursor. The times are in microseconds.
+     */
+    struct CursorStats {
+        uint64_t pages = 0;         // Decoded pages, including the &1
+        uint64_t rows = 0;          // Decoded rows, after the predicates of the plan
+        uint64_t bytes = 0;         // The size of the received pages
+        uint64_t stallUs = 0;       // The consumer waited for the network
+        uint64_t networkUs = 0;     // The I/O thread waited for the responses of the Xexport commands
+        uint64_t idleUs = 0;        // The I/O thread waited for the consumer to free a buffer
+    };
+
+    /**
+     * @brief Reads a result set page by page (see: protocol_doc 6.3),
+     * requesting the next page in the background. The query is sent
+     * after an 'Xreply_size', then a dedicated I/O thread sends the
+     * 'Xexport' commands of the remaining pages, and receives them into
+     * two buffers in turn, while the consumer thread decodes and
+     * processes the previous page. So the network time overlaps with
+     * the time of the parsing, and the consumer only stalls when the
+     * network is slower.
+     * The pages are decoded one at a time into a columnar batch, which
+     * is valid until the next page is requested. The pages have a fixed
+     * number of rows, or an adaptive one. (See: PageSizeController)
+     * The connection must not be used by others while the cursor is
+     * open, and the reply size stays set after closing it.
+     * With a lifecycle manager, the result set is closed on the server
+     * when the cursor is fully consumed, closed or destroyed. The Xclose
+     * is sent together with the next request. (See: ResultLifecycle)
+     */
+    class PrefetchingCursor {
+        private:
+            static const size_t BUFFER_COUNT = 2;
+
+            /**
+             * @brief The copies of a page held at once: the buffers, the
+             * receive arena of the connection (which Execute() copies out
+             * of) and the decoded batch. (Assumed to be about as large as
+             * its page.) The memory ceiling of the adaptive page size is
+             * shared among them.
+             */
+            static const size_t PAGE_COPIES = BUFFER_COUNT + 2;
+
+            /**
+             * @brief A received page. While 'filled' is false, it is
+             * owned by the I/O thread, otherwise by the consumer.
+             */
+            struct Buffer {
+                std::string message;
+                bool filled = false;
+                bool last = false;          // The last page of the result
+            };
+
+            Connection &connection;
+            ResultLifecycle *lifecycle = nullptr;
+            ResponseParser parser;
+            ColumnarDecoder decoder;
+            ParsePlan plan;
+            PageSizeController controller;
+            bool adaptive = false;
+            ResultHeader header;
+            ColumnarResult batch;
+            Buffer buffers[BUFFER_COUNT];
+            std::thread thread;
+            std::mutex mutex;
+            std::condition_variable changed;
+            bool stopping = false;
+            bool open = false;
+            std::exception_ptr error;       // Thrown by the I/O thread
+            int64_t resultId = -1;
+            ResultHandle handle;            // Empty if the server closed the result already
+            uint64_t totalRows = 0;
+            uint64_t pageSize = 0;          // The rows of the &1, and of the others if not adaptive
+            uint64_t firstRows = 0;         // The rows of the &1 response
+            size_t consumed = 0;            // The pages decoded by the consumer
+            bool finished = false;          // The last page is decoded
+            uint64_t batchStart = 0;        // The number of the first row of the batch
+            size_t row = 0;                 // The current row of the batch
+            bool hasRow = false;
+            CursorStats stats;
+
+            /**
+             * @brief Get the elapsed microseconds since a time.
+             *
+             * @param since
+             * @return uint64_t
+             */
+            static uint64_t ElapsedUs(std::chrono::steady_clock::time_point since) {
+                return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - since).count();
+            }
+
+            /**
+             * @brief Send a command and receive its response.
+             *
+             * @param command
+             * @return StringView Valid until the next receive.
+             * @throw runtime_error If the server disconnected.
+             */
+            StringView Execute(const std::string &command) {
+                this->connection.SendMessage(command);
+                StringView response = this->connection.ReceiveMessageView();
+
+                if (!this->connection.IsConnected()) {
+                    throw std::runtime_error("The server closed the connection during the pagination.");
+                }
+
+                return response;
+            }
+
+            /**
+             * @brief Send a command from the consumer thread. The queued
+             * commands of the lifecycle manager are sent along with it.
+             *
+             * @param command
+             * @return StringView Valid until the next receive.
+             * @throw runtime_error If the server disconnected.
+             */
+            StringView Request(const std::string &command) {
+                if (this->lifecycle == nullptr) {
+                    return this->Execute(command);
+                }
+
+                StringView response = this->lifecycle->Execute(command);
+
+                if (!this->connection.IsConnected()) {
+                    throw std::runtime_error("The server closed the connection during the pagination.");
+                }
+
+                return response;
+            }
+
+            /**
+             * @brief The main loop of the I/O thread: request the pages
+             * after the first one, each into the next free buffer.
+             */
+            void Fetch() {
+                size_t index = 1;   // The &1 response is in buffer 0
+
+                try {
+                    for (uint64_t offset = this->firstRows; offset < this->totalRows;) {
+                        Buffer &buffer = this->buffers[index];
+                        auto waitStart = std::chrono::steady_clock::now();
+
+                        {
+                            std::unique_lock<std::mutex> lock(this->mutex);
+                            this->changed.wait(lock, [&] { return this->stopping || !buffer.filled; });
+
+                            this->stats.idleUs += ElapsedUs(waitStart);
+                            if (this->stopping) {
+                                return;
+                            }
+                        }
+
+                        uint64_t count = this->adaptive ? this->controller.GetNextRowCount(this->pageSize)
+                            : this->pageSize;
+                        count = std::min(count, this->totalRows - offset);
+                        auto requestStart = std::chrono::steady_clock::now();
+
+                        StringView response = this->Execute("Xexport " + std::to_string(this->resultId) + " "
+                            + std::to_string(offset) + " " + std::to_string(count) + "\n");
+                        buffer.message.assign(response.data, response.length);
+                        uint64_t elapsed = ElapsedUs(requestStart);
+
+                        if (this->adaptive) {
+                            this->controller.OnPage(GetPageRowCount(response), response.length, elapsed / 1000000.0);
+                        }
+
+                        offset += count;
+                        buffer.last = offset >= this->totalRows;
+
+                        {
+                            std::lock_guard<std::mutex> lock(this->mutex);
+                            this->stats.networkUs += elapsed;
+                            buffer.filled = true;
+                        }
+
+                        this->changed.notify_all();
+                        index = (index + 1) % BUFFER_COUNT;
+                    }
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    this->error = std::current_exception();
+                }
+
+                this->changed.notify_all();
+            }
+
+            /**
+             * @brief Get the row count from the status line of a page.
+             *
+             * @param message A &1 response or &6 block.
+             * @return size_t 0 for other responses.
+             */
+            static size_t GetPageRowCount(StringView message) {
+                if (message.length < 2 || message.data[0] != '&') {
+                    return 0;
+                }
+
+                const char *newLine = (const char*)memchr(message.data, '\n', message.length);
+                StringView line(message.data, newLine == nullptr ? message.length : newLine - message.data);
+                StatusRecord status = ResponseParser::ParseStatus(line);
+
+                return status.rowCount > 0 ? (size_t)status.rowCount : 0;
+            }
+
+            /**
+             * @brief Stop and join the I/O thread. The page being
+             * received is still read to the end.
+             */
+            void Stop() {
+                if (!this->thread.joinable()) {
+                    return;
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    this->stopping = true;
+                }
+
+                this->changed.notify_all();
+                this->thread.join();
+            }
+
+            /**
+             * @brief Parse a page, and check that it belongs to the result.
+             *
+             * @param message
+             * @return const ParsedResult&
+             * @throw runtime_error On errors.
+             */
+            const ParsedResult &ParsePage(StringView message) {
+                this->parser.Parse(message);
+
+                if (this->parser.HasError()) {
+                    throw std::runtime_error("The server returned an error during the pagination: "
+                        + this->parser.GetError().ToString());
+                }
+
+                if (this->parser.GetResultCount() != 1) {
+                    throw std::runtime_error("Invalid page of result " + std::to_string(this->resultId) + ": "
+                        + std::to_string(this->parser.GetResultCount()) + " results in the response.");
+                }
+
+                const ParsedResult &page = this->parser.GetResult(0);
+                if (page.status.resultId != this->resultId || page.status.columnCount
+                    != (int64_t)this->header.Get().columns.size()) {
+
+                    throw std::runtime_error("Invalid page of result " + std::to_string(this->resultId) + ": "
+                        + page.status.line.ToString());
+                }
+
+                return page;
+            }
+
+            /**
+             * @brief Remove the trailing white-spaces and semi-colons.
+             *
+             * @param query
+             * @return StringView
+             */
+            static StringView TrimQuery(StringView query) {
+                while (query.length > 0 && (query.data[query.length - 1] == ';'
+                    || isspace((unsigned char)query.data[query.length - 1]))) {
+
+                    query.length--;
+                }
+
+                return query;
+            }
+
+        public:
+            /**
+             * @brief Construct a new PrefetchingCursor object
+             *
+             * @param connection An authenticated connection.
+             * @param kernel The SIMD kernel of the decoder.
+             */
+            PrefetchingCursor(Connection &connection, SimdKernel kernel = GetBestKernel())
+                : connection(connection), decoder(kernel) { }
+
+            PrefetchingCursor(const PrefetchingCursor&) = delete;
+            PrefetchingCursor &operator=(const PrefetchingCursor&) = delete;
+
+            /**
+             * @brief Destroy the PrefetchingCursor object
+             */
+            ~PrefetchingCursor() {
+                this->Stop();
+            }
+
+            /**
+             * @brief Close the result sets on the server through a lifecycle
+             * manager, from the next opened one on.
+             *
+             * @param lifecycle Must be bound to the same connection, and
+             * outlive the cursor.
+             */
+            void SetLifecycle(ResultLifecycle &lifecycle) {
+                this->lifecycle = &lifecycle;
+            }
+
+            /**
+             * @brief Set the parse plan for the results opened from now on.
+             *
+             * @param plan
+             */
+            void SetParsePlan(const ParsePlan &plan) {
+                this->plan = plan;
+            }
+
+            /**
+             * @brief Enable the dictionary encoding of the string columns.
+             * Each batch has its own dictionaries.
+             *
+             * @param maxSize See: ColumnarDecoder::SetMaxDictionarySize()
+             */
+            void SetMaxDictionarySize(size_t maxSize) {
+                this->decoder.SetMaxDictionarySize(maxSize);
+            }
+
+            /**
+             * @brief Choose the row counts of the pages after the first
+             * one by the measured size of the rows and the round trip,
+             * for the results opened from now on.
+             *
+             * @param settings
+             * @throw runtime_error If the settings are invalid.
+             */
+            void SetAdaptivePageSize(const PageSizeSettings &settings) {
+                this->controller = PageSizeController(settings, PAGE_COPIES);
+                this->adaptive = true;
+            }
+
+            /**
+             * @brief Get the measurements of the adaptive page size.
+             *
+             * @return const PageSizeController&
+             */
+            const PageSizeController &GetPageSizeController() const {
+                return this->controller;
+            }
+
+            /**
+             * @brief Execute a query, and start prefetching its pages.
+             * The previously opened result is closed.
+             *
+             * @param query A single SQL query, without the 's' prefix.
+             * @param pageSize The number of rows per page. With the adaptive
+             * page size only of the first one.
+             * @return bool False if the query returned no result set.
+             * (For example it was an update.) The cursor stays closed.
+             * @throw runtime_error On errors of the server or the decoding.
+             */
+            bool Open(StringView query, size_t pageSize) {
+                if (pageSize == 0) {
+                    throw std::runtime_error("PrefetchingCursor::Open(): The page size cannot be 0.");
+                }
+
+                this->Close();
+                this->pageSize = pageSize;
+
+                auto requestStart = std::chrono::steady_clock::now();
+                this->parser.Parse(this->Request("Xreply_size " + std::to_string(pageSize) + "\n"));
+                this->controller.OnRoundTrip(ElapsedUs(requestStart) / 1000000.0);
+
+                if (this->parser.HasError()) {
+                    throw std::runtime_error("Failed to set the reply size: " + this->parser.GetError().ToString());
+                }
+
+                query = TrimQuery(query);
+                StringView response = this->Request("s" + query.ToString() + ";\n");
+                this->buffers[0].message.assign(response.data, response.length);
+                this->parser.Parse(StringView(this->buffers[0].message));
+
+                if (this->parser.HasError()) {
+                    throw std::runtime_error("The query failed: " + this->parser.GetError().ToString());
+                }
+
+                if (this->parser.GetResultCount() != 1 || this->parser.GetResult(0).status.type != ResponseType::Table
+                    || this->parser.GetResult(0).status.resultId < 0) {
+
+                    return false;
+                }
+
+                const ParsedResult &first = this->parser.GetResult(0);
+                this->header.Assign(first);
+                this->resultId = first.status.resultId;
+                this->totalRows = (uint64_t)std::max(first.status.totalRowCount, (int64_t)0);
+                this->firstRows = first.tupleCount;
+                this->controller.Reset();
+
+                // The server closes the result sets which fit into the first response.
+                if (this->lifecycle != nullptr && this->firstRows < this->totalRows) {
+                    this->handle = ResultHandle(*this->lifecycle, this->resultId, HandleKind::Result);
+                }
+                this->controller.OnPage(first.tupleCount, response.length, 0);
+
+                this->consumed = 0;
+                this->finished = false;
+                this->batchStart = 0;
+                this->hasRow = false;
+                this->stats = CursorStats();
+                this->error = nullptr;
+                this->stopping = false;
+                this->buffers[0].filled = true;
+                this->buffers[0].last = this->firstRows >= this->totalRows;
+                this->buffers[1].filled = false;
+                this->open = true;
+
+                if (!this->buffers[0].last) {
+                    this->thread = std::thread(&PrefetchingCursor::Fetch, this);
+                }
+
+                return true;
+            }
+
+            /**
+             * @brief Stop the prefetching. The result set stays open on
+             * the server, unless a lifecycle manager is set. The batch
+             * is still accessible.
+             */
+            void Close() {
+                this->Stop();
+                this->handle.Reset();
+                this->open = false;
+            }
+
+            /**
+             * @brief Decode the next page into the batch.
+             *
+             * @return const ColumnarResult* Null at the end of the result.
+             * @throw runtime_error On errors of the I/O thread or the decoding.
+             */
+            const ColumnarResult *NextBatch() {
+                if (!this->open || this->finished) {
+                    this->Close();
+                    return nullptr;
+                }
+
+                Buffer &buffer = this->buffers[this->consumed % BUFFER_COUNT];
+                auto waitStart = std::chrono::steady_clock::now();
+
+                {
+                    std::unique_lock<std::mutex> lock(this->mutex);
+                    this->changed.wait(lock, [&] { return buffer.filled || this->error; });
+                    this->stats.stallUs += ElapsedUs(waitStart);
+
+                    if (!buffer.filled) {
+                        std::exception_ptr failure = this->error;
+                        lock.unlock();
+
+                        this->Close();
+                        std::rethrow_exception(failure);
+                    }
+                }
+
+                if (this->consumed > 0) {
+                    this->batchStart += this->batch.GetRowCount();
+                }
+
+                try {
+                    const ParsedResult &page = this->ParsePage(StringView(buffer.message));
+                    this->decoder.Begin(this->header.Get(), this->batch, this->plan);
+                    this->decoder.Append(page.tuples, this->batch);
+                } catch (...) {
+                    this->Close();
+                    throw;
+                }
+
+                this->stats.pages++;
+                this->stats.rows += this->batch.GetRowCount();
+                this->stats.bytes += buffer.message.length();
+                this->consumed++;
+                this->finished = buffer.last;
+
+                // The I/O thread has received the last page, so the result can be closed.
+                if (this->finished) {
+                    this->Stop();
+                    this->handle.Reset();
+                }
+                this->row = 0;
+                this->hasRow = false;
+
+                // The batch owns the decoded data, so the buffer can be refilled.
+                {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    buffer.filled = false;
+                }
+
+                this->changed.notify_all();
+
+                return &this->batch;
+            }
+
+            /**
+             * @brief Move to the next row. Decodes the next page
+             * when the current batch is exhausted.
+             *
+             * @return bool False at the end of the result.
+             */
+            bool NextRow() {
+                if (this->hasRow && this->row + 1 < this->batch.GetRowCount()) {
+                    this->row++;
+                    return true;
+                }
+
+                while (this->NextBatch() != nullptr) {
+                    if (this->batch.GetRowCount() > 0) {
+                        this->hasRow = true;
+                        return true;
+                    }
+                }
+
+                this->hasRow = false;
+                return false;
+            }
+
+            /**
+             * @brief Get the page decoded by the last NextBatch() call.
+             *
+             * @return const ColumnarResult&
+             */
+            const ColumnarResult &GetBatch() const {
+                return this->batch;
+            }
+
+            /**
+             * @brief Get the index of the current row inside the batch.
+             *
+             * @return size_t
+             */
+            size_t GetRow() const {
+                return this->row;
+            }
+
+            /**
+             * @brief Get the number of the current row inside the result.
+             * (Not counting the rows rejected by the plan.)
+             *
+             * @return uint64_t
+             */
+            uint64_t GetRowNumber() const {
+                return this->batchStart + this->row;
+            }
+
+            /**
+             * @brief Get the header of the result. (Without the total row count.)
+             *
+             * @return const ParsedResult&
+             */
+            const ParsedResult &GetHeader() const {
+                return this->header.Get();
+            }
+
+            int64_t GetResultId() const {
+                return this->resultId;
+            }
+
+            /**
+             * @brief Get the number of the rows of the result, according to the server.
+             *
+             * @return uint64_t
+             */
+            uint64_t GetTotalRowCount() const {
+                return this->totalRows;
+            }
+
+            bool IsOpen() const {
+                return this->open;
+            }
+
+            /**
+             * @brief Get the counters of the cursor. Only consistent
+             * while the I/O thread is not running. (After the last page
+             * or Close().)
+             *
+             * @return const CursorStats&
+             */
+            const CursorStats &GetStats() const {
+                return this->stats;
+            }
+    };
+}
@@ -0,0 +1,188 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+#include <cctype>
+#include <cstdint>
+#include <list>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include "ResponseParser.hpp"
+#include "ResultLifecycle.hpp"
+#include "StringView.hpp"
+
+
+namespace MonetExplorer {
+    /**
+     * @brief Counters of the prepared statement cache.
+     */
+    struct PreparedCacheStats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;        // PREPARE round trips
+        uint64_t evictions = 0;     // Released on the server
+    };
+
+    /**
+     * @brief Keeps the prepared statements of a session by their SQL text,
+     * so that a query is prepared only once. The number of the statements
+     * is limited, and the least recently used ones are evicted first. An
+     * evicted statement is released on the server with Xrelease, which is
+     * sent together with the next request. (See: ResultLifecycle)
+     */
+    class PreparedStatementCache {
+        private:
+            /**
+             * @brief A prepared statement.
+             */
+            struct Entry {
+                ResultHandle handle;
+                std::list<std::string>::iterator position;  // In 'recent'
+            };
+
+            ResultLifecycle &lifecycle;
+            ResponseParser parser;
+            size_t capacity;
+            std::unordered_map<std::string, Entry> statements;
+            std::list<std::string> recent;      // The queries, the most recently used first
+            PreparedCacheStats stats;
+
+            /**
+             * @brief Remove the white-spaces around the query,
+             * and the trailing semi-colons.
+             *
+             * @param query
+             * @return StringView
+             */
+            static StringView TrimQuery(StringView query) {
+                while (query.length > 0 && isspace((unsigned char)query.data[0])) {
+                    query.data++;
+                    query.length--;
+                }
+
+                while (query.length > 0 && (query.data[query.length - 1] == ';'
+                    || isspace((unsigned char)query.data[query.length - 1]))) {
+
+                    query.length--;
+                }
+
+                return query;
+            }
+
+            /**
+             * @brief Evict the least recently used statements
+             * until the capacity is kept.
+             */
+            void Evict() {
+                while (this->statements.size() > this->capacity) {
+                    this->statements.erase(this->recent.back());   // The handle queues the Xrelease
+                    this->recent.pop_back();
+                    this->stats.evictions++;
+                }
+            }
+
+        public:
+            /**
+             * @brief Construct a new PreparedStatementCache object
+             *
+             * @param lifecycle Sends the PREPARE and Xrelease commands.
+             * Must outlive the cache.
+             * @param capacity The maximal number of the prepared statements.
+             * @throw runtime_error If the capacity is 0.
+             */
+            PreparedStatementCache(ResultLifecycle &lifecycle, size_t capacity)
+                : lifecycle(lifecycle), capacity(capacity) {
+
+                if (capacity == 0) {
+                    throw std::runtime_error("PreparedStatementCache: The capacity cannot be 0.");
+                }
+            }
+
+            PreparedStatementCache(const PreparedStatementCache&) = delete;
+            PreparedStatementCache &operator=(const PreparedStatementCache&) = delete;
+
+            /**
+             * @brief Get the prepared statement of a query,
+             * preparing it if it is not cached.
+             *
+             * @param query A single SQL query, without the 's' prefix and PREPARE.
+             * @param cached Output: true if no request was sent.
+             * @return int64_t The ID of the statement, for EXECUTE.
+             * @throw runtime_error If the preparation failed.
+             */
+            int64_t Prepare(StringView query, bool &cached) {
+                std::string key = TrimQuery(query).ToString();
+                auto it = this->statements.find(key);
+
+                if (it != this->statements.end()) {
+                    this->recent.splice(this->recent.begin(), this->recent, it->second.position);
+                    this->stats.hits++;
+                    cached = true;
+
+                    return it->second.handle.GetId();
+                }
+
+                this->parser.Parse(this->lifecycle.Execute("sPREPARE " + key + ";\n"));
+                this->stats.misses++;
+                cached = false;
+
+                if (!this->lifecycle.GetConnection().IsConnected()) {
+                    throw std::runtime_error("The server closed the connection during the preparation.");
+                }
+
+                if (this->parser.HasError()) {
+                    throw std::runtime_error("Failed to prepare the query: " + this->parser.GetError().ToString());
+                }
+
+                if (this->parser.GetResultCount() != 1 || this->parser.GetResult(0).status.type != ResponseType::Prepare
+                    || this->parser.GetResult(0).status.preparedStatementId < 0) {
+
+                    throw std::runtime_error("Failed to prepare the query: The response is not a &5.");
+                }
+
+                int64_t id = this->parser.GetResult(0).status.preparedStatementId;
+
+                this->recent.push_front(key);
+                Entry &entry = this->statements[key];
+                entry.handle = ResultHandle(this->lifecycle, id, HandleKind::PreparedStatement);
+                entry.position = this->recent.begin();
+
+                this->Evict();
+
+                return id;
+            }
+
+            /**
+             * @brief Release all the statements. (With the next request.)
+             */
+            void Clear() {
+                this->statements.clear();
+                this->recent.clear();
+            }
+
+            size_t GetCount() const {
+                return this->statements.size();
+            }
+
+            size_t GetCapacity() const {
+                return this->capacity;
+            }
+
+            const PreparedCacheStats &GetStats() const {
+                return this->stats;
+            }
+    };
+}
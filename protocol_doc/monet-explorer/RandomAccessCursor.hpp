@@ -0,0 +1,487 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ColumnarDecoder.hpp"
+#include "ColumnarResult.hpp"
+#include "Connection.hpp"
+#include "ResponseParser.hpp"
+#include "ResultLifecycle.hpp"
+#include "ResultRegistry.hpp"
+#include "SimdKernel.hpp"
+#include "StringView.hpp"
+
+
+namespace MonetExplorer {
+    /**
+     * @brief The limits of the page cache.
+     */
+    struct PageCacheSettings {
+        size_t maxBytes = 67108864;     // The limit of the memory used by the decoded pages
+        size_t maxReadAhead = 16;       // The maximal number of pages read ahead in a request
+    };
+
+    /**
+     * @brief Counters of the page cache.
+     */
+    struct PageCacheStats {
+        uint64_t hits = 0;              // Accesses to cached pages. (Only when the page changes.)
+        uint64_t misses = 0;
+        uint64_t requests = 0;          // Xexport round trips
+        uint64_t pagesFetched = 0;
+        uint64_t pagesReadAhead = 0;    // Fetched without being accessed yet
+        uint64_t evictions = 0;
+    };
+
+    /**
+     * @brief Random access to the rows of a result set, for browsing
+     * large results. The rows are mapped to fixed-size pages, and the
+     * missing pages are fetched on demand with 'Xexport', which takes
+     * any offset. (See: protocol_doc 6.3) So jumping to a row costs a
+     * single round trip, whatever its position is.
+     * The decoded pages are kept in a cache, limited by their memory
+     * usage, and the least recently used ones are evicted first.
+     * When the pages are accessed one after the other, the following
+     * pages are read ahead in the same request. The read-ahead window
+     * doubles with each sequential miss, and is reset by a jump.
+     * Not thread safe. The connection must not be used by others while
+     * the cursor is open, and the reply size stays set after closing it.
+     * With a lifecycle manager, the result set is closed on the server
+     * when the cursor is closed or destroyed. (See: ResultLifecycle)
+     */
+    class RandomAccessCursor {
+        private:
+            static const size_t NO_PAGE = SIZE_MAX;
+
+            /**
+             * @brief A cached page.
+             */
+            struct Page {
+                ColumnarResult data;
+                size_t bytes = 0;
+                std::list<size_t>::iterator position;   // In 'recent'
+            };
+
+            Connection &connection;
+            ResultLifecycle *lifecycle = nullptr;
+            ResponseParser parser;
+            ColumnarDecoder decoder;
+            ResultHeader header;
+            PageCacheSettings settings;
+            std::unordered_map<size_t, std::unique_ptr<Page>> pages;
+            std::list<size_t> recent;           // The page numbers, the most recently used first
+            std::unique_ptr<Page> spare;        // An evicted page, whose allocations are reused
+            size_t cachedBytes = 0;
+            bool open = false;
+            int64_t resultId = -1;
+            ResultHandle handle;                // Empty if the server closed the result already
+            uint64_t totalRows = 0;
+            size_t pageSize = 0;
+            size_t pageCount = 0;
+            size_t lastPage = NO_PAGE;          // The last accessed page
+            size_t readAhead = 0;               // The current read-ahead window
+            PageCacheStats stats;
+
+            /**
+             * @brief Send a command and parse its response. The queued
+             * commands of the lifecycle manager are sent along with it.
+             *
+             * @param command
+             * @throw runtime_error If the server disconnected.
+             */
+            void Execute(const std::string &command) {
+                StringView response;
+
+                if (this->lifecycle != nullptr) {
+                    response = this->lifecycle->Execute(command);
+                } else {
+                    this->connection.SendMessage(command);
+                    response = this->connection.ReceiveMessageView();
+                }
+
+                if (!this->connection.IsConnected()) {
+                    throw std::runtime_error("The server closed the connection during the pagination.");
+                }
+
+                this->parser.Parse(response);
+            }
+
+            /**
+             * @brief Remove the trailing white-spaces and semi-colons.
+             *
+             * @param query
+             * @return StringView
+             */
+            static StringView TrimQuery(StringView query) {
+                while (query.length > 0 && (query.data[query.length - 1] == ';'
+                    || isspace((unsigned char)query.data[query.length - 1]))) {
+
+                    query.length--;
+                }
+
+                return query;
+            }
+
+            /**
+             * @brief Decode the tuples of a page, and add it to the cache
+             * as the most recently used one.
+             *
+             * @param number
+             * @param tuples
+             */
+            void Insert(size_t number, StringView tuples) {
+                std::unique_ptr<Page> page(this->spare ? this->spare.release() : new Page());
+
+                this->decoder.Begin(this->header.Get(), page->data);
+                this->decoder.Append(tuples, page->data);
+
+                page->bytes = page->data.GetMemoryUsage();
+                this->recent.push_front(number);
+                page->position = this->recent.begin();
+                this->cachedBytes += page->bytes;
+                this->pages[number] = std::move(page);
+            }
+
+            /**
+             * @brief Evict the least recently used pages, until the cache
+             * fits into its limit. The most recent page is always kept.
+             */
+            void Evict() {
+                while (this->cachedBytes > this->settings.maxBytes && this->recent.size() > 1) {
+                    size_t number = this->recent.back();
+                    auto it = this->pages.find(number);
+
+                    this->cachedBytes -= it->second->bytes;
+                    this->spare = std::move(it->second);
+                    this->pages.erase(it);
+                    this->recent.pop_back();
+                    this->stats.evictions++;
+                }
+            }
+
+            /**
+             * @brief Fetch consecutive pages in a single request.
+             *
+             * @param first
+             * @param count
+             * @throw runtime_error On errors of the server or the decoding.
+             */
+            void Fetch(size_t first, size_t count) {
+                uint64_t offset = (uint64_t)first * this->pageSize;
+                uint64_t rows = std::min((uint64_t)count * this->pageSize, this->totalRows - offset);
+
+                this->Execute("Xexport " + std::to_string(this->resultId) + " " + std::to_string(offset)
+                    + " " + std::to_string(rows) + "\n");
+
+                if (this->parser.HasError()) {
+                    throw std::runtime_error("The server returned an error for the page: "
+                        + this->parser.GetError().ToString());
+                }
+
+                if (this->parser.GetResultCount() != 1 || this->parser.GetResult(0).tupleCount != rows
+                    || this->parser.GetResult(0).status.resultId != this->resultId) {
+
+                    throw std::runtime_error("Invalid response for the rows " + std::to_string(offset) + " - "
+                        + std::to_string(offset + rows - 1) + " of result " + std::to_string(this->resultId) + ".");
+                }
+
+                /*
+                    Cut the tuples at every 'pageSize' lines. The pages are
+                    inserted from the last one, so that the first (requested)
+                    one becomes the most recently used.
+                */
+                StringView tuples = this->parser.GetResult(0).tuples;
+                std::vector<StringView> slices(count);
+                const char *position = tuples.data;
+                const char *end = tuples.data + tuples.length;
+
+                for (size_t i = 0; i < count; i++) {
+                    const char *start = position;
+
+                    for (size_t line = 0; line < this->pageSize && position < end; line++) {
+                        const char *newLine = (const char*)memchr(position, '\n', end - position);
+                        position = newLine == nullptr ? end : newLine + 1;
+                    }
+
+                    slices[i] = StringView(start, position - start);
+                }
+
+                for (size_t i = count; i > 0; i--) {
+                    this->Insert(first + i - 1, slices[i - 1]);
+                }
+
+                this->stats.requests++;
+                this->stats.pagesFetched += count;
+                this->stats.pagesReadAhead += count - 1;
+                this->Evict();
+            }
+
+            /**
+             * @brief Get the number of the pages to fetch after a missing
+             * one: the following missing pages in the read-ahead window,
+             * limited to half the cache.
+             *
+             * @param number
+             * @return size_t
+             */
+            size_t GetReadAheadCount(size_t number) const {
+                size_t limit = this->readAhead;
+
+                if (!this->pages.empty()) {
+                    size_t average = this->cachedBytes / this->pages.size();
+                    limit = std::min(limit, this->settings.maxBytes / 2 / std::max((size_t)1, average));
+                }
+
+                size_t count = 0;
+                while (count < limit && number + count + 1 < this->pageCount
+                    && this->pages.find(number + count + 1) == this->pages.end()) {
+
+                    count++;
+                }
+
+                return count;
+            }
+
+        public:
+            /**
+             * @brief Construct a new RandomAccessCursor object
+             *
+             * @param connection An authenticated connection.
+             * @param settings
+             * @param kernel The SIMD kernel of the decoder.
+             */
+            RandomAccessCursor(Connection &connection, const PageCacheSettings &settings = PageCacheSettings(),
+                SimdKernel kernel = GetBestKernel()) : connection(connection), decoder(kernel), settings(settings) { }
+
+            RandomAccessCursor(const RandomAccessCursor&) = delete;
+            RandomAccessCursor &operator=(const RandomAccessCursor&) = delete;
+
+            /**
+             * @brief Close the result sets on the server through a lifecycle
+             * manager, from the next opened one on.
+             *
+             * @param lifecycle Must be bound to the same connection, and
+             * outlive the cursor.
+             */
+            void SetLifecycle(ResultLifecycle &lifecycle) {
+                this->lifecycle = &lifecycle;
+            }
+
+            /**
+             * @brief Enable the dictionary encoding of the string columns.
+             * Each page has its own dictionaries.
+             *
+             * @param maxSize See: ColumnarDecoder::SetMaxDictionarySize()
+             */
+            void SetMaxDictionarySize(size_t maxSize) {
+                this->decoder.SetMaxDictionarySize(maxSize);
+            }
+
+            /**
+             * @brief Execute a query. Its first page is cached from the
+             * response. The pages of the previous result are dropped.
+             *
+             * @param query A single SQL query, without the 's' prefix.
+             * @param pageSize The number of rows per page.
+             * @return bool False if the query returned no result set.
+             * (For example it was an update.) The cursor stays closed.
+             * @throw runtime_error On errors of the server or the decoding.
+             */
+            bool Open(StringView query, size_t pageSize) {
+                if (pageSize == 0) {
+                    throw std::runtime_error("RandomAccessCursor::Open(): The page size cannot be 0.");
+                }
+
+                this->Close();
+                this->pageSize = pageSize;
+
+                this->Execute("Xreply_size " + std::to_string(pageSize) + "\n");
+                if (this->parser.HasError()) {
+                    throw std::runtime_error("Failed to set the reply size: " + this->parser.GetError().ToString());
+                }
+
+                this->Execute("s" + TrimQuery(query).ToString() + ";\n");
+                if (this->parser.HasError()) {
+                    throw std::runtime_error("The query failed: " + this->parser.GetError().ToString());
+                }
+
+                if (this->parser.GetResultCount() != 1 || this->parser.GetResult(0).status.type != ResponseType::Table
+                    || this->parser.GetResult(0).status.resultId < 0) {
+
+                    return false;
+                }
+
+                const ParsedResult &first = this->parser.GetResult(0);
+                this->header.Assign(first);
+                this->resultId = first.status.resultId;
+                this->totalRows = (uint64_t)std::max(first.status.totalRowCount, (int64_t)0);
+                this->pageCount = (size_t)((this->totalRows + pageSize - 1) / pageSize);
+                this->stats = PageCacheStats();
+                this->open = true;
+
+                // The server closes the result sets which fit into the first response.
+                if (this->lifecycle != nullptr && (uint64_t)first.tupleCount < this->totalRows) {
+                    this->handle = ResultHandle(*this->lifecycle, this->resultId, HandleKind::Result);
+                }
+
+                if (this->pageCount > 0) {
+                    this->Insert(0, first.tuples);
+                }
+
+                return true;
+            }
+
+            /**
+             * @brief Drop the cached pages. The result set stays open on the
+             * server, unless a lifecycle manager is set.
+             */
+            void Close() {
+                this->handle.Reset();
+                this->pages.clear();
+                this->recent.clear();
+                this->cachedBytes = 0;
+                this->lastPage = NO_PAGE;
+                this->readAhead = 0;
+                this->open = false;
+            }
+
+            /**
+             * @brief Get a page, fetching it if it is not cached.
+             *
+             * @param number
+             * @return const ColumnarResult& Valid until the next access.
+             * @throw runtime_error If the page does not exist, or on errors
+             * of the server or the decoding.
+             */
+            const ColumnarResult &GetPage(size_t number) {
+                if (!this->open || number >= this->pageCount) {
+                    throw std::runtime_error("RandomAccessCursor: Page " + std::to_string(number)
+                        + " does not exist.");
+                }
+
+                if (number != this->lastPage) {
+                    if (this->lastPage != NO_PAGE && number == this->lastPage + 1) {
+                        this->readAhead = std::min(std::max((size_t)1, this->readAhead * 2),
+                            this->settings.maxReadAhead);
+                    } else {
+                        this->readAhead = 0;
+                    }
+
+                    this->lastPage = number;
+                    auto it = this->pages.find(number);
+
+                    if (it == this->pages.end()) {
+                        this->stats.misses++;
+                        this->Fetch(number, 1 + this->GetReadAheadCount(number));
+                    } else {
+                        this->stats.hits++;
+                        this->recent.splice(this->recent.begin(), this->recent, it->second->position);
+                    }
+                }
+
+                return this->pages[number]->data;
+            }
+
+            /**
+             * @brief Get the page of a row.
+             *
+             * @param row
+             * @param index Output: the index of the row inside the page.
+             * @return const ColumnarResult& Valid until the next access.
+             * @throw runtime_error If the row does not exist, or on errors
+             * of the server or the decoding.
+             */
+            const ColumnarResult &GetRow(uint64_t row, size_t &index) {
+                if (row >= this->totalRows) {
+                    throw std::runtime_error("RandomAccessCursor: Row " + std::to_string(row) + " does not exist.");
+                }
+
+                index = (size_t)(row % this->pageSize);
+                return this->GetPage((size_t)(row / this->pageSize));
+            }
+
+            /**
+             * @brief Returns true if a page is in the cache.
+             *
+             * @param number
+             * @return bool
+             */
+            bool IsCached(size_t number) const {
+                return this->pages.find(number) != this->pages.end();
+            }
+
+            /**
+             * @brief Get the header of the result. (Without the total row count.)
+             *
+             * @return const ParsedResult&
+             */
+            const ParsedResult &GetHeader() const {
+                return this->header.Get();
+            }
+
+            int64_t GetResultId() const {
+                return this->resultId;
+            }
+
+            uint64_t GetTotalRowCount() const {
+                return this->totalRows;
+            }
+
+            size_t GetPageSize() const {
+                return this->pageSize;
+            }
+
+            size_t GetPageCount() const {
+                return this->pageCount;
+            }
+
+            size_t GetCachedPageCount() const {
+                return this->pages.size();
+            }
+
+            /**
+             * @brief Get the memory used by the cached pages.
+             *
+             * @return size_t
+             */
+            size_t GetCachedBytes() const {
+                return this->cachedBytes;
+            }
+
+            bool IsOpen() const {
+                return this->open;
+            }
+
+            /**
+             * @brief Get the counters of the cache, since the last Open().
+             *
+             * @return const PageCacheStats&
+             */
+            const PageCacheStats &GetStats() const {
+                return this->stats;
+            }
+    };
+}
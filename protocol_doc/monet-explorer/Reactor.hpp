@@ -0,0 +1,539 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Connection.hpp"
+#include "ConnectionSettings.hpp"
+#include "Handshake.hpp"
+#include "StringView.hpp"
+
+
+namespace MonetExplorer {
+    class Reactor;
+
+    /**
+     * @brief The states of an asynchronous session.
+     */
+    enum class SessionState : int {
+        Idle = 1,           // Not started yet
+        Connecting = 2,
+        Authenticating = 3,
+        Ready = 4,          // Authenticated, no request in progress
+        Busy = 5,           // Waiting for the response of a request
+        Closed = 6,
+        Failed = 7
+    };
+
+    /**
+     * @brief A session driven by a Reactor. It connects,
+     * authenticates and exchanges messages with the server
+     * without blocking. The requests are queued, and sent
+     * one by one, as the previous responses arrive.
+     */
+    class AsyncSession {
+        friend class Reactor;
+
+        public:
+            /**
+             * @brief Called with the response of a request. The view
+             * is only valid during the call. Error responses of the
+             * server (starting with '!') are passed here too.
+             */
+            typedef std::function<void(AsyncSession &session, StringView response)> ResponseCallback;
+
+            /**
+             * @brief Called once when the session is authenticated.
+             */
+            typedef std::function<void(AsyncSession &session)> ReadyCallback;
+
+            /**
+             * @brief Called once when the session failed. The queued
+             * requests are dropped without calling their callbacks.
+             */
+            typedef std::function<void(AsyncSession &session, const std::string &error)> ErrorCallback;
+
+        private:
+            struct Request {
+                std::string message;
+                ResponseCallback callback;
+            };
+
+            ConnectionSettings settings;
+            Connection connection;
+            Handshake handshake;
+            SessionState state = SessionState::Idle;
+            Reactor *reactor = nullptr;
+            std::deque<Request> queue;
+            ResponseCallback currentCallback;
+            ReadyCallback onReady;
+            ErrorCallback onError;
+            std::string error;
+
+            /**
+             * @brief Open the socket in non-blocking mode.
+             */
+            void Start() {
+                this->connection.SetNonBlocking(true);
+                this->connection.SetSocketTuning(this->settings.tuning);
+
+                if (this->settings.unixDomainSocket) {
+                    this->connection.ConnectUnix(this->settings.GetSocketFilePath());
+                } else {
+                    this->connection.ConnectTCP(this->settings.host, this->settings.port);
+                }
+
+                this->state = SessionState::Connecting;
+            }
+
+            /**
+             * @brief Returns true if the reactor has to wait
+             * for the socket to become writable.
+             *
+             * @return bool
+             */
+            bool WantsWrite() const {
+                return this->state == SessionState::Connecting || this->connection.HasPendingOutput();
+            }
+
+            /**
+             * @brief Returns true if the session waits for
+             * network events to make progress.
+             *
+             * @return bool
+             */
+            bool IsActive() const {
+                return this->state == SessionState::Connecting || this->state == SessionState::Authenticating
+                    || this->state == SessionState::Busy;
+            }
+
+            /**
+             * @brief Process the readiness events of the socket.
+             *
+             * @param events Event flags from epoll.
+             */
+            void HandleEvents(uint32_t events) {
+                StringView msg;
+                std::string reply;
+                int response;
+
+                if (this->state == SessionState::Connecting) {
+                    int connectError = this->connection.GetConnectError();
+                    if (connectError != 0) {
+                        throw std::runtime_error("Failed to connect to the server. Error: '"
+                            + std::string(strerror(connectError)) + "' (" + std::to_string(connectError) + ")");
+                    }
+
+                    if ((events & EPOLLOUT) == 0) {
+                        return;
+                    }
+
+                    if (this->settings.unixDomainSocket) {
+                        this->connection.SendUnixDomainSocketInitByte();
+                    }
+
+                    this->state = SessionState::Authenticating;
+                }
+
+                if (events & EPOLLOUT) {
+                    this->connection.TryFlush();
+                }
+
+                if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) == 0) {
+                    return;
+                }
+
+                while (this->IsActive()) {
+                    response = this->connection.TryReceiveMessage(msg);
+                    if (response == 0) {
+                        return;
+                    } else if (response < 0) {
+                        throw std::runtime_error("The server closed the connection.");
+                    }
+
+                    if (this->state == SessionState::Authenticating) {
+                        HandshakeStep step = this->handshake.Process(msg, reply);
+
+                        if (step == HandshakeStep::SendReply) {
+                            this->connection.QueueMessage(reply);
+                            this->connection.TryFlush();
+                        } else if (step == HandshakeStep::Authenticated) {
+                            this->state = SessionState::Ready;
+
+                            if (this->onReady) {
+                                this->onReady(*this);
+                            }
+
+                            this->SendNext();
+                        }
+                    } else {
+                        ResponseCallback callback;
+                        std::swap(callback, this->currentCallback);
+                        this->state = SessionState::Ready;
+
+                        if (callback) {
+                            callback(*this, msg);
+                        }
+
+                        this->SendNext();
+                    }
+                }
+            }
+
+            /**
+             * @brief Send the next queued request, if the
+             * session is ready for it.
+             */
+            void SendNext() {
+                if (this->state != SessionState::Ready || this->queue.empty()) {
+                    return;
+                }
+
+                Request &request = this->queue.front();
+                this->connection.QueueMessage(request.message);
+                this->currentCallback = request.callback;
+                this->queue.pop_front();
+                this->state = SessionState::Busy;
+
+                this->connection.TryFlush();
+            }
+
+            /**
+             * @brief Close the connection after an error and
+             * notify the owner.
+             *
+             * @param message The error message.
+             */
+            void Fail(const std::string &message);
+
+        public:
+            /**
+             * @brief Construct a new AsyncSession object
+             *
+             * @param settings Where to connect and how to authenticate.
+             */
+            AsyncSession(const ConnectionSettings &settings) : settings(settings), connection(),
+                handshake(settings) { }
+
+            /**
+             * @brief Destroy the AsyncSession object
+             */
+            ~AsyncSession() {
+                this->Close();
+            }
+
+            /**
+             * @brief Set the function to be called after a successful authentication.
+             *
+             * @param callback
+             */
+            void OnReady(ReadyCallback callback) {
+                this->onReady = callback;
+            }
+
+            /**
+             * @brief Set the function to be called when the session fails.
+             *
+             * @param callback
+             */
+            void OnError(ErrorCallback callback) {
+                this->onError = callback;
+            }
+
+            /**
+             * @brief Queue a request. It is sent when the session is
+             * authenticated and the responses of the previous requests
+             * have arrived.
+             *
+             * @param message The message to send. (For example: "sSELECT 1;")
+             * @param callback Called with the response.
+             */
+            void Query(StringView message, ResponseCallback callback);
+
+            /**
+             * @brief Close the connection and detach from the reactor.
+             * The queued requests are dropped.
+             */
+            void Close();
+
+            /**
+             * @brief Get the current state of the session.
+             *
+             * @return SessionState
+             */
+            SessionState GetState() const {
+                return this->state;
+            }
+
+            /**
+             * @brief Get the error message, if the session failed.
+             *
+             * @return const std::string&
+             */
+            const std::string &GetError() const {
+                return this->error;
+            }
+
+            /**
+             * @brief Get the underlying connection. (For example
+             * to query its transfer statistics.)
+             *
+             * @return const Connection&
+             */
+            const Connection &GetConnection() const {
+                return this->connection;
+            }
+    };
+
+    /**
+     * @brief Drives many asynchronous sessions from a single
+     * thread, using epoll for waiting on their sockets.
+     */
+    class Reactor {
+        private:
+            int epollFd = -1;
+            std::unordered_map<int, AsyncSession*> sessions;
+            std::vector<struct epoll_event> events;
+
+            /**
+             * @brief Calculate the epoll event mask for a session.
+             *
+             * @param session
+             * @return uint32_t
+             */
+            uint32_t GetEventMask(const AsyncSession &session) {
+                return EPOLLIN | (session.WantsWrite() ? (uint32_t)EPOLLOUT : 0);
+            }
+
+        public:
+            /**
+             * @brief Construct a new Reactor object
+             *
+             * @param maxEvents The maximal number of events processed
+             * in one iteration.
+             */
+            Reactor(int maxEvents = 256) : events(maxEvents) {
+                this->epollFd = epoll_create1(EPOLL_CLOEXEC);
+                if (this->epollFd == -1) {
+                    throw std::runtime_error("Failed to create epoll instance. Error: '"
+                        + std::string(strerror(errno)) + "' (" + std::to_string(errno) + ")");
+                }
+            }
+
+            /**
+             * @brief Destroy the Reactor object. The sessions
+             * are detached, but not closed.
+             */
+            ~Reactor() {
+                for (auto &item : this->sessions) {
+                    item.second->reactor = nullptr;
+                }
+
+                close(this->epollFd);
+            }
+
+            /**
+             * @brief Start a session: connect to the server and
+             * authenticate. The session must outlive its
+             * attachment to the reactor.
+             *
+             * @param session A session in Idle state.
+             */
+            void Add(AsyncSession &session) {
+                if (session.state != SessionState::Idle) {
+                    throw std::runtime_error("Reactor::Add(): Only sessions in idle state can be added.");
+                }
+
+                try {
+                    session.Start();
+                } catch (const std::runtime_error &err) {
+                    session.Fail(err.what());
+                    return;
+                }
+
+                struct epoll_event event;
+                event.events = this->GetEventMask(session);
+                event.data.fd = session.connection.GetSocket();
+
+                if (epoll_ctl(this->epollFd, EPOLL_CTL_ADD, event.data.fd, &event) != 0) {
+                    session.Fail("Failed to register the socket in epoll. Error: '"
+                        + std::string(strerror(errno)) + "' (" + std::to_string(errno) + ")");
+                    return;
+                }
+
+                this->sessions[event.data.fd] = &session;
+                session.reactor = this;
+            }
+
+            /**
+             * @brief Update the events the reactor waits for,
+             * after the session changed its state.
+             *
+             * @param session
+             */
+            void Update(AsyncSession &session) {
+                struct epoll_event event;
+                event.events = this->GetEventMask(session);
+                event.data.fd = session.connection.GetSocket();
+
+                epoll_ctl(this->epollFd, EPOLL_CTL_MOD, event.data.fd, &event);
+            }
+
+            /**
+             * @brief Stop watching the socket of a session.
+             * Must be called before its socket is closed.
+             *
+             * @param session
+             */
+            void Remove(AsyncSession &session) {
+                int fd = session.connection.GetSocket();
+
+                if (fd > -1) {
+                    epoll_ctl(this->epollFd, EPOLL_CTL_DEL, fd, nullptr);
+                    this->sessions.erase(fd);
+                }
+
+                session.reactor = nullptr;
+            }
+
+            /**
+             * @brief Wait for network events once, and process them.
+             *
+             * @param timeoutMs Timeout in milliseconds. -1 = infinite.
+             * @return int The number of processed events.
+             */
+            int RunOnce(int timeoutMs) {
+                int count = epoll_wait(this->epollFd, this->events.data(), this->events.size(), timeoutMs);
+                if (count < 0) {
+                    if (errno == EINTR) {
+                        return 0;
+                    }
+
+                    throw std::runtime_error("Failed to wait for events. Error: '"
+                        + std::string(strerror(errno)) + "' (" + std::to_string(errno) + ")");
+                }
+
+                for (int i = 0; i < count; i++) {
+                    /*
+                        Look up by descriptor: a callback might have
+                        closed a session of a later event.
+                    */
+                    auto item = this->sessions.find(this->events[i].data.fd);
+                    if (item == this->sessions.end()) {
+                        continue;
+                    }
+
+                    AsyncSession &session = *item->second;
+
+                    try {
+                        session.HandleEvents(this->events[i].events);
+                    } catch (const std::runtime_error &err) {
+                        session.Fail(err.what());
+                        continue;
+                    }
+
+                    if (session.reactor == this) {
+                        this->Update(session);
+                    }
+                }
+
+                return count;
+            }
+
+            /**
+             * @brief Process events until no session waits for
+             * the network. (All are ready with empty queues,
+             * closed or failed.)
+             */
+            void Run() {
+                while (this->HasActiveSessions()) {
+                    this->RunOnce(-1);
+                }
+            }
+
+            /**
+             * @brief Returns true if any of the sessions is connecting,
+             * authenticating or waiting for a response.
+             *
+             * @return bool
+             */
+            bool HasActiveSessions() const {
+                for (auto &item : this->sessions) {
+                    if (item.second->IsActive()) {
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+    };
+
+    inline void AsyncSession::Fail(const std::string &message) {
+        if (this->reactor != nullptr) {
+            this->reactor->Remove(*this);
+        }
+
+        this->connection.Disconnect();
+        this->queue.clear();
+        this->currentCallback = nullptr;
+        this->state = SessionState::Failed;
+        this->error = message;
+
+        if (this->onError) {
+            this->onError(*this, message);
+        }
+    }
+
+    inline void AsyncSession::Query(StringView message, ResponseCallback callback) {
+        if (this->state == SessionState::Closed || this->state == SessionState::Failed) {
+            throw std::runtime_error("AsyncSession::Query(): The session is already closed.");
+        }
+
+        Request request;
+        request.message = message.ToString();
+        request.callback = callback;
+        this->queue.push_back(request);
+
+        this->SendNext();
+
+        if (this->reactor != nullptr) {
+            this->reactor->Update(*this);
+        }
+    }
+
+    inline void AsyncSession::Close() {
+        if (this->reactor != nullptr) {
+            this->reactor->Remove(*this);
+        }
+
+        if (this->state != SessionState::Idle && this->state != SessionState::Failed) {
+            this->connection.Disconnect();
+            this->state = SessionState::Closed;
+        }
+
+        this->queue.clear();
+        this->currentCallback = nullptr;
+    }
+}
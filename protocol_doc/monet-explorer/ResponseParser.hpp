@@ -0,0 +1,664 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "StringView.hpp"
+#include "Unescaper.hpp"
+
+
+namespace MonetExplorer {
+    /**
+     * @brief The kinds of lines in a response, identified
+     * by their first character. See: protocol_doc chapter 5.
+     */
+    enum class LineType : int {
+        Redirect = 1,       // ^
+        QueryResponse = 2,  // &
+        TableHeader = 3,    // %
+        Error = 4,          // !
+        Tuple = 5,          // [
+        Prompt = 6,         // \001
+        Unknown = 7
+    };
+
+    /**
+     * @brief The sub-types of the query responses. (The digit after the '&')
+     */
+    enum class ResponseType : int {
+        Table = 1,          // Data response
+        Update = 2,         // Modification results
+        Schema = 3,         // Stats only
+        Transaction = 4,
+        Prepare = 5,        // Prepared statement creation
+        Block = 6           // Response to an export command
+    };
+
+    /**
+     * @brief The fields of the first line of a query response.
+     * The fields which are not present in the given response
+     * type are -1.
+     */
+    struct StatusRecord {
+        ResponseType type = ResponseType::Schema;
+        int64_t resultId = -1;
+        int64_t totalRowCount = -1;
+        int64_t columnCount = -1;
+        int64_t rowCount = -1;              // Rows in this message only
+        int64_t queryId = -1;
+        int64_t queryTimeUs = -1;
+        int64_t malOptimizerTimeUs = -1;
+        int64_t sqlOptimizerTimeUs = -1;
+        int64_t affectedRows = -1;
+        int64_t lastInsertId = -1;
+        int64_t preparedStatementId = -1;
+        int64_t exportOffset = -1;
+        bool autoCommit = true;             // Only for the transaction responses
+        StringView line;
+    };
+
+    /**
+     * @brief The metadata of a column, from the '%' header lines.
+     */
+    struct ColumnInfo {
+        StringView tableName;
+        StringView name;
+        StringView type;
+        int length = 0;
+        StringView typeSizes;               // Only if enabled by 'Xsizeheader 1'
+    };
+
+    /**
+     * @brief A single result inside a response message. The tuple
+     * lines of a result are stored contiguously in the message,
+     * so they are referenced as a single range.
+     */
+    struct ParsedResult {
+        StatusRecord status;
+        std::vector<ColumnInfo> columns;
+        StringView tuples;                  // The tuple lines, including their '\n'
+        size_t tupleCount = 0;
+    };
+
+    /**
+     * @brief Iterates over the fields of a tuple line.
+     * The fields are returned in their escaped form.
+     */
+    class FieldReader {
+        private:
+            StringView line;
+            const char *position;
+            const char *end;
+
+        public:
+            /**
+             * @brief Construct a new FieldReader object
+             *
+             * @param tuple A tuple line, with or without the '\n'.
+             */
+            FieldReader(StringView tuple) {
+                if (tuple.length > 0 && tuple.data[tuple.length - 1] == '\n') {
+                    tuple.length--;
+                }
+
+                this->line = tuple;
+
+                // Skip the leading "[ " and the trailing "\t]"
+                if (tuple.length >= 4 && tuple.data[0] == '[') {
+                    this->position = tuple.data + 2;
+                    this->end = tuple.data + tuple.length - 2;
+                } else {
+                    this->position = tuple.data;
+                    this->end = tuple.data;
+                }
+            }
+
+            /**
+             * @brief Get the next field. All the text values are escaped
+             * inside the tuples, so the tabs can only be separators.
+             *
+             * @param field Output: the raw field.
+             * @return bool False if there are no more fields.
+             * @throw runtime_error If a separator is not ",\t".
+             */
+            bool Next(StringView &field) {
+                if (this->position == nullptr || this->position > this->end) {
+                    return false;
+                }
+
+                const char *tab = (const char*)memchr(this->position, '\t', this->end - this->position);
+
+                if (tab == nullptr) {
+                    field = StringView(this->position, this->end - this->position);
+                    this->position = nullptr;
+                } else {
+                    // The separator is ",\t"
+                    if (tab == this->position || tab[-1] != ',') {
+                        throw std::runtime_error("Invalid tuple line from MonetDB (missing separator): "
+                            + this->line.ToString());
+                    }
+
+                    field = StringView(this->position, tab - 1 - this->position);
+                    this->position = tab + 1;
+                }
+
+                return true;
+            }
+    };
+
+    /**
+     * @brief Iterates over the tuple lines of a result.
+     */
+    class TupleReader {
+        private:
+            const char *position;
+            const char *end;
+
+        public:
+            /**
+             * @brief Construct a new TupleReader object
+             *
+             * @param tuples The tuple lines of a result.
+             */
+            TupleReader(StringView tuples) : position(tuples.data), end(tuples.data + tuples.length) { }
+
+            /**
+             * @brief Get the next tuple line.
+             *
+             * @param tuple Output: the line without the '\n'.
+             * @return bool False if there are no more tuples.
+             */
+            bool Next(StringView &tuple) {
+                if (this->position >= this->end) {
+                    return false;
+                }
+
+                const char *newLine = (const char*)memchr(this->position, '\n', this->end - this->position);
+                const char *lineEnd = newLine == nullptr ? this->end : newLine;
+
+                tuple = StringView(this->position, lineEnd - this->position);
+                this->position = newLine == nullptr ? this->end : newLine + 1;
+
+                return true;
+            }
+    };
+
+    /**
+     * @brief Parses the response messages into results, column
+     * metadata and tuples. Nothing is copied: all the returned views
+     * point into the message, which must outlive them. The parser
+     * reuses its allocations between the messages.
+     * See: protocol_doc chapters 5 and 6.
+     */
+    class ResponseParser {
+        private:
+            std::vector<ParsedResult> results;
+            size_t resultCount = 0;
+            StringView error;
+            StringView redirect;
+            StringView prompt;
+            std::vector<StringView> headerValues;
+
+            /**
+             * @brief Get the next line.
+             *
+             * @param position Input/output: the position in the message.
+             * @param end The end of the message.
+             * @return StringView The line without the '\n'.
+             */
+            static StringView NextLine(const char *&position, const char *end) {
+                const char *newLine = (const char*)memchr(position, '\n', end - position);
+                const char *lineEnd = newLine == nullptr ? end : newLine;
+                StringView line(position, lineEnd - position);
+
+                position = newLine == nullptr ? end : newLine + 1;
+
+                return line;
+            }
+
+            /**
+             * @brief Parse a '%' line into the column info records.
+             *
+             * @param line
+             * @param result
+             */
+            void ParseHeader(StringView line, ParsedResult &result) {
+                StringView name;
+                ParseHeaderLine(line, this->headerValues, name);
+
+                if (result.columns.size() < this->headerValues.size()) {
+                    result.columns.resize(this->headerValues.size());
+                }
+
+                for (size_t i = 0; i < this->headerValues.size(); i++) {
+                    ColumnInfo &column = result.columns[i];
+                    StringView value = this->headerValues[i];
+
+                    if (name.length == 10 && memcmp(name.data, "table_name", 10) == 0) {
+                        column.tableName = value;
+                    } else if (name.length == 4 && memcmp(name.data, "name", 4) == 0) {
+                        column.name = value;
+                    } else if (name.length == 4 && memcmp(name.data, "type", 4) == 0) {
+                        column.type = value;
+                    } else if (name.length == 6 && memcmp(name.data, "length", 6) == 0) {
+                        int64_t length = 0;
+                        ParseInt(value, length);
+                        column.length = (int)length;
+                    } else if (name.length == 9 && memcmp(name.data, "typesizes", 9) == 0) {
+                        column.typeSizes = value;
+                    }
+                }
+            }
+
+        public:
+            /**
+             * @brief Identify the type of a line.
+             *
+             * @param line
+             * @return LineType
+             */
+            static LineType ClassifyLine(StringView line) {
+                if (line.length == 0) {
+                    return LineType::Unknown;
+                }
+
+                switch (line.data[0]) {
+                    case '^': return LineType::Redirect;
+                    case '&': return LineType::QueryResponse;
+                    case '%': return LineType::TableHeader;
+                    case '!': return LineType::Error;
+                    case '[': return LineType::Tuple;
+                    case '\001': return LineType::Prompt;
+                    default: return LineType::Unknown;
+                }
+            }
+
+            /**
+             * @brief Parse a decimal integer.
+             *
+             * @param text Without white-spaces.
+             * @param value Output.
+             * @return bool False if the text is not a valid integer.
+             */
+            static bool ParseInt(StringView text, int64_t &value) {
+                const char *position = text.data;
+                const char *end = text.data + text.length;
+                bool negative = false;
+                uint64_t result = 0;
+
+                if (position < end && (*position == '-' || *position == '+')) {
+                    negative = *position == '-';
+                    position++;
+                }
+
+                if (position == end) {
+                    return false;
+                }
+
+                for (; position < end; position++) {
+                    if (*position < '0' || *position > '9') {
+                        return false;
+                    }
+
+                    result = result * 10 + (*position - '0');
+                }
+
+                value = negative ? -(int64_t)result : (int64_t)result;
+                return true;
+            }
+
+            /**
+             * @brief Parse the first line of a query response ('&').
+             * Extra fields are ignored, because newer servers can add
+             * new ones. (See: protocol_doc chapter 5)
+             *
+             * @param line
+             * @return StatusRecord
+             * @throw runtime_error If the line has fewer fields than expected.
+             */
+            static StatusRecord ParseStatus(StringView line) {
+                StatusRecord status;
+                int64_t fields[8];
+                size_t fieldCount = 0;
+                StringView text;
+
+                if (line.length < 2 || line.data[0] != '&' || line.data[1] < '1' || line.data[1] > '6') {
+                    throw std::runtime_error("Invalid query response from MonetDB: " + line.ToString());
+                }
+
+                status.type = (ResponseType)(line.data[1] - '0');
+                status.line = line;
+
+                /*
+                    Split the space-separated fields
+                */
+                const char *position = line.data + 2;
+                const char *end = line.data + line.length;
+
+                while (position < end && fieldCount < 8) {
+                    while (position < end && *position == ' ') {
+                        position++;
+                    }
+
+                    const char *fieldStart = position;
+                    while (position < end && *position != ' ' && *position != '\r') {
+                        position++;
+                    }
+
+                    if (position == fieldStart) {
+                        break;
+                    }
+
+                    text = StringView(fieldStart, position - fieldStart);
+
+                    if (status.type == ResponseType::Transaction) {
+                        status.autoCommit = !(text.length == 1 && text.data[0] == 'f');
+                        fieldCount++;
+                        break;
+                    }
+
+                    if (!ParseInt(text, fields[fieldCount])) {
+                        throw std::runtime_error("Invalid field in the query response from MonetDB: "
+                            + line.ToString());
+                    }
+
+                    fieldCount++;
+                }
+
+                static const size_t expected[] = { 0, 8, 6, 2, 1, 4, 4 };
+                if (fieldCount < expected[(int)status.type]) {
+                    throw std::runtime_error("Invalid response from MonetDB. Status response has invalid number "
+                        "of fields. '" + std::to_string(expected[(int)status.type]) + "' is expected: "
+                        + line.ToString());
+                }
+
+                switch (status.type) {
+                    case ResponseType::Table:
+                        status.resultId = fields[0];
+                        status.totalRowCount = fields[1];
+                        status.columnCount = fields[2];
+                        status.rowCount = fields[3];
+                        status.queryId = fields[4];
+                        status.queryTimeUs = fields[5];
+                        status.malOptimizerTimeUs = fields[6];
+                        status.sqlOptimizerTimeUs = fields[7];
+                        break;
+                    case ResponseType::Update:
+                        status.affectedRows = fields[0];
+                        status.lastInsertId = fields[1];
+                        status.queryId = fields[2];
+                        status.queryTimeUs = fields[3];
+                        status.malOptimizerTimeUs = fields[4];
+                        status.sqlOptimizerTimeUs = fields[5];
+                        break;
+                    case ResponseType::Schema:
+                        status.queryTimeUs = fields[0];
+                        status.malOptimizerTimeUs = fields[1];
+                        break;
+                    case ResponseType::Transaction:
+                        break;
+                    case ResponseType::Prepare:
+                        status.preparedStatementId = fields[0];
+                        status.totalRowCount = fields[1];
+                        status.columnCount = fields[2];
+                        status.rowCount = fields[3];
+                        break;
+                    case ResponseType::Block:
+                        status.resultId = fields[0];
+                        status.columnCount = fields[1];
+                        status.rowCount = fields[2];
+                        status.exportOffset = fields[3];
+                        break;
+                }
+
+                return status;
+            }
+
+            /**
+             * @brief Parse a table header line. Format:
+             * "% value1,\tvalue2,\t... # header_name"
+             *
+             * @param line
+             * @param values Output: the values for each column.
+             * @param name Output: the name of the header line.
+             * @throw runtime_error If the line is not a valid header line.
+             */
+            static void ParseHeaderLine(StringView line, std::vector<StringView> &values, StringView &name) {
+                values.clear();
+
+                const char *end = line.data + line.length;
+                const char *separator = nullptr;
+
+                // The name is after the last " # "
+                for (const char *position = end - 3; position >= line.data + 1; position--) {
+                    if (position[0] == ' ' && position[1] == '#' && position[2] == ' ') {
+                        separator = position;
+                        break;
+                    }
+                }
+
+                if (line.length < 2 || line.data[0] != '%' || separator == nullptr) {
+                    throw std::runtime_error("Invalid response from MonetDB. Broken table header line: "
+                        + line.ToString());
+                }
+
+                name = StringView(separator + 3, end - separator - 3);
+
+                const char *position = line.data + 2;
+                while (position <= separator) {
+                    const char *tab = (const char*)memchr(position, '\t', separator - position);
+
+                    if (tab == nullptr) {
+                        values.push_back(StringView(position, separator - position));
+                        break;
+                    }
+
+                    // The values are separated by ",\t"
+                    if (tab == position || tab[-1] != ',') {
+                        throw std::runtime_error("Invalid response from MonetDB. Broken table header line: "
+                            + line.ToString());
+                    }
+
+                    values.push_back(StringView(position, tab - 1 - position));
+                    position = tab + 1;
+                }
+            }
+
+            /**
+             * @brief Returns true if the raw field is the NULL value.
+             * (Unquoted, case-insensitive.)
+             *
+             * @param field
+             * @return bool
+             */
+            static bool IsNull(StringView field) {
+                return field.length == 4 && (field.data[0] | 0x20) == 'n' && (field.data[1] | 0x20) == 'u'
+                    && (field.data[2] | 0x20) == 'l' && (field.data[3] | 0x20) == 'l';
+            }
+
+            /**
+             * @brief Returns true if the raw field is a quoted string.
+             *
+             * @param field
+             * @return bool
+             */
+            static bool IsString(StringView field) {
+                return field.length >= 2 && field.data[0] == '"' && field.data[field.length - 1] == '"';
+            }
+
+            /**
+             * @brief Get the value of a quoted string field, by removing
+             * the quotes and resolving the escape sequences.
+             * See: protocol_doc chapter 6.1
+             *
+             * @param field A raw field. If it is not quoted, then it is copied as is.
+             * @param output Output: the value. (Overwritten)
+             */
+            static void Unescape(StringView field, std::string &output) {
+                output.clear();
+
+                if (!IsString(field)) {
+                    output.append(field.data, field.length);
+                    return;
+                }
+
+                output.resize(field.length - 2);
+                output.resize(Unescaper::UnescapeScalar(field.data + 1, field.length - 2, &output[0]));
+            }
+
+            /**
+             * @brief Parse a complete response message.
+             * The results of the previous message are discarded.
+             *
+             * @param message The message. Must outlive the parsed views.
+             * @throw runtime_error On an invalid line.
+             */
+            void Parse(StringView message) {
+                const char *position = message.data;
+                const char *end = message.data + message.length;
+                ParsedResult *current = nullptr;
+
+                this->resultCount = 0;
+                this->error = StringView();
+                this->redirect = StringView();
+                this->prompt = StringView();
+
+                while (position < end) {
+                    const char *lineStart = position;
+                    StringView line = NextLine(position, end);
+
+                    switch (ClassifyLine(line)) {
+                        case LineType::QueryResponse:
+                            if (this->resultCount == this->results.size()) {
+                                this->results.emplace_back();
+                            }
+
+                            current = &this->results[this->resultCount++];
+                            current->status = ParseStatus(line);
+                            current->columns.clear();
+                            current->tuples = StringView(position, 0);
+                            current->tupleCount = 0;
+                            break;
+
+                        case LineType::TableHeader:
+                            if (current == nullptr) {
+                                throw std::runtime_error("Invalid response from MonetDB. Table header "
+                                    "without a query response: " + line.ToString());
+                            }
+
+                            this->ParseHeader(line, *current);
+                            current->tuples = StringView(position, 0);
+                            break;
+
+                        case LineType::Tuple:
+                            if (current == nullptr) {
+                                throw std::runtime_error("Invalid response from MonetDB. Tuple "
+                                    "without a query response: " + line.ToString());
+                            }
+
+                            current->tuples.length = position - current->tuples.data;
+                            current->tupleCount++;
+                            break;
+
+                        case LineType::Error:
+                            // Multi-line errors are kept together.
+                            if (this->error.IsEmpty()) {
+                                this->error = StringView(lineStart, position - lineStart);
+                            } else {
+                                this->error.length = position - this->error.data;
+                            }
+                            break;
+
+                        case LineType::Redirect:
+                            this->redirect = line;
+                            break;
+
+                        case LineType::Prompt:
+                            this->prompt = line;
+                            break;
+
+                        default:
+                            if (line.length > 0) {
+                                throw std::runtime_error("Invalid response from MonetDB: " + line.ToString());
+                            }
+                    }
+                }
+            }
+
+            /**
+             * @brief Get the number of results in the last parsed message.
+             *
+             * @return size_t
+             */
+            size_t GetResultCount() const {
+                return this->resultCount;
+            }
+
+            /**
+             * @brief Get a result of the last parsed message.
+             *
+             * @param index Less than GetResultCount().
+             * @return const ParsedResult&
+             */
+            const ParsedResult &GetResult(size_t index) const {
+                if (index >= this->resultCount) {
+                    throw std::runtime_error("ResponseParser::GetResult(): Index out of range.");
+                }
+
+                return this->results[index];
+            }
+
+            /**
+             * @brief Returns true if the message contained an error.
+             *
+             * @return bool
+             */
+            bool HasError() const {
+                return !this->error.IsEmpty();
+            }
+
+            /**
+             * @brief Get the error lines, including the leading '!' characters.
+             *
+             * @return StringView Empty if there was no error.
+             */
+            StringView GetError() const {
+                return this->error;
+            }
+
+            /**
+             * @brief Get the redirect line.
+             *
+             * @return StringView Empty if there was no redirect.
+             */
+            StringView GetRedirect() const {
+                return this->redirect;
+            }
+
+            /**
+             * @brief Get the prompt line. (See: protocol_doc chapter 5.6)
+             *
+             * @return StringView Empty if there was no prompt.
+             */
+            StringView GetPrompt() const {
+                return this->prompt;
+            }
+    };
+}
@@ -0,0 +1,306 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Connection.hpp"
+#include "StringView.hpp"
+
+
+namespace MonetExplorer {
+    /**
+     * @brief The kinds of server-side objects of a session.
+     */
+    enum class HandleKind : int {
+        Result = 1,                 // A result set of a &1 response. Freed by Xclose.
+        PreparedStatement = 2       // A prepared statement of a &5 response. Freed by Xrelease.
+    };
+
+    /**
+     * @brief Counters of the lifecycle manager.
+     */
+    struct LifecycleStats {
+        uint64_t closes = 0;        // Xclose commands sent
+        uint64_t releases = 0;      // Xrelease commands sent
+        uint64_t pipelined = 0;     // Commands sent together with a request
+        uint64_t flushes = 0;       // Round trips of their own
+        uint64_t failures = 0;      // Error responses to the commands
+    };
+
+    /**
+     * @brief Frees the result sets and the prepared statements of a session,
+     * which the server would keep until the end of the session otherwise.
+     * (So a pooled session would pin their memory.) The Xclose and Xrelease
+     * commands are not sent right away, but queued, and they are pipelined
+     * with the next request: the queued commands and the request are sent
+     * in a single write, then the responses are read in the same order. So
+     * they don't cost a round trip of their own.
+     * The requests which should carry the queued commands have to be sent
+     * through Execute(). The manager must outlive its handles. The commands
+     * still queued at its destruction are dropped.
+     */
+    class ResultLifecycle {
+        private:
+            /**
+             * @brief A queued Xclose or Xrelease.
+             */
+            struct PendingCommand {
+                HandleKind kind;
+                int64_t id;
+            };
+
+            Connection &connection;
+            std::vector<PendingCommand> pending;
+            std::vector<std::string> commands;      // The formatted commands, reused
+            std::vector<StringView> messages;       // The commands and the request
+            LifecycleStats stats;
+
+            /**
+             * @brief Format the queued commands into the messages to be sent.
+             *
+             * @return size_t The number of the commands.
+             */
+            size_t FormatPending() {
+                size_t count = this->pending.size();
+                this->commands.resize(std::max(this->commands.size(), count));
+                this->messages.clear();
+
+                for (size_t i = 0; i < count; i++) {
+                    const PendingCommand &item = this->pending[i];
+
+                    if (item.kind == HandleKind::Result) {
+                        this->commands[i] = "Xclose " + std::to_string(item.id) + "\n";
+                        this->stats.closes++;
+                    } else {
+                        this->commands[i] = "Xrelease " + std::to_string(item.id) + "\n";
+                        this->stats.releases++;
+                    }
+
+                    this->messages.push_back(StringView(this->commands[i]));
+                }
+
+                this->pending.clear();
+
+                return count;
+            }
+
+            /**
+             * @brief Receive and check the responses of the sent commands.
+             * The errors are only counted, because the object could have
+             * been freed by the server already.
+             *
+             * @param count
+             * @throw runtime_error If the server disconnected.
+             */
+            void ReceivePending(size_t count) {
+                for (size_t i = 0; i < count; i++) {
+                    StringView response = this->connection.ReceiveMessageView();
+
+                    if (!this->connection.IsConnected()) {
+                        throw std::runtime_error("The server closed the connection while freeing the result sets.");
+                    }
+
+                    if (response.StartsWith("!")) {
+                        this->stats.failures++;
+                    }
+                }
+            }
+
+        public:
+            /**
+             * @brief Construct a new ResultLifecycle object
+             *
+             * @param connection An authenticated connection.
+             */
+            ResultLifecycle(Connection &connection) : connection(connection) { }
+
+            ResultLifecycle(const ResultLifecycle&) = delete;
+            ResultLifecycle &operator=(const ResultLifecycle&) = delete;
+
+            /**
+             * @brief Queue the closing of a result set.
+             *
+             * @param resultId
+             */
+            void ScheduleClose(int64_t resultId) {
+                this->pending.push_back({ HandleKind::Result, resultId });
+            }
+
+            /**
+             * @brief Queue the release of a prepared statement.
+             *
+             * @param statementId
+             */
+            void ScheduleRelease(int64_t statementId) {
+                this->pending.push_back({ HandleKind::PreparedStatement, statementId });
+            }
+
+            /**
+             * @brief Send a request together with the queued commands,
+             * and receive its response.
+             *
+             * @param message The request. (For example an SQL query with the 's' prefix.)
+             * @return StringView The response to the request. Valid until the next receive.
+             * @throw runtime_error If the server disconnected.
+             */
+            StringView Execute(StringView message) {
+                size_t count = this->FormatPending();
+                this->messages.push_back(message);
+                this->connection.SendMessages(this->messages.data(), this->messages.size());
+                this->stats.pipelined += count;
+
+                this->ReceivePending(count);
+
+                return this->connection.ReceiveMessageView();
+            }
+
+            /**
+             * @brief Send the queued commands right away. (For example before
+             * returning the session to a pool.) Costs a single round trip.
+             *
+             * @throw runtime_error If the server disconnected.
+             */
+            void Flush() {
+                if (this->pending.empty()) {
+                    return;
+                }
+
+                size_t count = this->FormatPending();
+                this->connection.SendMessages(this->messages.data(), count);
+
+                this->ReceivePending(count);
+                this->stats.flushes++;
+            }
+
+            /**
+             * @brief Returns the number of the queued commands.
+             *
+             * @return size_t
+             */
+            size_t GetPendingCount() const {
+                return this->pending.size();
+            }
+
+            const LifecycleStats &GetStats() const {
+                return this->stats;
+            }
+
+            Connection &GetConnection() {
+                return this->connection;
+            }
+    };
+
+    /**
+     * @brief Owns a result set or a prepared statement on the server.
+     * When the handle is reset or destroyed, then the object is queued
+     * for freeing. (See: ResultLifecycle) Movable, but not copyable.
+     */
+    class ResultHandle {
+        private:
+            ResultLifecycle *lifecycle = nullptr;
+            int64_t id = -1;
+            HandleKind kind = HandleKind::Result;
+
+        public:
+            ResultHandle() { }
+
+            /**
+             * @brief Construct a new ResultHandle object
+             *
+             * @param lifecycle Must outlive the handle.
+             * @param id The ID of the result set or the prepared statement.
+             * @param kind
+             */
+            ResultHandle(ResultLifecycle &lifecycle, int64_t id, HandleKind kind)
+                : lifecycle(&lifecycle), id(id), kind(kind) { }
+
+            ResultHandle(ResultHandle &&other) : lifecycle(other.lifecycle), id(other.id), kind(other.kind) {
+                other.lifecycle = nullptr;
+                other.id = -1;
+            }
+
+            ResultHandle &operator=(ResultHandle &&other) {
+                if (this != &other) {
+                    this->Reset();
+                    this->lifecycle = other.lifecycle;
+                    this->id = other.id;
+                    this->kind = other.kind;
+                    other.lifecycle = nullptr;
+                    other.id = -1;
+                }
+
+                return *this;
+            }
+
+            ResultHandle(const ResultHandle&) = delete;
+            ResultHandle &operator=(const ResultHandle&) = delete;
+
+            ~ResultHandle() {
+                this->Reset();
+            }
+
+            /**
+             * @brief Queue the freeing of the object, and empty the handle.
+             */
+            void Reset() {
+                if (this->lifecycle != nullptr && this->id >= 0) {
+                    if (this->kind == HandleKind::Result) {
+                        this->lifecycle->ScheduleClose(this->id);
+                    } else {
+                        this->lifecycle->ScheduleRelease(this->id);
+                    }
+                }
+
+                this->lifecycle = nullptr;
+                this->id = -1;
+            }
+
+            /**
+             * @brief Empty the handle without freeing the object.
+             * (For example when the server freed it already.)
+             *
+             * @return int64_t The ID. -1 if the handle was empty.
+             */
+            int64_t Detach() {
+                int64_t id = this->id;
+                this->lifecycle = nullptr;
+                this->id = -1;
+
+                return id;
+            }
+
+            int64_t GetId() const {
+                return this->id;
+            }
+
+            HandleKind GetKind() const {
+                return this->kind;
+            }
+
+            /**
+             * @brief Returns true if an object is owned.
+             *
+             * @return bool
+             */
+            bool IsValid() const {
+                return this->lifecycle != nullptr && this->id >= 0;
+            }
+    };
+}
@@ -0,0 +1,359 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ColumnarDecoder.hpp"
+#include "ColumnarResult.hpp"
+#include "ParsePlan.hpp"
+#include "ResponseParser.hpp"
+#include "SimdKernel.hpp"
+#include "StringView.hpp"
+
+
+namespace MonetExplorer {
+    /**
+     * @brief An owned copy of the header of a &1 response: the status
+     * record and the column metadata, without the tuples. The parsed
+     * views point into the received message, which is reused by the
+     * connection, so the header has to be copied for decoding the
+     * later pages of the result.
+     */
+    class ResultHeader {
+        private:
+            /**
+             * @brief The owned copy of the metadata of a column.
+             */
+            struct ColumnHeader {
+                std::string tableName;
+                std::string name;
+                std::string type;
+                std::string typeSizes;
+            };
+
+            std::vector<ColumnHeader> strings;
+            ParsedResult header;                    // References 'strings'. No tuples.
+
+        public:
+            ResultHeader() { }
+
+            /**
+             * @brief Construct a new ResultHeader object
+             *
+             * @param table A parsed &1 response.
+             */
+            ResultHeader(const ParsedResult &table) {
+                this->Assign(table);
+            }
+
+            ResultHeader(const ResultHeader&) = delete;
+            ResultHeader &operator=(const ResultHeader&) = delete;
+
+            /**
+             * @brief Copy the header of a result.
+             *
+             * @param table A parsed &1 response.
+             */
+            void Assign(const ParsedResult &table) {
+                this->strings.resize(table.columns.size());
+                this->header.status = table.status;
+                this->header.status.line = StringView();
+                this->header.columns.resize(table.columns.size());
+                this->header.tuples = StringView();
+                this->header.tupleCount = 0;
+
+                for (size_t i = 0; i < table.columns.size(); i++) {
+                    const ColumnInfo &source = table.columns[i];
+                    ColumnHeader &copy = this->strings[i];
+                    ColumnInfo &info = this->header.columns[i];
+
+                    copy.tableName = source.tableName.ToString();
+                    copy.name = source.name.ToString();
+                    copy.type = source.type.ToString();
+                    copy.typeSizes = source.typeSizes.ToString();
+
+                    info.tableName = StringView(copy.tableName);
+                    info.name = StringView(copy.name);
+                    info.type = StringView(copy.type);
+                    info.length = source.length;
+                    info.typeSizes = StringView(copy.typeSizes);
+                }
+            }
+
+            /**
+             * @brief Get the header as a result without tuples.
+             *
+             * @return const ParsedResult&
+             */
+            const ParsedResult &Get() const {
+                return this->header;
+            }
+    };
+
+    /**
+     * @brief A result set, whose pages are still arriving: the &1
+     * response, then the &6 blocks of the Xexport commands. The header
+     * of the &1 is copied, and the decoder is bound to its columns once,
+     * so the pages are just appended.
+     */
+    class RegisteredResult {
+        friend class ResultRegistry;
+
+        private:
+            ResultHeader header;
+            ColumnarDecoder decoder;
+            ColumnarResult result;
+            size_t pageCount = 0;
+
+            /**
+             * @brief Decode a page.
+             *
+             * @param tuples
+             * @param columnCount From the status line.
+             * @param rowCount From the status line.
+             * @param offset The index of the first row of the page. Must
+             * equal the number of the rows received so far.
+             */
+            void AppendPage(StringView tuples, int64_t columnCount, int64_t rowCount, int64_t offset) {
+                if (columnCount != (int64_t)this->header.Get().columns.size()) {
+                    throw std::runtime_error("Page of result " + std::to_string(this->header.Get().status.resultId)
+                        + " has " + std::to_string(columnCount) + " columns instead of "
+                        + std::to_string(this->header.Get().columns.size()) + ".");
+                }
+
+                uint64_t before = this->result.GetRowCount() + this->decoder.GetRejectedRowCount();
+
+                // Duplicate or out of order pages would corrupt the result.
+                if (offset < 0 || (uint64_t)offset != before) {
+                    throw std::runtime_error("Page of result " + std::to_string(this->header.Get().status.resultId)
+                        + " starts at row " + std::to_string(offset) + " instead of " + std::to_string(before) + ".");
+                }
+                this->decoder.Append(tuples, this->result);
+                uint64_t received = this->result.GetRowCount() + this->decoder.GetRejectedRowCount() - before;
+
+                if (rowCount > -1 && received != (uint64_t)rowCount) {
+                    throw std::runtime_error("Page of result " + std::to_string(this->header.Get().status.resultId)
+                        + " has " + std::to_string(received) + " tuples instead of " + std::to_string(rowCount) + ".");
+                }
+
+                this->pageCount++;
+            }
+
+        public:
+            /**
+             * @brief Construct a new RegisteredResult object
+             *
+             * @param table A parsed &1 response.
+             * @param kernel The SIMD kernel of the decoder.
+             * @param maxDictionarySize See: ColumnarDecoder::SetMaxDictionarySize()
+             * @param plan Applied to all the pages.
+             */
+            RegisteredResult(const ParsedResult &table, SimdKernel kernel, size_t maxDictionarySize,
+                const ParsePlan &plan)
+                : header(table), decoder(kernel) {
+
+                this->decoder.SetMaxDictionarySize(maxDictionarySize);
+                this->decoder.Begin(this->header.Get(), this->result, plan);
+                this->AppendPage(table.tuples, table.status.columnCount, table.status.rowCount, 0);
+            }
+
+            RegisteredResult(const RegisteredResult&) = delete;
+            RegisteredResult &operator=(const RegisteredResult&) = delete;
+
+            int64_t GetResultId() const {
+                return this->header.Get().status.resultId;
+            }
+
+            /**
+             * @brief Get the header of the &1 response. (The tuples are empty.)
+             *
+             * @return const ParsedResult&
+             */
+            const ParsedResult &GetHeader() const {
+                return this->header.Get();
+            }
+
+            /**
+             * @brief Get the number of the rows dropped by the predicates of the plan.
+             *
+             * @return uint64_t
+             */
+            uint64_t GetRejectedRowCount() const {
+                return this->decoder.GetRejectedRowCount();
+            }
+
+            /**
+             * @brief Get the rows of all the pages received so far.
+             *
+             * @return const ColumnarResult&
+             */
+            const ColumnarResult &GetResult() const {
+                return this->result;
+            }
+
+            /**
+             * @brief Get the number of the pages: the &1 and the &6 blocks.
+             *
+             * @return size_t
+             */
+            size_t GetPageCount() const {
+                return this->pageCount;
+            }
+
+            /**
+             * @brief Returns true if all the rows of the result set are received.
+             *
+             * @return bool
+             */
+            bool IsComplete() const {
+                return this->header.Get().status.totalRowCount > -1 && this->result.GetRowCount()
+                    + this->decoder.GetRejectedRowCount() >= (uint64_t)this->header.Get().status.totalRowCount;
+            }
+    };
+
+    /**
+     * @brief The open result sets of a connection, by their result ID.
+     * The &1 responses register the results, and the &6 blocks are
+     * appended to the registered result of the same ID.
+     */
+    class ResultRegistry {
+        private:
+            std::unordered_map<int64_t, std::unique_ptr<RegisteredResult>> results;
+            SimdKernel kernel;
+            size_t maxDictionarySize = 0;
+            ParsePlan plan;
+
+        public:
+            /**
+             * @brief Construct a new ResultRegistry object
+             *
+             * @param kernel The SIMD kernel of the decoders.
+             */
+            ResultRegistry(SimdKernel kernel = GetBestKernel()) : kernel(kernel) { }
+
+            /**
+             * @brief Enable the dictionary encoding for the results registered from now on.
+             *
+             * @param maxSize See: ColumnarDecoder::SetMaxDictionarySize()
+             */
+            void SetMaxDictionarySize(size_t maxSize) {
+                this->maxDictionarySize = maxSize;
+            }
+
+            /**
+             * @brief Set the parse plan for the results registered from now on.
+             *
+             * @param plan
+             */
+            void SetParsePlan(const ParsePlan &plan) {
+                this->plan = plan;
+            }
+
+            /**
+             * @brief Register a result set, and decode its first page. An
+             * earlier result with the same ID is replaced.
+             *
+             * @param table A parsed &1 response.
+             * @return RegisteredResult&
+             * @throw runtime_error On invalid values or missing result ID.
+             */
+            RegisteredResult &Register(const ParsedResult &table) {
+                if (table.status.type != ResponseType::Table || table.status.resultId < 0) {
+                    throw std::runtime_error("ResultRegistry::Register(): Only &1 responses can be registered.");
+                }
+
+                this->results.erase(table.status.resultId);
+
+                std::unique_ptr<RegisteredResult> entry(new RegisteredResult(table, this->kernel,
+                    this->maxDictionarySize, this->plan));
+                RegisteredResult &registered = *entry;
+                this->results[table.status.resultId] = std::move(entry);
+
+                return registered;
+            }
+
+            /**
+             * @brief Append a &6 block to its result set.
+             *
+             * @param block A parsed &6 response.
+             * @return RegisteredResult&
+             * @throw runtime_error If the result is not registered, or the block is invalid
+             * or doesn't continue the received rows.
+             */
+            RegisteredResult &Append(const ParsedResult &block) {
+                if (block.status.type != ResponseType::Block) {
+                    throw std::runtime_error("ResultRegistry::Append(): Only &6 blocks can be appended.");
+                }
+
+                RegisteredResult *entry = this->Find(block.status.resultId);
+                if (entry == nullptr) {
+                    throw std::runtime_error("Block received for unknown result " + std::to_string(block.status.resultId)
+                        + ".");
+                }
+
+                entry->AppendPage(block.tuples, block.status.columnCount, block.status.rowCount,
+                    block.status.exportOffset);
+
+                return *entry;
+            }
+
+            /**
+             * @brief Register a &1 response or append a &6 block.
+             *
+             * @param result
+             * @return RegisteredResult* Null for the other response types.
+             */
+            RegisteredResult *Process(const ParsedResult &result) {
+                if (result.status.type == ResponseType::Table && result.status.resultId > -1) {
+                    return &this->Register(result);
+                } else if (result.status.type == ResponseType::Block) {
+                    return &this->Append(result);
+                }
+
+                return nullptr;
+            }
+
+            /**
+             * @brief Find a result set.
+             *
+             * @param resultId
+             * @return RegisteredResult* Null if not registered.
+             */
+            RegisteredResult *Find(int64_t resultId) {
+                auto it = this->results.find(resultId);
+                return it == this->results.end() ? nullptr : it->second.get();
+            }
+
+            /**
+             * @brief Forget a result set. (When it is closed on the server.)
+             *
+             * @param resultId
+             * @return bool False if it was not registered.
+             */
+            bool Remove(int64_t resultId) {
+                return this->results.erase(resultId) > 0;
+            }
+
+            size_t GetCount() const {
+                return this->results.size();
+            }
+    };
+}
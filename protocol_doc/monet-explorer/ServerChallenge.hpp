@@ -178,6 +178,7 @@ namespace MonetExplorer {
                             case 2: {
                                 std::string tmp(start, pos - start);
                                 char *endPtr;
+                                errno = 0;
                                 this->version = strtol(tmp.c_str(), &endPtr, 10);
                                 if (errno != 0 || *endPtr != '\0') {
                                     throw std::runtime_error("Invalid version value received "
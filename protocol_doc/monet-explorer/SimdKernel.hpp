@@ -0,0 +1,85 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+    #define MONET_EXPLORER_X86 1
+#endif
+
+
+namespace MonetExplorer {
+    /**
+     * @brief The instruction sets of the text processing kernels.
+     * The kernels are compiled for all of them, using the 'target'
+     * function attribute, and one is selected at runtime.
+     */
+    enum class SimdKernel : int {
+        Scalar = 1,     // One byte at a time
+        SSE2 = 2,       // 16 byte vectors
+        AVX2 = 3        // 32 byte vectors
+    };
+
+    /**
+     * @brief Returns true if the CPU supports the kernel.
+     *
+     * @param kernel
+     * @return bool
+     */
+    inline bool IsKernelSupported(SimdKernel kernel) {
+        switch (kernel) {
+            case SimdKernel::Scalar:
+                return true;
+#ifdef MONET_EXPLORER_X86
+            case SimdKernel::SSE2:
+                return __builtin_cpu_supports("sse2");
+            case SimdKernel::AVX2:
+                return __builtin_cpu_supports("avx2");
+#endif
+            default:
+                return false;
+        }
+    }
+
+    /**
+     * @brief Get the fastest kernel supported by the CPU.
+     *
+     * @return SimdKernel
+     */
+    inline SimdKernel GetBestKernel() {
+        if (IsKernelSupported(SimdKernel::AVX2)) {
+            return SimdKernel::AVX2;
+        } else if (IsKernelSupported(SimdKernel::SSE2)) {
+            return SimdKernel::SSE2;
+        }
+
+        return SimdKernel::Scalar;
+    }
+
+    /**
+     * @brief Get the name of a kernel.
+     *
+     * @param kernel
+     * @return const char*
+     */
+    inline const char *GetKernelName(SimdKernel kernel) {
+        switch (kernel) {
+            case SimdKernel::SSE2: return "sse2";
+            case SimdKernel::AVX2: return "avx2";
+            default: return "scalar";
+        }
+    }
+}
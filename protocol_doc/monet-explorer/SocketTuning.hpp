@@ -0,0 +1,342 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include "CommandLine.hpp"
+
+#ifndef SO_BUSY_POLL
+    #define SO_BUSY_POLL 46
+#endif
+
+
+namespace MonetExplorer {
+    /**
+     * @brief Predefined sets of socket options.
+     */
+    enum class TuningProfile : int {
+        Default = 1,    // Keep the system defaults
+        Latency = 2,    // Point queries: no batching of small packets, immediate ACKs, busy polling
+        Bulk = 3,       // Large exports: big socket buffers
+        Auto = 4        // Decided from the measured round-trip time and throughput
+    };
+
+    /**
+     * @brief The socket options of a connection. Applied before
+     * connecting, so that the buffer sizes can influence the
+     * TCP window scaling. The TCP specific options are skipped
+     * for Unix domain sockets.
+     */
+    struct SocketTuning {
+        TuningProfile profile = TuningProfile::Default;
+        bool noDelay = false;           // TCP_NODELAY
+        bool quickAck = false;          // TCP_QUICKACK, re-armed after each read
+        int receiveBuffer = 0;          // SO_RCVBUF in bytes. 0: system default (auto-tuned by the kernel)
+        int sendBuffer = 0;             // SO_SNDBUF in bytes. 0: system default
+        int busyPollUs = 0;             // SO_BUSY_POLL in microseconds. 0: disabled
+
+        // Measured by the auto profile
+        uint32_t rttUs = 0;
+        double throughput = 0;          // Bytes per second, of the fastest large response so far
+
+        /**
+         * @brief The smallest response used for measuring the throughput.
+         */
+        static const size_t MEASURE_MIN_BYTES = 1048576;
+        static const int AUTO_MIN_BUFFER = 262144;
+        static const int AUTO_MAX_BUFFER = 16777216;
+
+        /**
+         * @brief Parse the name of a profile.
+         *
+         * @param name default, latency, bulk or auto.
+         * @return TuningProfile
+         * @throw runtime_error If the name is invalid.
+         */
+        static TuningProfile ParseProfile(const std::string &name) {
+            if (name == "default") {
+                return TuningProfile::Default;
+            } else if (name == "latency") {
+                return TuningProfile::Latency;
+            } else if (name == "bulk") {
+                return TuningProfile::Bulk;
+            } else if (name == "auto") {
+                return TuningProfile::Auto;
+            }
+
+            throw std::runtime_error("Invalid socket profile: '" + name + "'. "
+                "The supported values are: default, latency, bulk, auto.");
+        }
+
+        /**
+         * @brief Get the name of a profile.
+         *
+         * @param profile
+         * @return const char*
+         */
+        static const char *GetProfileName(TuningProfile profile) {
+            switch (profile) {
+                case TuningProfile::Latency: return "latency";
+                case TuningProfile::Bulk: return "bulk";
+                case TuningProfile::Auto: return "auto";
+                default: return "default";
+            }
+        }
+
+        /**
+         * @brief Create the options of a profile.
+         *
+         * @param profile
+         * @return SocketTuning
+         */
+        static SocketTuning FromProfile(TuningProfile profile) {
+            SocketTuning tuning;
+            tuning.profile = profile;
+
+            if (profile == TuningProfile::Latency) {
+                tuning.noDelay = true;
+                tuning.quickAck = true;
+                tuning.busyPollUs = 50;
+            } else if (profile == TuningProfile::Bulk) {
+                tuning.noDelay = true;
+                tuning.receiveBuffer = 4194304;
+                tuning.sendBuffer = 262144;
+            } else if (profile == TuningProfile::Auto) {
+                tuning.noDelay = true;
+            }
+
+            return tuning;
+        }
+
+        /**
+         * @brief Create the options from the command line arguments.
+         * The individual options override those of the profile.
+         *
+         * @param args Command line arguments.
+         * @return SocketTuning
+         */
+        static SocketTuning FromArguments(CommandLine::Arguments &args) {
+            SocketTuning tuning = FromProfile(ParseProfile(args.GetStringValue("socket-profile")));
+
+            int receiveBuffer = args.GetIntValue("receive-buffer");
+            int sendBuffer = args.GetIntValue("send-buffer");
+            int busyPollUs = args.GetIntValue("busy-poll");
+
+            if (receiveBuffer < 0 || sendBuffer < 0 || busyPollUs < 0) {
+                throw std::runtime_error("The socket buffer sizes and the busy poll time cannot be negative.");
+            }
+
+            if (args.IsOptionSet("no-delay")) {
+                tuning.noDelay = true;
+            }
+
+            if (args.IsOptionSet("quick-ack")) {
+                tuning.quickAck = true;
+            }
+
+            if (receiveBuffer > 0) {
+                tuning.receiveBuffer = receiveBuffer;
+            }
+
+            if (sendBuffer > 0) {
+                tuning.sendBuffer = sendBuffer;
+            }
+
+            if (busyPollUs > 0) {
+                tuning.busyPollUs = busyPollUs;
+            }
+
+            return tuning;
+        }
+
+        /**
+         * @brief Set a socket option, or throw an exception.
+         *
+         * @param fd
+         * @param level
+         * @param name
+         * @param value
+         * @param description For the error message.
+         */
+        static void SetOption(int fd, int level, int name, int value, const char *description) {
+            if (setsockopt(fd, level, name, &value, sizeof(value)) != 0) {
+                throw std::runtime_error("Failed to set the socket option " + std::string(description)
+                    + ". Error: '" + std::string(strerror(errno)) + "' (" + std::to_string(errno) + ")");
+            }
+        }
+
+        /**
+         * @brief Apply the options to a new socket, before connecting it.
+         *
+         * @param fd The socket.
+         * @param tcp False for Unix domain sockets.
+         */
+        void Apply(int fd, bool tcp) const {
+            if (this->receiveBuffer > 0) {
+                SetOption(fd, SOL_SOCKET, SO_RCVBUF, this->receiveBuffer, "SO_RCVBUF");
+            }
+
+            if (this->sendBuffer > 0) {
+                SetOption(fd, SOL_SOCKET, SO_SNDBUF, this->sendBuffer, "SO_SNDBUF");
+            }
+
+            if (!tcp) {
+                return;
+            }
+
+            if (this->busyPollUs > 0) {
+                // Raising it above net.core.busy_read requires CAP_NET_ADMIN.
+                SetOption(fd, SOL_SOCKET, SO_BUSY_POLL, this->busyPollUs, "SO_BUSY_POLL");
+            }
+
+            if (this->noDelay) {
+                SetOption(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+            }
+
+            this->ApplyQuickAck(fd);
+        }
+
+        /**
+         * @brief The kernel turns the quick ACK mode off by itself,
+         * so it has to be set again after the reads.
+         *
+         * @param fd A TCP socket.
+         */
+        void ApplyQuickAck(int fd) const {
+            if (this->quickAck) {
+                int value = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &value, sizeof(value));
+            }
+        }
+
+        /**
+         * @brief Called after the TCP connection is established. The
+         * auto profile takes the round-trip time from the kernel,
+         * which measured it during the TCP handshake. On a local
+         * network the quick ACKs are enabled, because there the
+         * delayed ACKs are long compared to the round trips.
+         *
+         * @param fd A connected TCP socket.
+         */
+        void OnConnected(int fd) {
+            if (this->profile != TuningProfile::Auto) {
+                return;
+            }
+
+            struct tcp_info info;
+            socklen_t length = sizeof(info);
+            std::memset(&info, 0, sizeof(info));
+
+            if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &length) == 0) {
+                this->rttUs = info.tcpi_rtt;
+            }
+
+            if (this->rttUs > 0 && this->rttUs < 1000) {
+                this->quickAck = true;
+                this->ApplyQuickAck(fd);
+            }
+        }
+
+        /**
+         * @brief Called after a response was received. The auto profile
+         * measures the throughput of the large responses, and raises the
+         * receive buffer to twice the bandwidth-delay product, if the
+         * current one is smaller. (Setting SO_RCVBUF disables the kernel's
+         * own receive buffer tuning, so it is never done to shrink it.)
+         *
+         * @param fd A connected TCP socket.
+         * @param bytes The size of the response.
+         * @param seconds The time between its first and last packets.
+         */
+        void OnTransfer(int fd, size_t bytes, double seconds) {
+            if (this->profile != TuningProfile::Auto || bytes < MEASURE_MIN_BYTES || seconds <= 0) {
+                return;
+            }
+
+            this->throughput = std::max(this->throughput, bytes / seconds);
+            if (this->rttUs == 0) {
+                return;
+            }
+
+            double bandwidthDelay = this->throughput * this->rttUs / 1000000.0;
+            int target = AUTO_MIN_BUFFER;
+
+            while (target < 2 * bandwidthDelay && target < AUTO_MAX_BUFFER) {
+                target *= 2;
+            }
+
+            int current = 0;
+            socklen_t length = sizeof(current);
+            getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &current, &length);
+
+            // The kernel reports the double of the set value.
+            if (target > current / 2 && target > this->receiveBuffer) {
+                SetOption(fd, SOL_SOCKET, SO_RCVBUF, target, "SO_RCVBUF");
+                this->receiveBuffer = target;
+            }
+        }
+
+        /**
+         * @brief Describe the chosen options and the effective
+         * buffer sizes of a socket.
+         *
+         * @param fd The socket, or -1.
+         * @return std::string
+         */
+        std::string Describe(int fd) const {
+            std::stringstream text;
+
+            text << "profile " << GetProfileName(this->profile);
+
+            if (this->profile == TuningProfile::Auto) {
+                text << " (rtt " << this->rttUs << " us, throughput ";
+
+                if (this->throughput > 0) {
+                    text << (uint64_t)(this->throughput / 1048576) << " MiB/s)";
+                } else {
+                    text << "not measured yet)";
+                }
+            }
+
+            text << ", nodelay " << (this->noDelay ? "on" : "off")
+                << ", quickack " << (this->quickAck ? "on" : "off")
+                << ", busy poll " << this->busyPollUs << " us";
+
+            if (fd > -1) {
+                int receive = 0;
+                int send = 0;
+                socklen_t length = sizeof(int);
+
+                getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receive, &length);
+                length = sizeof(int);
+                getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &send, &length);
+
+                text << ", rcvbuf " << receive << " bytes, sndbuf " << send << " bytes";
+            }
+
+            return text.str();
+        }
+    };
+}
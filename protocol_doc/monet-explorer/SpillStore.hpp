@@ -0,0 +1,683 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+#include "ColumnarResult.hpp"
+#include "StringView.hpp"
+
+
+namespace MonetExplorer {
+    /**
+     * @brief The limits of a spill store.
+     */
+    struct SpillSettings {
+        size_t memoryBudget = 268435456;    // The segments are kept in memory until they use this much
+        std::string directory;              // Of the temporary file. Empty: $TMPDIR or /tmp.
+    };
+
+    /**
+     * @brief Counters of a spill store.
+     */
+    struct SpillStats {
+        uint64_t segmentsInMemory = 0;
+        uint64_t segmentsSpilled = 0;
+        uint64_t bytesWritten = 0;
+        uint64_t writeCalls = 0;
+        uint64_t segmentsMapped = 0;
+    };
+
+    /**
+     * @brief A read-only column of a segment, which is either in memory
+     * or mapped from the file of a spill store. The same accessors as
+     * of Column.
+     */
+    class ColumnView {
+        friend class SpillStore;
+
+        private:
+            const std::string *name = nullptr;
+            ColumnType type = ColumnType::String;
+            int scale = -1;
+            size_t rowCount = 0;
+            size_t nullCount = 0;
+            const uint64_t *validity = nullptr;
+            const char *values = nullptr;
+            const uint32_t *codes = nullptr;    // Dictionary encoded strings only
+            const size_t *offsets = nullptr;
+            size_t offsetCount = 0;
+            const char *bytes = nullptr;
+            size_t byteCount = 0;
+            bool dictionary = false;
+
+        public:
+            const std::string &GetName() const {
+                return *this->name;
+            }
+
+            ColumnType GetType() const {
+                return this->type;
+            }
+
+            int GetScale() const {
+                return this->scale;
+            }
+
+            size_t GetRowCount() const {
+                return this->rowCount;
+            }
+
+            size_t GetNullCount() const {
+                return this->nullCount;
+            }
+
+            /**
+             * @brief Get the values of a fixed-width column.
+             *
+             * @tparam T Must have the size of the storage type.
+             * @return Span<T>
+             * @throw runtime_error If the type doesn't match.
+             */
+            template<typename T>
+            Span<T> GetValues() const {
+                if (this->type == ColumnType::String || sizeof(T) != GetColumnTypeSize(this->type)) {
+                    throw std::runtime_error("Column '" + *this->name + "' stores "
+                        + GetColumnTypeName(this->type) + " values, which don't match the requested type.");
+                }
+
+                return Span<T>((const T*)this->values, this->rowCount);
+            }
+
+            bool IsDictionaryEncoded() const {
+                return this->dictionary;
+            }
+
+            /**
+             * @brief See: Column::GetCodes()
+             *
+             * @return Span<uint32_t>
+             */
+            Span<uint32_t> GetCodes() const {
+                return Span<uint32_t>(this->codes, this->dictionary ? this->rowCount : 0);
+            }
+
+            /**
+             * @brief See: Column::GetOffsets()
+             *
+             * @return Span<size_t>
+             */
+            Span<size_t> GetOffsets() const {
+                return Span<size_t>(this->offsets, this->offsetCount);
+            }
+
+            Span<char> GetBytes() const {
+                return Span<char>(this->bytes, this->byteCount);
+            }
+
+            Span<uint64_t> GetValidity() const {
+                return Span<uint64_t>(this->validity, (this->rowCount + 63) / 64);
+            }
+
+            bool IsNull(size_t row) const {
+                return ((this->validity[row >> 6] >> (row & 63)) & 1) == 0;
+            }
+
+            /**
+             * @brief Get a value of a string column.
+             *
+             * @param row
+             * @return StringView
+             */
+            StringView GetString(size_t row) const {
+                if (this->type != ColumnType::String) {
+                    throw std::runtime_error("Column '" + *this->name + "' is not a string column.");
+                }
+
+                size_t index = this->dictionary ? this->codes[row] : row;
+
+                return StringView(this->bytes + this->offsets[index], this->offsets[index + 1] - this->offsets[index]);
+            }
+    };
+
+    /**
+     * @brief A segment of a spill store. The mapping of a spilled segment
+     * is released when the view is reused or destroyed, so iterating with
+     * a single view keeps only one segment mapped.
+     */
+    class SegmentView {
+        friend class SpillStore;
+
+        private:
+            std::vector<ColumnView> columns;
+            size_t rowCount = 0;
+            void *mapping = nullptr;
+            size_t mappingLength = 0;
+
+            void Unmap() {
+                if (this->mapping != nullptr) {
+                    munmap(this->mapping, this->mappingLength);
+                    this->mapping = nullptr;
+                    this->mappingLength = 0;
+                }
+            }
+
+        public:
+            SegmentView() { }
+            SegmentView(const SegmentView&) = delete;
+            SegmentView &operator=(const SegmentView&) = delete;
+
+            ~SegmentView() {
+                this->Unmap();
+            }
+
+            size_t GetColumnCount() const {
+                return this->columns.size();
+            }
+
+            size_t GetRowCount() const {
+                return this->rowCount;
+            }
+
+            const ColumnView &GetColumn(size_t index) const {
+                return this->columns.at(index);
+            }
+
+            /**
+             * @brief Returns true if the segment is mapped from the file.
+             *
+             * @return bool
+             */
+            bool IsMapped() const {
+                return this->mapping != nullptr;
+            }
+    };
+
+    /**
+     * @brief Stores a large result as a sequence of decoded segments
+     * (for example the pages of a cursor), without requiring memory for
+     * all of them. The first segments are kept in memory, until they
+     * use more than the budget. After that, each segment is appended to
+     * a temporary file and released. The file is unlinked right after
+     * its creation, so it is removed even if the process crashes.
+     *
+     * The layout of a spilled segment is columnar: a header for each
+     * column (type, scale, NULL count, and the positions of its arrays),
+     * then the arrays of the columns one after the other: validity bitmap,
+     * values, dictionary codes, string offsets and string bytes, each
+     * aligned to 16 bytes. The arrays are written in their in-memory
+     * format, because the file is only read by the same process.
+     * Only the position and the row count of the segments are kept in
+     * memory.
+     *
+     * The segments are read back by mapping them into memory, so the
+     * consumers get the same spans as from a Column, and the resident
+     * memory is bounded by the budget and the segment being read.
+     */
+    class SpillStore {
+        private:
+            /**
+             * @brief The header of a column in a spilled segment.
+             * The positions are relative to the start of the segment.
+             */
+            struct SpilledColumn {
+                int32_t type;
+                int32_t scale;
+                uint64_t rowCount;
+                uint64_t nullCount;
+                int64_t dictionarySize;         // -1: not dictionary encoded
+                uint64_t validity;
+                uint64_t values;
+                uint64_t codes;
+                uint64_t offsets;
+                uint64_t offsetCount;
+                uint64_t bytes;
+                uint64_t byteCount;
+            };
+
+            /**
+             * @brief The position of a segment in the file.
+             */
+            struct SpilledSegment {
+                uint64_t position;
+                uint64_t length;
+                size_t rowCount;
+            };
+
+            static const size_t ALIGNMENT = 16;
+
+            SpillSettings settings;
+            std::vector<std::string> names;
+            std::vector<std::unique_ptr<ColumnarResult>> memory;    // The first segments
+            std::vector<SpilledSegment> spilled;                    // The ones after them
+            size_t memoryUsage = 0;
+            uint64_t rowCount = 0;
+            int file = -1;
+            uint64_t fileSize = 0;
+            std::vector<SpilledColumn> headers;
+            std::vector<struct iovec> vectors;
+            SpillStats stats;
+
+            static uint64_t Align(uint64_t position) {
+                return (position + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+            }
+
+            /**
+             * @brief Get the values of a column as raw bytes.
+             *
+             * @param column
+             * @return const char* Null for strings.
+             */
+            static const char *GetValueData(const Column &column) {
+                switch (GetColumnTypeSize(column.GetType())) {
+                    case 1: return (const char*)column.GetValues<int8_t>().data;
+                    case 2: return (const char*)column.GetValues<int16_t>().data;
+                    case 4: return (const char*)column.GetValues<int32_t>().data;
+                    case 8: return (const char*)column.GetValues<int64_t>().data;
+                    case 16: return (const char*)column.GetValues<HugeInt>().data;
+                    default: return nullptr;
+                }
+            }
+
+            /**
+             * @brief Create the temporary file.
+             */
+            void CreateFile() {
+                std::string directory = this->settings.directory;
+
+                if (directory.empty()) {
+                    const char *temp = getenv("TMPDIR");
+                    directory = temp != nullptr && *temp != '\0' ? temp : "/tmp";
+                }
+
+                std::string path = directory + "/monet-explorer-spill-XXXXXX";
+                std::vector<char> name(path.begin(), path.end());
+                name.push_back('\0');
+
+                this->file = mkstemp(name.data());
+                if (this->file < 0) {
+                    throw std::runtime_error("Failed to create the spill file in '" + directory + "'. Error: '"
+                        + std::string(strerror(errno)) + "' (" + std::to_string(errno) + ")");
+                }
+
+                unlink(name.data());
+            }
+
+            /**
+             * @brief Add an array to the pending writes, followed by
+             * the padding to the alignment.
+             *
+             * @param data
+             * @param length
+             * @param position The position of the array in the segment.
+             * Advanced after the padding.
+             */
+            void AddArray(const void *data, size_t length, uint64_t &position) {
+                static const char padding[ALIGNMENT] = { 0 };
+
+                if (length > 0) {
+                    this->vectors.push_back({ (void*)data, length });
+                }
+
+                uint64_t end = Align(position + length);
+                if (end > position + length) {
+                    this->vectors.push_back({ (void*)padding, (size_t)(end - position - length) });
+                }
+
+                position = end;
+            }
+
+            /**
+             * @brief Write all the pending vectors to the end of the file. The
+             * position is explicit, so after a failed (or partial) write the
+             * next segment overwrites the incomplete one.
+             */
+            void WriteVectors() {
+                size_t index = 0;
+                uint64_t offset = this->fileSize;
+
+                while (index < this->vectors.size()) {
+                    int count = (int)std::min(this->vectors.size() - index, (size_t)IOV_MAX);
+                    ssize_t written = pwritev(this->file, &this->vectors[index], count, (off_t)offset);
+                    this->stats.writeCalls++;
+
+                    if (written < 0) {
+                        if (errno == EINTR) {
+                            continue;
+                        }
+
+                        throw std::runtime_error("Failed to write the spill file. Error: '"
+                            + std::string(strerror(errno)) + "' (" + std::to_string(errno) + ")");
+                    }
+
+                    this->stats.bytesWritten += written;
+                    offset += written;
+
+                    while (index < this->vectors.size() && (size_t)written >= this->vectors[index].iov_len) {
+                        written -= this->vectors[index].iov_len;
+                        index++;
+                    }
+
+                    if (written > 0) {
+                        this->vectors[index].iov_base = (char*)this->vectors[index].iov_base + written;
+                        this->vectors[index].iov_len -= written;
+                    }
+                }
+
+                this->vectors.clear();
+            }
+
+            /**
+             * @brief Append a segment to the file.
+             *
+             * @param segment
+             */
+            void Spill(const ColumnarResult &segment) {
+                if (this->file < 0) {
+                    this->CreateFile();
+                }
+
+                size_t columnCount = segment.GetColumnCount();
+                uint64_t position = Align(columnCount * sizeof(SpilledColumn));
+
+                this->headers.resize(columnCount);
+                this->vectors.clear();
+                this->vectors.push_back({ this->headers.data(), columnCount * sizeof(SpilledColumn) });
+
+                if (position > columnCount * sizeof(SpilledColumn)) {
+                    static const char padding[ALIGNMENT] = { 0 };
+                    this->vectors.push_back({ (void*)padding, (size_t)(position - columnCount * sizeof(SpilledColumn)) });
+                }
+
+                for (size_t i = 0; i < columnCount; i++) {
+                    const Column &column = segment.GetColumn(i);
+                    SpilledColumn &header = this->headers[i];
+                    Span<uint64_t> validity = column.GetValidity();
+                    Span<uint32_t> codes = column.GetCodes();
+                    Span<size_t> offsets = column.GetOffsets();
+                    Span<char> bytes = column.GetBytes();
+
+                    header.type = (int32_t)column.GetType();
+                    header.scale = column.GetScale();
+                    header.rowCount = column.GetRowCount();
+                    header.nullCount = column.GetNullCount();
+                    header.dictionarySize = column.IsDictionaryEncoded() ? (int64_t)column.GetDictionarySize() : -1;
+
+                    header.validity = position;
+                    this->AddArray(validity.data, validity.size * sizeof(uint64_t), position);
+
+                    header.values = position;
+                    this->AddArray(GetValueData(column), column.GetRowCount() * GetColumnTypeSize(column.GetType()),
+                        position);
+
+                    header.codes = position;
+                    this->AddArray(codes.data, codes.size * sizeof(uint32_t), position);
+
+                    header.offsets = position;
+                    header.offsetCount = offsets.size;
+                    this->AddArray(offsets.data, offsets.size * sizeof(size_t), position);
+
+                    header.bytes = position;
+                    header.byteCount = bytes.size;
+                    this->AddArray(bytes.data, bytes.size, position);
+                }
+
+                this->WriteVectors();
+
+                SpilledSegment entry;
+                entry.position = this->fileSize;
+                entry.length = position;
+                entry.rowCount = segment.GetRowCount();
+
+                this->spilled.push_back(entry);
+                this->fileSize += position;
+                this->stats.segmentsSpilled++;
+            }
+
+            /**
+             * @brief Set up the view of a segment in memory.
+             *
+             * @param segment
+             * @param view
+             */
+            void ViewMemory(const ColumnarResult &segment, SegmentView &view) const {
+                for (size_t i = 0; i < segment.GetColumnCount(); i++) {
+                    const Column &column = segment.GetColumn(i);
+                    ColumnView &target = view.columns[i];
+
+                    target.type = column.GetType();
+                    target.scale = column.GetScale();
+                    target.rowCount = column.GetRowCount();
+                    target.nullCount = column.GetNullCount();
+                    target.validity = column.GetValidity().data;
+                    target.values = GetValueData(column);
+                    target.codes = column.GetCodes().data;
+                    target.offsets = column.GetOffsets().data;
+                    target.offsetCount = column.GetOffsets().size;
+                    target.bytes = column.GetBytes().data;
+                    target.byteCount = column.GetBytes().size;
+                    target.dictionary = column.IsDictionaryEncoded();
+                }
+
+                view.rowCount = segment.GetRowCount();
+            }
+
+            /**
+             * @brief Map a spilled segment, and set up its view.
+             *
+             * @param segment
+             * @param view
+             */
+            void ViewFile(const SpilledSegment &segment, SegmentView &view) {
+                uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+                uint64_t start = segment.position / page * page;
+                size_t length = (size_t)(segment.position + segment.length - start);
+
+                void *address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, this->file, (off_t)start);
+                if (address == MAP_FAILED) {
+                    throw std::runtime_error("Failed to map the spill file. Error: '"
+                        + std::string(strerror(errno)) + "' (" + std::to_string(errno) + ")");
+                }
+
+                madvise(address, length, MADV_SEQUENTIAL);
+                view.mapping = address;
+                view.mappingLength = length;
+                this->stats.segmentsMapped++;
+
+                const char *base = (const char*)address + (segment.position - start);
+                const SpilledColumn *headers = (const SpilledColumn*)base;
+
+                for (size_t i = 0; i < view.columns.size(); i++) {
+                    const SpilledColumn &header = headers[i];
+                    ColumnView &target = view.columns[i];
+
+                    target.type = (ColumnType)header.type;
+                    target.scale = header.scale;
+                    target.rowCount = header.rowCount;
+                    target.nullCount = header.nullCount;
+                    target.validity = (const uint64_t*)(base + header.validity);
+                    target.values = base + header.values;
+                    target.codes = (const uint32_t*)(base + header.codes);
+                    target.offsets = (const size_t*)(base + header.offsets);
+                    target.offsetCount = header.offsetCount;
+                    target.bytes = base + header.bytes;
+                    target.byteCount = header.byteCount;
+                    target.dictionary = header.dictionarySize > -1;
+                }
+
+                view.rowCount = segment.rowCount;
+            }
+
+        public:
+            /**
+             * @brief Construct a new SpillStore object
+             *
+             * @param settings
+             */
+            SpillStore(const SpillSettings &settings = SpillSettings()) : settings(settings) { }
+
+            SpillStore(const SpillStore&) = delete;
+            SpillStore &operator=(const SpillStore&) = delete;
+
+            /**
+             * @brief Destroy the SpillStore object. (Also deletes the file.)
+             */
+            ~SpillStore() {
+                if (this->file >= 0) {
+                    close(this->file);
+                }
+            }
+
+            /**
+             * @brief Remove all the segments. The file is truncated and reused.
+             */
+            void Clear() {
+                this->names.clear();
+                this->memory.clear();
+                this->spilled.clear();
+                this->memoryUsage = 0;
+                this->rowCount = 0;
+                this->stats = SpillStats();
+
+                if (this->file >= 0) {
+                    if (ftruncate(this->file, 0) != 0) {
+                        close(this->file);
+                        this->file = -1;
+                    }
+                }
+
+                this->fileSize = 0;
+            }
+
+            /**
+             * @brief Append a segment. The segments must have the same columns.
+             *
+             * @param segment Copied if it fits into the memory budget,
+             * written to the file otherwise. (So the decoder can reuse it.)
+             * @throw runtime_error If the columns don't match, or the file
+             * cannot be written.
+             */
+            void Append(const ColumnarResult &segment) {
+                if (this->GetSegmentCount() == 0) {
+                    this->names.clear();
+
+                    for (size_t i = 0; i < segment.GetColumnCount(); i++) {
+                        this->names.push_back(segment.GetColumn(i).GetName());
+                    }
+                } else if (segment.GetColumnCount() != this->names.size()) {
+                    throw std::runtime_error("SpillStore::Append(): The segment has " + std::to_string(
+                        segment.GetColumnCount()) + " columns instead of " + std::to_string(this->names.size()) + ".");
+                }
+
+                size_t usage = segment.GetMemoryUsage();
+
+                if (this->spilled.empty() && this->memoryUsage + usage <= this->settings.memoryBudget) {
+                    this->memory.emplace_back(new ColumnarResult(segment));
+                    this->memoryUsage += this->memory.back()->GetMemoryUsage();
+                    this->stats.segmentsInMemory++;
+                } else {
+                    this->Spill(segment);
+                }
+
+                this->rowCount += segment.GetRowCount();
+            }
+
+            /**
+             * @brief Get a segment. The in-memory segments are referenced,
+             * the spilled ones are mapped from the file. The previous
+             * mapping of the view is released.
+             *
+             * @param index
+             * @param view Output. Valid until the next Read() into it,
+             * or until the store is cleared or destroyed.
+             * @throw runtime_error If the index is invalid, or the file
+             * cannot be mapped.
+             */
+            void Read(size_t index, SegmentView &view) {
+                if (index >= this->GetSegmentCount()) {
+                    throw std::runtime_error("SpillStore::Read(): Invalid segment index: " + std::to_string(index));
+                }
+
+                view.Unmap();
+                view.columns.resize(this->names.size());
+
+                for (size_t i = 0; i < this->names.size(); i++) {
+                    view.columns[i].name = &this->names[i];
+                }
+
+                if (index < this->memory.size()) {
+                    this->ViewMemory(*this->memory[index], view);
+                } else {
+                    this->ViewFile(this->spilled[index - this->memory.size()], view);
+                }
+            }
+
+            size_t GetSegmentCount() const {
+                return this->memory.size() + this->spilled.size();
+            }
+
+            /**
+             * @brief Get the number of the segments in the file.
+             *
+             * @return size_t
+             */
+            size_t GetSpilledSegmentCount() const {
+                return this->spilled.size();
+            }
+
+            uint64_t GetRowCount() const {
+                return this->rowCount;
+            }
+
+            size_t GetColumnCount() const {
+                return this->names.size();
+            }
+
+            /**
+             * @brief Get the memory used by the segments kept in memory.
+             *
+             * @return size_t
+             */
+            size_t GetMemoryUsage() const {
+                return this->memoryUsage;
+            }
+
+            /**
+             * @brief Get the size of the spilled data.
+             *
+             * @return uint64_t
+             */
+            uint64_t GetFileSize() const {
+                return this->fileSize;
+            }
+
+            const SpillStats &GetStats() const {
+                return this->stats;
+            }
+    };
+}
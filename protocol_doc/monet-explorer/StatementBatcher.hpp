@@ -0,0 +1,307 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Connection.hpp"
+#include "StringView.hpp"
+
+
+namespace MonetExplorer {
+    /**
+     * @brief The outcome of a single statement inside a batch.
+     */
+    enum class StatementStatus : int {
+        Success = 1,
+        Failed = 2,         // The response is the error message
+        NotExecuted = 3     // A previous statement of the batch failed
+    };
+
+    /**
+     * @brief The part of a multi-statement response
+     * that belongs to a single statement.
+     */
+    struct StatementResult {
+        StatementStatus status = StatementStatus::NotExecuted;
+        StringView response;    // Lines of the result, including the last '\n'
+    };
+
+    /**
+     * @brief The limits of coalescing the statements.
+     */
+    struct BatchSettings {
+        size_t maxMessageBytes = 65536;     // Flush before the message would grow larger
+        size_t maxStatements = 64;
+        int maxDelayMs = 5;                 // Flush if the oldest statement waits longer
+    };
+
+    /**
+     * @brief Counters of the batching.
+     */
+    struct BatchStats {
+        uint64_t statements = 0;
+        uint64_t messages = 0;      // Round trips
+        uint64_t failedBatches = 0;
+    };
+
+    /**
+     * @brief Coalesces independent SQL statements into multi-statement
+     * messages (see: protocol_doc 6.4), so that many statements cost
+     * a single round trip. The concatenated response is split back
+     * into per-statement results.
+     * Each submitted text must contain exactly one statement, because
+     * the results are matched to the statements by their order.
+     */
+    class StatementBatcher {
+        public:
+            /**
+             * @brief Receives the result of a statement. The response view
+             * is only valid until the callback returns.
+             */
+            typedef std::function<void(const StatementResult &result)> ResultCallback;
+
+        private:
+            Connection &connection;
+            BatchSettings settings;
+            std::string message = "s";
+            std::string sending;        // The message of the batch in flight
+            std::string failure;        // The error response of a batch which was not completed
+            std::vector<ResultCallback> callbacks;
+            std::vector<StatementResult> results;
+            std::chrono::steady_clock::time_point oldest;
+            BatchStats stats;
+
+            /**
+             * @brief Remove the trailing white-spaces and semi-colons.
+             *
+             * @param statement
+             * @return StringView
+             */
+            static StringView TrimStatement(StringView statement) {
+                while (statement.length > 0 && (statement.data[statement.length - 1] == ';'
+                    || isspace((unsigned char)statement.data[statement.length - 1]))) {
+
+                    statement.length--;
+                }
+
+                return statement;
+            }
+
+        public:
+            /**
+             * @brief Construct a new StatementBatcher object
+             *
+             * @param connection An authenticated connection. It must not
+             * be used by others while statements are queued.
+             * @param settings
+             */
+            StatementBatcher(Connection &connection, const BatchSettings &settings = BatchSettings())
+                : connection(connection), settings(settings) { }
+
+            /**
+             * @brief Queue a statement. Sends the batch if a limit is reached.
+             *
+             * @param statement A single SQL statement, without the 's' prefix.
+             * @param callback Called with the result when the batch is completed.
+             */
+            void Submit(StringView statement, ResultCallback callback) {
+                statement = TrimStatement(statement);
+                if (statement.IsEmpty()) {
+                    throw std::runtime_error("StatementBatcher::Submit(): Empty statement.");
+                }
+
+                if (!this->callbacks.empty()
+                    && this->message.length() + statement.length + 2 > this->settings.maxMessageBytes) {
+
+                    this->Flush();
+                }
+
+                if (this->callbacks.empty()) {
+                    this->oldest = std::chrono::steady_clock::now();
+                }
+
+                this->message.append(statement.data, statement.length);
+                this->message.append(";\n", 2);
+                this->callbacks.push_back(std::move(callback));
+                this->stats.statements++;
+
+                if (this->callbacks.size() >= this->settings.maxStatements) {
+                    this->Flush();
+                } else {
+                    this->Poll();
+                }
+            }
+
+            /**
+             * @brief Send the batch if the oldest queued statement
+             * reached the latency limit.
+             *
+             * @return bool True if a batch was sent.
+             */
+            bool Poll() {
+                if (this->callbacks.empty()) {
+                    return false;
+                }
+
+                if (std::chrono::steady_clock::now() - this->oldest
+                    < std::chrono::milliseconds(this->settings.maxDelayMs)) {
+
+                    return false;
+                }
+
+                this->Flush();
+                return true;
+            }
+
+            /**
+             * @brief Send the queued statements in a single message,
+             * and dispatch the results to the callbacks.
+             *
+             * @throw runtime_error If the batch could not be sent or its
+             * response received. The callbacks are called before, with a
+             * failed result, whose response is the error message.
+             */
+            void Flush() {
+                if (this->callbacks.empty()) {
+                    return;
+                }
+
+                std::vector<ResultCallback> pending;
+                pending.swap(this->callbacks);
+                this->sending.swap(this->message);
+                this->message.assign(1, 's');
+
+                StringView response;
+
+                try {
+                    this->connection.SendMessage(this->sending);
+                    this->stats.messages++;
+
+                    response = this->connection.ReceiveMessageView();
+                    if (!this->connection.IsConnected()) {
+                        throw std::runtime_error("The server closed the connection during the batch.");
+                    }
+                } catch (const std::exception &err) {
+                    // Tell the waiting callers, then let the exception through.
+                    this->stats.failedBatches++;
+                    this->failure = "!" + std::string(err.what()) + "\n";
+
+                    StatementResult result;
+                    result.status = StatementStatus::Failed;
+                    result.response = StringView(this->failure);
+
+                    for (size_t i = 0; i < pending.size(); i++) {
+                        pending[i](result);
+                    }
+
+                    throw;
+                }
+
+                if (SplitResponse(response, pending.size(), this->results)) {
+                    this->stats.failedBatches++;
+                }
+
+                for (size_t i = 0; i < pending.size(); i++) {
+                    pending[i](this->results[i]);
+                }
+            }
+
+            /**
+             * @brief Returns the number of queued statements.
+             *
+             * @return size_t
+             */
+            size_t GetPendingCount() const {
+                return this->callbacks.size();
+            }
+
+            /**
+             * @brief Get the counters of the batching.
+             *
+             * @return const BatchStats&
+             */
+            const BatchStats &GetStats() const {
+                return this->stats;
+            }
+
+            /**
+             * @brief Split the response of a multi-statement message into
+             * the results of the individual statements. Every result starts
+             * with a '&' line, and continues with the header ('%') and tuple
+             * ('[') lines. An error ('!' lines) ends the processing of the
+             * message on the server, so the statements after it get no result.
+             *
+             * @param response The concatenated response.
+             * @param count The number of statements in the message.
+             * @param results Output: exactly 'count' items.
+             * @return bool True if a statement failed.
+             */
+            static bool SplitResponse(StringView response, size_t count, std::vector<StatementResult> &results) {
+                results.assign(count, StatementResult());
+
+                const char *position = response.data;
+                const char *end = response.data + response.length;
+                size_t index = 0;
+                bool failed = false;
+
+                while (position < end && index < count) {
+                    StatementResult &result = results[index];
+                    const char *start = position;
+                    bool isError = *position == '!';
+
+                    /*
+                        Consume the first line, then the lines
+                        which belong to the same result.
+                    */
+                    do {
+                        const char *newLine = (const char*)memchr(position, '\n', end - position);
+                        position = newLine == nullptr ? end : newLine + 1;
+                    } while (position < end && (isError ? *position == '!' : (*position != '&' && *position != '!')));
+
+                    result.response = StringView(start, position - start);
+                    index++;
+
+                    if (isError) {
+                        result.status = StatementStatus::Failed;
+                        failed = true;
+                        break;
+                    }
+
+                    result.status = StatementStatus::Success;
+                }
+
+                if (!failed && index < count) {
+                    // The server returned fewer results than expected.
+                    for (; index < count; index++) {
+                        results[index].status = StatementStatus::Failed;
+                        results[index].response = StringView("!Missing response for the statement in the batch.\n");
+                    }
+
+                    failed = true;
+                }
+
+                return failed;
+            }
+    };
+}
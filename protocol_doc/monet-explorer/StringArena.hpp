@@ -0,0 +1,149 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+
+namespace MonetExplorer {
+    /**
+     * @brief Bump allocator for decoded text. The allocations are never
+     * freed one by one: Clear() releases all of them at once, and keeps
+     * the blocks for the next use. The returned pointers remain valid
+     * until then, because the blocks are never moved.
+     */
+    class StringArena {
+        private:
+            struct Block {
+                std::unique_ptr<char[]> data;
+                size_t size;
+            };
+
+            std::vector<Block> blocks;
+            size_t blockSize;
+            size_t nextBlock = 0;       // Index of the next block to use
+            char *position = nullptr;
+            size_t remaining = 0;
+            size_t usedBytes = 0;
+
+            /**
+             * @brief Continue in the next block which can hold
+             * the allocation, or create a new one.
+             *
+             * @param size
+             */
+            void NextBlock(size_t size) {
+                while (this->nextBlock < this->blocks.size()) {
+                    Block &block = this->blocks[this->nextBlock++];
+
+                    if (block.size >= size) {
+                        this->position = block.data.get();
+                        this->remaining = block.size;
+                        return;
+                    }
+                }
+
+                Block block;
+                block.size = std::max(this->blockSize, size);
+                block.data.reset(new char[block.size]);
+
+                this->position = block.data.get();
+                this->remaining = block.size;
+                this->blocks.push_back(std::move(block));
+                this->nextBlock = this->blocks.size();
+            }
+
+        public:
+            /**
+             * @brief Construct a new StringArena object
+             *
+             * @param blockSize The size of the allocated blocks. Larger
+             * allocations get their own block.
+             */
+            StringArena(size_t blockSize = 65536) : blockSize(blockSize) { }
+
+            /**
+             * @brief Allocate memory for text. (Not aligned)
+             *
+             * @param size
+             * @return char*
+             */
+            char *Allocate(size_t size) {
+                if (size > this->remaining) {
+                    this->NextBlock(size);
+                }
+
+                char *result = this->position;
+                this->position += size;
+                this->remaining -= size;
+                this->usedBytes += size;
+
+                return result;
+            }
+
+            /**
+             * @brief Give back the unused end of the last allocation.
+             *
+             * @param last The pointer returned by the last Allocate() call.
+             * @param allocated The size passed to it.
+             * @param used The part which is kept.
+             */
+            void Shrink(char *last, size_t allocated, size_t used) {
+                if (last + allocated == this->position && used <= allocated) {
+                    this->position -= allocated - used;
+                    this->remaining += allocated - used;
+                    this->usedBytes -= allocated - used;
+                }
+            }
+
+            /**
+             * @brief Release all allocations. The blocks are kept for reuse.
+             */
+            void Clear() {
+                this->nextBlock = 0;
+                this->position = nullptr;
+                this->remaining = 0;
+                this->usedBytes = 0;
+            }
+
+            /**
+             * @brief Get the total size of the live allocations.
+             *
+             * @return size_t
+             */
+            size_t GetUsedBytes() const {
+                return this->usedBytes;
+            }
+
+            /**
+             * @brief Get the total size of the blocks.
+             *
+             * @return size_t
+             */
+            size_t GetReservedBytes() const {
+                size_t total = 0;
+
+                for (const Block &block : this->blocks) {
+                    total += block.size;
+                }
+
+                return total;
+            }
+    };
+}
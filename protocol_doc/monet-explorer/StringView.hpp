@@ -0,0 +1,92 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+
+namespace MonetExplorer {
+    /**
+     * @brief A non-owning reference to a range of characters.
+     * (The project is on C++11, which has no std::string_view.)
+     * The referenced memory must outlive the view.
+     */
+    struct StringView {
+        const char *data;
+        size_t length;
+
+        /**
+         * @brief Construct an empty view.
+         */
+        StringView() : data(""), length(0) { }
+
+        /**
+         * @brief Construct a view over a character range.
+         *
+         * @param data Start of the range.
+         * @param length Number of bytes in the range.
+         */
+        StringView(const char *data, size_t length) : data(data), length(length) { }
+
+        /**
+         * @brief Construct a view over a null-terminated string.
+         *
+         * @param str Null-terminated string.
+         */
+        StringView(const char *str) : data(str), length(strlen(str)) { }
+
+        /**
+         * @brief Construct a view over the contents of a string.
+         * Intentionally implicit, so that functions taking a view
+         * can be called with strings too.
+         *
+         * @param str The string must not be modified while the view is used.
+         */
+        StringView(const std::string &str) : data(str.c_str()), length(str.length()) { }
+
+        /**
+         * @brief Returns true if the view references zero bytes.
+         *
+         * @return bool
+         */
+        bool IsEmpty() const {
+            return this->length == 0;
+        }
+
+        /**
+         * @brief Returns true if the view starts with the given prefix.
+         *
+         * @param prefix Null-terminated string.
+         * @return bool
+         */
+        bool StartsWith(const char *prefix) const {
+            size_t prefixLength = strlen(prefix);
+
+            return prefixLength <= this->length && memcmp(this->data, prefix, prefixLength) == 0;
+        }
+
+        /**
+         * @brief Copy the referenced bytes into a new string.
+         *
+         * @return std::string
+         */
+        std::string ToString() const {
+            return std::string(this->data, this->length);
+        }
+    };
+}
@@ -0,0 +1,205 @@
+/*
+    Copyright 2020 Tamas Bolner
+    
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+    
+      http://www.apache.org/licenses/LICENSE-2.0
+    
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <atomic>
+#include <cstdint>
+#include "Deadline.hpp"
+
+
+namespace MonetExplorer {
+    /**
+     * @brief The layer that moves the bytes between the
+     * blocking connections and their sockets. Implementations
+     * can be selected at runtime. (See: Connection::SetTransport)
+     */
+    class Transport {
+        protected:
+            // Atomic, because the default instance is shared between threads.
+            std::atomic<uint64_t> systemCalls{0};
+
+            /**
+             * @brief Wait until the socket is ready for the
+             * requested operation, or the deadline passes.
+             * 
+             * @param fd The socket.
+             * @param events POLLIN or POLLOUT.
+             * @param deadline
+             * @return int 1 if ready, 0 on timeout, -1 on error, with errno populated.
+             */
+            int WaitReady(int fd, short events, const Deadline &deadline) {
+                struct pollfd item;
+                item.fd = fd;
+                item.events = events;
+                item.revents = 0;
+
+                while (true) {
+                    this->systemCalls++;
+                    int result = poll(&item, 1, deadline.GetRemainingMs());
+
+                    if (result >= 0 || errno != EINTR) {
+                        return result > 0 ? 1 : result;
+                    }
+                }
+            }
+
+        public:
+            virtual ~Transport() { }
+
+            /**
+             * @brief Block until at least one byte is read, or the end
+             * of the stream is reached. Same semantics as readv().
+             * 
+             * @param fd The socket.
+             * @param vectors Where to put the data.
+             * @param count The number of vectors.
+             * @param timeoutMs The maximal time to wait. -1: no limit.
+             * @return ssize_t The number of bytes read, 0 at the end of
+             * the stream, -1 on error, with errno populated. (ETIMEDOUT
+             * on timeout)
+             */
+            virtual ssize_t Read(int fd, const struct iovec *vectors, int count, int timeoutMs) = 0;
+
+            /**
+             * @brief Block until at least one byte is written.
+             * Same semantics as writev().
+             * 
+             * @param fd The socket.
+             * @param vectors The data to write.
+             * @param count The number of vectors.
+             * @param timeoutMs The maximal time to wait. -1: no limit.
+             * @return ssize_t The number of bytes written, -1 on error,
+             * with errno populated. (ETIMEDOUT on timeout)
+             */
+            virtual ssize_t Write(int fd, const struct iovec *vectors, int count, int timeoutMs) = 0;
+
+            /**
+             * @brief Called before a socket is closed, to release
+             * the resources associated with it.
+             * 
+             * @param fd The socket.
+             */
+            virtual void Release(int fd) {
+                (void)fd;
+            }
+
+            /**
+             * @brief Get the name of the transport, for display.
+             * 
+             * @return const char* 
+             */
+            virtual const char *GetName() const = 0;
+
+            /**
+             * @brief Get the number of system calls made by the transport.
+             * 
+             * @return uint64_t 
+             */
+            uint64_t GetSystemCalls() const {
+                return this->systemCalls;
+            }
+    };
+
+    /**
+     * @brief The default transport, which uses one
+     * readv() / writev() call per operation. With a timeout
+     * the calls don't block (MSG_DONTWAIT), and poll() waits
+     * for the readiness only if no data or space is available.
+     */
+    class SocketTransport : public Transport {
+        public:
+            ssize_t Read(int fd, const struct iovec *vectors, int count, int timeoutMs) override {
+                if (timeoutMs < 0) {
+                    this->systemCalls++;
+                    return readv(fd, vectors, count);
+                }
+
+                Deadline deadline = Deadline::After(timeoutMs);
+                struct msghdr message = {};
+                message.msg_iov = (struct iovec*)vectors;
+                message.msg_iovlen = count;
+
+                while (true) {
+                    this->systemCalls++;
+                    ssize_t result = recvmsg(fd, &message, MSG_DONTWAIT);
+
+                    if (result >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                        return result;
+                    }
+
+                    int ready = this->WaitReady(fd, POLLIN, deadline);
+                    if (ready <= 0) {
+                        if (ready == 0) {
+                            errno = ETIMEDOUT;
+                        }
+
+                        return -1;
+                    }
+                }
+            }
+
+            ssize_t Write(int fd, const struct iovec *vectors, int count, int timeoutMs) override {
+                if (timeoutMs < 0) {
+                    this->systemCalls++;
+                    return writev(fd, vectors, count);
+                }
+
+                Deadline deadline = Deadline::After(timeoutMs);
+                struct msghdr message = {};
+                message.msg_iov = (struct iovec*)vectors;
+                message.msg_iovlen = count;
+
+                while (true) {
+                    this->systemCalls++;
+                    ssize_t result = sendmsg(fd, &message, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+                    if (result >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                        return result;
+                    }
+
+                    int ready = this->WaitReady(fd, POLLOUT, deadline);
+                    if (ready <= 0) {
+                        if (ready == 0) {
+                            errno = ETIMEDOUT;
+                        }
+
+                        return -1;
+                    }
+                }
+            }
+
+            const char *GetName() const override {
+                return "socket";
+            }
+
+            /**
+             * @brief Get the shared instance, used by
+             * the connections by default.
+             * 
+             * @return SocketTransport& 
+             */
+            static SocketTransport &GetInstance() {
+                static SocketTransport instance;
+
+                return instance;
+            }
+    };
+}
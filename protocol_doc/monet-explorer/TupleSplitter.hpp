@@ -0,0 +1,386 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "SimdKernel.hpp"
+#include "StringView.hpp"
+
+
+namespace MonetExplorer {
+    /**
+     * @brief The position of a raw field inside a page of tuples.
+     */
+    struct FieldSpan {
+        uint32_t offset = 0;    // Relative to the start of the page
+        uint32_t length = 0;
+        bool escaped = false;   // Contains a backslash, so it needs unescaping
+    };
+
+    /**
+     * @brief The fields of a page of tuples, in row-major order.
+     */
+    struct SplitPage {
+        StringView data;
+        size_t columnCount = 0;
+        size_t rowCount = 0;
+        std::vector<FieldSpan> fields;
+
+        /**
+         * @brief Get the position of a field.
+         *
+         * @param row
+         * @param column
+         * @return const FieldSpan&
+         */
+        const FieldSpan &GetSpan(size_t row, size_t column) const {
+            return this->fields[row * this->columnCount + column];
+        }
+
+        /**
+         * @brief Get a raw field. (Quoted and escaped, if it is a string.)
+         *
+         * @param row
+         * @param column
+         * @return StringView
+         */
+        StringView GetField(size_t row, size_t column) const {
+            const FieldSpan &span = this->fields[row * this->columnCount + column];
+            return StringView(this->data.data + span.offset, span.length);
+        }
+    };
+
+    /**
+     * @brief Splits all tuple lines of a page into fields in one pass.
+     * The string values are escaped inside the tuples (protocol_doc 6.1),
+     * so a raw tab is always a separator and a raw new line is always the
+     * end of a row. Therefore the quotes do not have to be tracked: it is
+     * enough to find the tabs, the new lines and the backslashes. The SIMD
+     * kernels classify 64 bytes at a time into bit masks, and only visit
+     * the positions of the set bits. The kernel is selected at runtime,
+     * based on the CPU.
+     * Not thread safe: use one instance per thread.
+     */
+    class TupleSplitter {
+        private:
+            SimdKernel kernel;
+
+            // State of the page being split
+            const char *data = nullptr;
+            size_t length = 0;
+            size_t columnCount = 0;
+            size_t fieldStart = 0;
+            size_t rowFields = 0;
+            bool escaped = false;
+            bool rowClosed = false;
+            SplitPage *page = nullptr;
+            size_t fieldCount = 0;      // The used part of page->fields
+
+            /**
+             * @brief Throw an exception about the row which contains the position.
+             *
+             * @param position
+             * @param problem
+             */
+            [[noreturn]] void ThrowInvalidRow(size_t position, const char *problem) const {
+                size_t start = position;
+                while (start > 0 && this->data[start - 1] != '\n') {
+                    start--;
+                }
+
+                const char *newLine = (const char*)memchr(this->data + start, '\n', this->length - start);
+                size_t end = newLine == nullptr ? this->length : newLine - this->data;
+
+                throw std::runtime_error("Invalid tuple line from MonetDB (" + std::string(problem) + "): "
+                    + std::string(this->data + start, end - start));
+            }
+
+            /**
+             * @brief Handle a tab character.
+             *
+             * @param position
+             */
+            inline void OnTab(size_t position) {
+                FieldSpan span;
+                span.offset = (uint32_t)this->fieldStart;
+                span.escaped = this->escaped;
+
+                // The last field is closed by "\t]", the others by ",\t"
+                if (position + 1 < this->length && this->data[position + 1] == ']'
+                    && (position + 2 == this->length || this->data[position + 2] == '\n')) {
+
+                    span.length = (uint32_t)(position - this->fieldStart);
+                    this->rowClosed = true;
+                } else {
+                    if (position == 0 || this->data[position - 1] != ',') {
+                        this->ThrowInvalidRow(position, "missing separator");
+                    }
+
+                    span.length = (uint32_t)(position - 1 - this->fieldStart);
+                }
+
+                if (++this->rowFields > this->columnCount) {
+                    this->ThrowInvalidRow(position, "too many fields");
+                }
+
+                if (this->fieldCount == this->page->fields.size()) {
+                    this->page->fields.resize(this->fieldCount * 2 + 1024);
+                }
+
+                this->page->fields[this->fieldCount++] = span;
+                this->fieldStart = position + 1;
+                this->escaped = false;
+            }
+
+            /**
+             * @brief Handle the end of a row.
+             *
+             * @param position The position of the new line, or the end of the page.
+             */
+            inline void OnRowEnd(size_t position) {
+                if (!this->rowClosed || this->rowFields != this->columnCount) {
+                    this->ThrowInvalidRow(position > 0 ? position - 1 : 0, "wrong number of fields");
+                }
+
+                this->page->rowCount++;
+                this->StartRow(position + 1);
+            }
+
+            /**
+             * @brief Initialize the state for a row.
+             *
+             * @param position The start of the line.
+             */
+            inline void StartRow(size_t position) {
+                if (position < this->length && (this->data[position] != '['
+                    || position + 1 >= this->length || this->data[position + 1] != ' ')) {
+
+                    this->ThrowInvalidRow(position, "not a tuple");
+                }
+
+                this->fieldStart = position + 2;    // After the "[ "
+                this->rowFields = 0;
+                this->rowClosed = false;
+                this->escaped = false;
+            }
+
+            /**
+             * @brief Process the classified positions of a 64 byte block,
+             * in the order of their appearance.
+             *
+             * @param tabs Bit mask of the tabs.
+             * @param newLines Bit mask of the new lines.
+             * @param backslashes Bit mask of the backslashes.
+             * @param base The position of the block.
+             */
+            inline void ProcessMasks(uint64_t tabs, uint64_t newLines, uint64_t backslashes, size_t base) {
+                uint64_t delimiters = tabs | newLines;
+
+                while (delimiters != 0) {
+                    int bit = __builtin_ctzll(delimiters);
+                    uint64_t below = (1ULL << bit) - 1;
+
+                    if ((backslashes & below) != 0) {
+                        this->escaped = true;
+                        backslashes &= ~below;
+                    }
+
+                    if ((tabs >> bit) & 1) {
+                        this->OnTab(base + bit);
+                    } else {
+                        this->OnRowEnd(base + bit);
+                    }
+
+                    delimiters &= delimiters - 1;
+                }
+
+                if (backslashes != 0) {
+                    this->escaped = true;
+                }
+            }
+
+            /**
+             * @brief Classify the bytes from a position to the end of the page
+             * one at a time. Used for the tails of the SIMD kernels too.
+             *
+             * @param position
+             */
+            void SplitScalar(size_t position) {
+                for (; position < this->length; position++) {
+                    char c = this->data[position];
+
+                    if (c == '\t') {
+                        this->OnTab(position);
+                    } else if (c == '\n') {
+                        this->OnRowEnd(position);
+                    } else if (c == '\\') {
+                        this->escaped = true;
+                    }
+                }
+            }
+
+#ifdef MONET_EXPLORER_X86
+            /**
+             * @brief Get the bit mask of the bytes which are equal to 'c',
+             * in a 16 byte chunk.
+             */
+            static inline uint64_t MatchSSE2(__m128i chunk, char c) {
+                return (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(c)));
+            }
+
+            /**
+             * @brief The SSE2 kernel. (Part of the x86-64 baseline)
+             *
+             * @return size_t The position where the scalar processing has to continue.
+             */
+            size_t SplitSSE2() {
+                size_t position = 0;
+
+                for (; position + 64 <= this->length; position += 64) {
+                    uint64_t tabs = 0, newLines = 0, backslashes = 0;
+
+                    for (int i = 0; i < 4; i++) {
+                        __m128i chunk = _mm_loadu_si128((const __m128i*)(this->data + position + i * 16));
+                        tabs |= MatchSSE2(chunk, '\t') << (i * 16);
+                        newLines |= MatchSSE2(chunk, '\n') << (i * 16);
+                        backslashes |= MatchSSE2(chunk, '\\') << (i * 16);
+                    }
+
+                    this->ProcessMasks(tabs, newLines, backslashes, position);
+                }
+
+                return position;
+            }
+
+            /**
+             * @brief Get the bit mask of the bytes which are equal to 'c',
+             * in a 32 byte chunk.
+             */
+            __attribute__((target("avx2")))
+            static inline uint64_t MatchAVX2(__m256i chunk, char c) {
+                return (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(c)));
+            }
+
+            /**
+             * @brief The AVX2 kernel.
+             *
+             * @return size_t The position where the scalar processing has to continue.
+             */
+            __attribute__((target("avx2")))
+            size_t SplitAVX2() {
+                size_t position = 0;
+
+                for (; position + 64 <= this->length; position += 64) {
+                    __m256i low = _mm256_loadu_si256((const __m256i*)(this->data + position));
+                    __m256i high = _mm256_loadu_si256((const __m256i*)(this->data + position + 32));
+
+                    this->ProcessMasks(
+                        MatchAVX2(low, '\t') | (MatchAVX2(high, '\t') << 32),
+                        MatchAVX2(low, '\n') | (MatchAVX2(high, '\n') << 32),
+                        MatchAVX2(low, '\\') | (MatchAVX2(high, '\\') << 32),
+                        position
+                    );
+                }
+
+                return position;
+            }
+#endif
+
+        public:
+            /**
+             * @brief Construct a new TupleSplitter object
+             *
+             * @param kernel Falls back to a supported one, if the CPU lacks it.
+             */
+            TupleSplitter(SimdKernel kernel = GetBestKernel()) {
+                this->kernel = IsKernelSupported(kernel) ? kernel : GetBestKernel();
+            }
+
+            /**
+             * @brief Get the kernel used by this instance.
+             *
+             * @return SimdKernel
+             */
+            SimdKernel GetKernel() const {
+                return this->kernel;
+            }
+
+            /**
+             * @brief Split the tuple lines of a page.
+             *
+             * @param tuples The tuple lines (See: ParsedResult::tuples). The
+             * new line is optional after the last one.
+             * @param columnCount The number of fields in each row.
+             * @param page Output. The previous content is replaced, but
+             * the allocation is reused.
+             * @throw runtime_error If a line is not a valid tuple.
+             */
+            void Split(StringView tuples, size_t columnCount, SplitPage &page) {
+                if (tuples.length > UINT32_MAX) {
+                    throw std::runtime_error("TupleSplitter::Split(): The page is larger than 4 GiB.");
+                }
+
+                if (columnCount == 0) {
+                    throw std::runtime_error("TupleSplitter::Split(): The column count cannot be zero.");
+                }
+
+                page.data = tuples;
+                page.columnCount = columnCount;
+                page.rowCount = 0;
+
+                /*
+                    The field array is resized rather than appended to, so
+                    that it keeps its elements between the pages.
+                */
+                page.fields.resize(page.fields.capacity());
+                this->fieldCount = 0;
+
+                this->data = tuples.data;
+                this->length = tuples.length;
+                this->columnCount = columnCount;
+                this->page = &page;
+
+                if (this->length == 0) {
+                    page.fields.clear();
+                    return;
+                }
+
+                this->StartRow(0);
+                size_t position = 0;
+
+#ifdef MONET_EXPLORER_X86
+                if (this->kernel == SimdKernel::AVX2) {
+                    position = this->SplitAVX2();
+                } else if (this->kernel == SimdKernel::SSE2) {
+                    position = this->SplitSSE2();
+                }
+#endif
+
+                this->SplitScalar(position);
+
+                // The last line can end without a new line.
+                if (this->data[this->length - 1] != '\n') {
+                    this->OnRowEnd(this->length);
+                }
+
+                page.fields.resize(this->fieldCount);
+            }
+    };
+}
@@ -0,0 +1,301 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include "SimdKernel.hpp"
+#include "StringArena.hpp"
+#include "StringView.hpp"
+
+
+namespace MonetExplorer {
+    /**
+     * @brief Resolves the escape sequences of the string values
+     * (protocol_doc 6.1): \t \n \r \f \" \' \\ and the three digit
+     * octal \ooo. A backslash before any other character is dropped,
+     * and a backslash at the end is kept.
+     * The unescaped text is never longer than the escaped, so the
+     * routines can work in place (output == input). The SIMD kernels
+     * copy the runs without backslashes one vector at a time, and only
+     * take the slow path at the backslashes.
+     */
+    class Unescaper {
+        private:
+            SimdKernel kernel;
+
+            /**
+             * @brief From this number of backslashes in a vector, the SIMD
+             * kernels switch to the scalar loop for the next DENSE_WINDOW bytes.
+             */
+            static const int DENSE_ESCAPES = 3;
+            static const int DENSE_WINDOW = 256;
+
+            /**
+             * @brief Decode the escape sequence at the input position.
+             *
+             * @param input Input/output: points to the backslash.
+             * @param end The end of the input.
+             * @param output Input/output: where the character is written.
+             */
+            static inline void DecodeEscape(const char *&input, const char *end, char *&output) {
+                input++;
+
+                if (input == end) {
+                    *output++ = '\\';
+                    return;
+                }
+
+                char code = *input++;
+
+                switch (code) {
+                    case 't': *output++ = '\t'; break;
+                    case 'n': *output++ = '\n'; break;
+                    case 'r': *output++ = '\r'; break;
+                    case 'f': *output++ = '\f'; break;
+                    default:
+                        if (code >= '0' && code <= '7' && end - input >= 2
+                            && input[0] >= '0' && input[0] <= '7'
+                            && input[1] >= '0' && input[1] <= '7') {
+
+                            *output++ = (char)(((code - '0') << 6) | ((input[0] - '0') << 3) | (input[1] - '0'));
+                            input += 2;
+                        } else {
+                            // \\, \", \' and the unknown sequences
+                            *output++ = code;
+                        }
+                }
+            }
+
+            /**
+             * @brief Unescape one byte at a time, until the input position reaches
+             * 'stop'. The last escape sequence can end after it.
+             *
+             * @param input Input/output.
+             * @param stop
+             * @param end The end of the input.
+             * @param output Input/output.
+             */
+            static inline void CopyScalar(const char *&input, const char *stop, const char *end, char *&output) {
+                while (input < stop) {
+                    if (*input == '\\') {
+                        DecodeEscape(input, end, output);
+                    } else {
+                        *output++ = *input++;
+                    }
+                }
+            }
+
+#ifdef MONET_EXPLORER_X86
+            /**
+             * @brief The SSE2 kernel.
+             *
+             * @return size_t The length of the output.
+             */
+            static size_t UnescapeSSE2(const char *input, size_t length, char *output) {
+                const char *end = input + length;
+                char *start = output;
+                bool separate = output + length <= input || input + length <= output;
+                const __m128i backslash = _mm_set1_epi8('\\');
+
+                while (end - input >= 16) {
+                    __m128i chunk = _mm_loadu_si128((const __m128i*)input);
+                    unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, backslash));
+
+                    if (mask == 0) {
+                        if (output != input) {
+                            _mm_storeu_si128((__m128i*)output, chunk);
+                        }
+
+                        input += 16;
+                        output += 16;
+                        continue;
+                    }
+
+                    /*
+                        Escape-dense text: reloading the vector after each
+                        escape would cost more than the scalar loop.
+                    */
+                    if (__builtin_popcount(mask) >= DENSE_ESCAPES) {
+                        CopyScalar(input, end - input > DENSE_WINDOW ? input + DENSE_WINDOW : end, end, output);
+                        continue;
+                    }
+
+                    /*
+                        The whole vector can be stored, unless it would overwrite
+                        the input after the backslash. (In place, when the output
+                        lags behind by less than a vector.)
+                    */
+                    int run = __builtin_ctz(mask);
+                    if (separate || input - output >= 16) {
+                        _mm_storeu_si128((__m128i*)output, chunk);
+                    } else if (output != input) {
+                        memmove(output, input, run);
+                    }
+
+                    input += run;
+                    output += run;
+                    DecodeEscape(input, end, output);
+                }
+
+                return UnescapeScalar(input, end - input, output) + (output - start);
+            }
+
+            /**
+             * @brief The AVX2 kernel.
+             *
+             * @return size_t The length of the output.
+             */
+            __attribute__((target("avx2")))
+            static size_t UnescapeAVX2(const char *input, size_t length, char *output) {
+                const char *end = input + length;
+                char *start = output;
+                bool separate = output + length <= input || input + length <= output;
+                const __m256i backslash = _mm256_set1_epi8('\\');
+
+                while (end - input >= 32) {
+                    __m256i chunk = _mm256_loadu_si256((const __m256i*)input);
+                    unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, backslash));
+
+                    if (mask == 0) {
+                        if (output != input) {
+                            _mm256_storeu_si256((__m256i*)output, chunk);
+                        }
+
+                        input += 32;
+                        output += 32;
+                        continue;
+                    }
+
+                    /*
+                        Escape-dense text: reloading the vector after each
+                        escape would cost more than the scalar loop.
+                    */
+                    if (__builtin_popcount(mask) >= DENSE_ESCAPES) {
+                        CopyScalar(input, end - input > DENSE_WINDOW ? input + DENSE_WINDOW : end, end, output);
+                        continue;
+                    }
+
+                    int run = __builtin_ctz(mask);
+                    if (separate || input - output >= 32) {
+                        _mm256_storeu_si256((__m256i*)output, chunk);
+                    } else if (output != input) {
+                        memmove(output, input, run);
+                    }
+
+                    input += run;
+                    output += run;
+                    DecodeEscape(input, end, output);
+                }
+
+                return UnescapeSSE2(input, end - input, output) + (output - start);
+            }
+#endif
+
+        public:
+            /**
+             * @brief Construct a new Unescaper object
+             *
+             * @param kernel Falls back to a supported one, if the CPU lacks it.
+             */
+            Unescaper(SimdKernel kernel = GetBestKernel()) {
+                this->kernel = IsKernelSupported(kernel) ? kernel : GetBestKernel();
+            }
+
+            /**
+             * @brief Get the kernel used by this instance.
+             *
+             * @return SimdKernel
+             */
+            SimdKernel GetKernel() const {
+                return this->kernel;
+            }
+
+            /**
+             * @brief The reference implementation: one byte at a time.
+             *
+             * @param input The escaped text, without the quotes.
+             * @param length
+             * @param output At least 'length' bytes. Can be equal to 'input'.
+             * @return size_t The length of the output.
+             */
+            static size_t UnescapeScalar(const char *input, size_t length, char *output) {
+                char *start = output;
+                CopyScalar(input, input + length, input + length, output);
+
+                return output - start;
+            }
+
+            /**
+             * @brief Unescape with the selected kernel.
+             *
+             * @param input The escaped text, without the quotes.
+             * @param length
+             * @param output At least 'length' bytes. Can be equal to 'input'.
+             * @return size_t The length of the output.
+             */
+            size_t Unescape(const char *input, size_t length, char *output) const {
+#ifdef MONET_EXPLORER_X86
+                if (this->kernel == SimdKernel::AVX2) {
+                    return UnescapeAVX2(input, length, output);
+                } else if (this->kernel == SimdKernel::SSE2) {
+                    return UnescapeSSE2(input, length, output);
+                }
+#endif
+
+                return UnescapeScalar(input, length, output);
+            }
+
+            /**
+             * @brief Unescape a buffer in place.
+             *
+             * @param data
+             * @param length
+             * @return size_t The new length.
+             */
+            size_t UnescapeInPlace(char *data, size_t length) const {
+                return this->Unescape(data, length, data);
+            }
+
+            /**
+             * @brief Get the value of a raw field. The quotes of the strings
+             * are removed. Only the strings with escape sequences are copied
+             * (into the arena), the other values point into the field.
+             *
+             * @param field A raw field of a tuple.
+             * @param arena Holds the result.
+             * @return StringView
+             */
+            StringView Unescape(StringView field, StringArena &arena) const {
+                if (field.length < 2 || field.data[0] != '"' || field.data[field.length - 1] != '"') {
+                    return field;
+                }
+
+                const char *input = field.data + 1;
+                size_t length = field.length - 2;
+
+                if (memchr(input, '\\', length) == nullptr) {
+                    return StringView(input, length);
+                }
+
+                char *output = arena.Allocate(length);
+                size_t result = this->Unescape(input, length, output);
+                arena.Shrink(output, length, result);
+
+                return StringView(output, result);
+            }
+    };
+}
@@ -0,0 +1,535 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "StringView.hpp"
+
+
+namespace MonetExplorer {
+    /**
+     * @brief The storage type of the MonetDB 'hugeint' values,
+     * and of the unscaled decimals.
+     */
+    typedef __int128 HugeInt;
+
+    /**
+     * @brief Parsers of the textual representations of the values
+     * inside the tuples. They return false on invalid input instead
+     * of throwing, so that the callers can add the context.
+     */
+    class ValueParser {
+        private:
+            /**
+             * @brief Parse exactly 'count' decimal digits.
+             *
+             * @param text Input/output: the position.
+             * @param end
+             * @param count
+             * @param value Output.
+             * @return bool
+             */
+            static inline bool ParseDigits(const char *&text, const char *end, int count, int &value) {
+                if (end - text < count) {
+                    return false;
+                }
+
+                value = 0;
+
+                for (int i = 0; i < count; i++) {
+                    if (text[i] < '0' || text[i] > '9') {
+                        return false;
+                    }
+
+                    value = value * 10 + (text[i] - '0');
+                }
+
+                text += count;
+                return true;
+            }
+
+            /**
+             * @brief Parse the optional fractional seconds, with up to 6 digits.
+             *
+             * @param text Input/output: points to the '.', if any.
+             * @param end
+             * @param microseconds Output.
+             * @return bool
+             */
+            static inline bool ParseFraction(const char *&text, const char *end, int64_t &microseconds) {
+                microseconds = 0;
+
+                if (text == end || *text != '.') {
+                    return true;
+                }
+
+                text++;
+                int digits = 0;
+
+                for (; text < end && *text >= '0' && *text <= '9'; text++, digits++) {
+                    if (digits < 6) {
+                        microseconds = microseconds * 10 + (*text - '0');
+                    }
+                }
+
+                for (; digits < 6; digits++) {
+                    microseconds *= 10;
+                }
+
+                return true;
+            }
+
+            /**
+             * @brief Parse the optional time zone suffix. (+HH:MM or -HH:MM)
+             *
+             * @param text Input/output.
+             * @param end
+             * @param offsetUs Output: the offset from UTC in microseconds.
+             * @return bool
+             */
+            static inline bool ParseZone(const char *&text, const char *end, int64_t &offsetUs) {
+                int hours, minutes;
+                offsetUs = 0;
+
+                if (text == end) {
+                    return true;
+                }
+
+                bool negative = *text == '-';
+                if (*text != '+' && *text != '-') {
+                    return false;
+                }
+
+                text++;
+                if (!ParseDigits(text, end, 2, hours) || text == end || *text++ != ':'
+                    || !ParseDigits(text, end, 2, minutes)) {
+
+                    return false;
+                }
+
+                offsetUs = ((int64_t)hours * 60 + minutes) * 60000000LL;
+                if (negative) {
+                    offsetUs = -offsetUs;
+                }
+
+                return true;
+            }
+
+        public:
+            static const int64_t MICROSECONDS_PER_DAY = 86400000000LL;
+
+            /**
+             * @brief Remove the quotes, if the value is quoted.
+             *
+             * @param field
+             * @return StringView
+             */
+            static StringView Unquote(StringView field) {
+                if (field.length >= 2 && field.data[0] == '"' && field.data[field.length - 1] == '"') {
+                    return StringView(field.data + 1, field.length - 2);
+                }
+
+                return field;
+            }
+
+            /**
+             * @brief Parse a signed integer of up to 128 bits.
+             *
+             * @param text
+             * @param value Output.
+             * @return bool False on invalid text or overflow.
+             */
+            static bool ParseHugeInt(StringView text, HugeInt &value) {
+                const char *position = text.data;
+                const char *end = text.data + text.length;
+                bool negative = false;
+                unsigned __int128 result = 0;
+                const unsigned __int128 limit = ((unsigned __int128)1 << 127);
+
+                if (position < end && (*position == '-' || *position == '+')) {
+                    negative = *position == '-';
+                    position++;
+                }
+
+                if (position == end) {
+                    return false;
+                }
+
+                for (; position < end; position++) {
+                    if (*position < '0' || *position > '9') {
+                        return false;
+                    }
+
+                    unsigned digit = *position - '0';
+                    if (result > (limit - digit) / 10) {
+                        return false;
+                    }
+
+                    result = result * 10 + digit;
+                }
+
+                if (!negative && result == limit) {
+                    return false;
+                }
+
+                value = negative ? (HugeInt)(0 - result) : (HugeInt)result;
+                return true;
+            }
+
+            /**
+             * @brief Parse a signed 64 bit integer.
+             *
+             * @param text
+             * @param value Output.
+             * @return bool False on invalid text or overflow.
+             */
+            static bool ParseInt64(StringView text, int64_t &value) {
+                const char *position = text.data;
+                const char *end = text.data + text.length;
+                bool negative = false;
+                uint64_t result = 0;
+
+                if (position < end && (*position == '-' || *position == '+')) {
+                    negative = *position == '-';
+                    position++;
+                }
+
+                if (position == end || end - position > 19) {
+                    return false;
+                }
+
+                for (; position < end; position++) {
+                    if (*position < '0' || *position > '9') {
+                        return false;
+                    }
+
+                    result = result * 10 + (*position - '0');
+                }
+
+                if (result > (uint64_t)INT64_MAX + (negative ? 1 : 0)) {
+                    return false;
+                }
+
+                value = negative ? (int64_t)(0 - result) : (int64_t)result;
+                return true;
+            }
+
+            /**
+             * @brief Parse a decimal number into its unscaled integer value.
+             * For example "12.5" with scale 3 gives 12500.
+             *
+             * @param text
+             * @param scale The number of fractional digits. If it is -1, then
+             * it is set to the number of fractional digits in the text.
+             * @param value Output.
+             * @return bool False on invalid text, overflow or too many fractional digits.
+             */
+            static bool ParseDecimal(StringView text, int &scale, HugeInt &value) {
+                const char *dot = (const char*)memchr(text.data, '.', text.length);
+
+                if (dot == nullptr) {
+                    if (scale < 0) {
+                        scale = 0;
+                    }
+
+                    if (!ParseHugeInt(text, value)) {
+                        return false;
+                    }
+                } else {
+                    int fraction = (int)(text.data + text.length - dot - 1);
+                    if (scale < 0) {
+                        scale = fraction;
+                    }
+
+                    if (fraction > scale || fraction > 38) {
+                        return false;
+                    }
+
+                    // Remove the dot: "-.5" and "1." are accepted too.
+                    char digits[80];
+                    size_t length = text.length - 1;
+
+                    if (length >= sizeof(digits)) {
+                        return false;
+                    }
+
+                    memcpy(digits, text.data, dot - text.data);
+                    memcpy(digits + (dot - text.data), dot + 1, fraction);
+
+                    if (length == 0 || (length == 1 && (digits[0] == '-' || digits[0] == '+'))) {
+                        return false;
+                    }
+
+                    if (!ParseHugeInt(StringView(digits, length), value)) {
+                        return false;
+                    }
+
+                    for (; fraction < scale; fraction++) {
+                        value *= 10;
+                    }
+
+                    return true;
+                }
+
+                for (int i = 0; i < scale; i++) {
+                    value *= 10;
+                }
+
+                return true;
+            }
+
+            /**
+             * @brief Parse a floating point number.
+             *
+             * @param text
+             * @param value Output.
+             * @return bool
+             */
+            static bool ParseDouble(StringView text, double &value) {
+                char buffer[128];
+
+                if (text.length == 0 || text.length >= sizeof(buffer)) {
+                    return false;
+                }
+
+                // strtod() needs a terminated string
+                memcpy(buffer, text.data, text.length);
+                buffer[text.length] = 0;
+
+                char *end;
+                value = strtod(buffer, &end);
+
+                return end == buffer + text.length;
+            }
+
+            /**
+             * @brief Parse a boolean.
+             *
+             * @param text "true" or "false".
+             * @param value Output.
+             * @return bool
+             */
+            static bool ParseBoolean(StringView text, bool &value) {
+                if (text.length == 4 && memcmp(text.data, "true", 4) == 0) {
+                    value = true;
+                    return true;
+                } else if (text.length == 5 && memcmp(text.data, "false", 5) == 0) {
+                    value = false;
+                    return true;
+                }
+
+                return false;
+            }
+
+            /**
+             * @brief Parse a date.
+             *
+             * @param text YYYY-MM-DD
+             * @param days Output: days since 1970-01-01.
+             * @return bool
+             */
+            static bool ParseDate(StringView text, int32_t &days) {
+                const char *position = text.data;
+                const char *end = text.data + text.length;
+                int year, month, day;
+
+                if (!ParseDate(position, end, year, month, day) || position != end) {
+                    return false;
+                }
+
+                days = DaysFromCivil(year, month, day);
+                return true;
+            }
+
+            /**
+             * @brief Parse the date part of a text.
+             *
+             * @param text Input/output: the position.
+             * @param end
+             * @param year Output.
+             * @param month Output.
+             * @param day Output.
+             * @return bool
+             */
+            static bool ParseDate(const char *&text, const char *end, int &year, int &month, int &day) {
+                bool negative = text < end && *text == '-';
+                if (negative) {
+                    text++;
+                }
+
+                const char *dash = (const char*)memchr(text, '-', end - text);
+                if (dash == nullptr || dash - text < 1 || dash - text > 6) {
+                    return false;
+                }
+
+                if (!ParseDigits(text, dash, (int)(dash - text), year)) {
+                    return false;
+                }
+
+                if (negative) {
+                    year = -year;
+                }
+
+                text++;
+                if (!ParseDigits(text, end, 2, month) || text == end || *text++ != '-'
+                    || !ParseDigits(text, end, 2, day)) {
+
+                    return false;
+                }
+
+                return month >= 1 && month <= 12 && day >= 1 && day <= 31;
+            }
+
+            /**
+             * @brief Parse a time of day, with an optional time zone.
+             * The values with time zones are converted to UTC.
+             *
+             * @param text HH:MM:SS[.ffffff][+HH:MM]
+             * @param microseconds Output: since midnight.
+             * @return bool
+             */
+            static bool ParseTime(StringView text, int64_t &microseconds) {
+                const char *position = text.data;
+                const char *end = text.data + text.length;
+                int64_t offset;
+
+                if (!ParseTime(position, end, microseconds) || !ParseZone(position, end, offset)
+                    || position != end) {
+
+                    return false;
+                }
+
+                microseconds -= offset;
+                microseconds = ((microseconds % MICROSECONDS_PER_DAY) + MICROSECONDS_PER_DAY) % MICROSECONDS_PER_DAY;
+                return true;
+            }
+
+            /**
+             * @brief Parse the time part of a text.
+             *
+             * @param text Input/output: the position.
+             * @param end
+             * @param microseconds Output: since midnight.
+             * @return bool
+             */
+            static bool ParseTime(const char *&text, const char *end, int64_t &microseconds) {
+                int hours, minutes, seconds;
+                int64_t fraction;
+
+                if (!ParseDigits(text, end, 2, hours) || text == end || *text++ != ':'
+                    || !ParseDigits(text, end, 2, minutes) || text == end || *text++ != ':'
+                    || !ParseDigits(text, end, 2, seconds) || !ParseFraction(text, end, fraction)) {
+
+                    return false;
+                }
+
+                microseconds = (((int64_t)hours * 60 + minutes) * 60 + seconds) * 1000000LL + fraction;
+                return hours < 24 && minutes < 60 && seconds < 61;
+            }
+
+            /**
+             * @brief Parse a timestamp, with an optional time zone.
+             * The values with time zones are converted to UTC.
+             *
+             * @param text YYYY-MM-DD HH:MM:SS[.ffffff][+HH:MM]
+             * @param microseconds Output: since 1970-01-01 00:00:00.
+             * @return bool
+             */
+            static bool ParseTimestamp(StringView text, int64_t &microseconds) {
+                const char *position = text.data;
+                const char *end = text.data + text.length;
+                int year, month, day;
+                int64_t time, offset;
+
+                if (!ParseDate(position, end, year, month, day) || position == end || *position++ != ' '
+                    || !ParseTime(position, end, time) || !ParseZone(position, end, offset) || position != end) {
+
+                    return false;
+                }
+
+                microseconds = DaysFromCivil(year, month, day) * MICROSECONDS_PER_DAY + time - offset;
+                return true;
+            }
+
+            /**
+             * @brief Convert a date of the proleptic Gregorian calendar
+             * to the number of days since 1970-01-01.
+             * (Howard Hinnant's days_from_civil algorithm.)
+             *
+             * @param year
+             * @param month 1..12
+             * @param day 1..31
+             * @return int32_t
+             */
+            static int32_t DaysFromCivil(int year, int month, int day) {
+                year -= month <= 2;
+                int era = (year >= 0 ? year : year - 399) / 400;
+                int yearOfEra = year - era * 400;
+                int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+                int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+
+                return era * 146097 + dayOfEra - 719468;
+            }
+
+            /**
+             * @brief Format a 128 bit integer.
+             *
+             * @param value
+             * @return std::string
+             */
+            static std::string FormatHugeInt(HugeInt value) {
+                return FormatDecimal(value, 0);
+            }
+
+            /**
+             * @brief Format an unscaled decimal value, the same way as MonetDB does.
+             *
+             * @param value
+             * @param scale
+             * @return std::string
+             */
+            static std::string FormatDecimal(HugeInt value, int scale) {
+                char buffer[48];
+                char *position = buffer + sizeof(buffer);
+                bool negative = value < 0;
+                unsigned __int128 magnitude = negative ? 0 - (unsigned __int128)value : (unsigned __int128)value;
+                int digits = 0;
+
+                do {
+                    *--position = (char)('0' + (int)(magnitude % 10));
+                    magnitude /= 10;
+                    digits++;
+
+                    if (digits == scale) {
+                        *--position = '.';
+                    }
+                } while (magnitude != 0 || digits < scale);
+
+                if (scale > 0 && digits == scale) {
+                    *--position = '0';
+                }
+
+                if (negative) {
+                    *--position = '-';
+                }
+
+                return std::string(position, buffer + sizeof(buffer) - position);
+            }
+    };
+}
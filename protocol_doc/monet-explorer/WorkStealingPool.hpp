@@ -0,0 +1,260 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+
+namespace MonetExplorer {
+    /**
+     * @brief A fixed set of worker threads, which execute batches of
+     * indexed tasks. Each worker gets a contiguous range of the tasks
+     * of a batch in its own queue, and takes them from the front. When
+     * its queue is empty, it steals from the back of the others, so
+     * the uneven tasks are balanced without a central queue.
+     * Only one batch runs at a time: Run() is not reentrant.
+     */
+    class WorkStealingPool {
+        public:
+            /**
+             * @brief A task of a batch.
+             *
+             * @param task The index of the task.
+             * @param worker The index of the executing worker, for
+             * accessing per-worker state without locking.
+             */
+            typedef std::function<void(size_t task, size_t worker)> Job;
+
+        private:
+            /**
+             * @brief The task queue of a worker.
+             */
+            struct Queue {
+                std::mutex mutex;
+                std::deque<size_t> tasks;
+            };
+
+            std::vector<std::unique_ptr<Queue>> queues;
+            std::vector<std::thread> threads;
+            std::mutex mutex;
+            std::condition_variable wake;
+            std::condition_variable done;
+            const Job *job = nullptr;
+            uint64_t generation = 0;        // Incremented for each batch
+            size_t remaining = 0;           // Unfinished tasks of the current batch
+            bool stopping = false;
+            std::exception_ptr error;       // The first exception of the current batch
+            std::atomic<uint64_t> steals;
+
+            /**
+             * @brief Take a task: from the front of the own queue,
+             * or from the back of the others.
+             *
+             * @param worker
+             * @param task Output.
+             * @return bool False if all the queues are empty.
+             */
+            bool Take(size_t worker, size_t &task) {
+                for (size_t i = 0; i < this->queues.size(); i++) {
+                    Queue &queue = *this->queues[(worker + i) % this->queues.size()];
+                    std::lock_guard<std::mutex> lock(queue.mutex);
+
+                    if (queue.tasks.empty()) {
+                        continue;
+                    }
+
+                    if (i == 0) {
+                        task = queue.tasks.front();
+                        queue.tasks.pop_front();
+                    } else {
+                        task = queue.tasks.back();
+                        queue.tasks.pop_back();
+                        this->steals++;
+                    }
+
+                    return true;
+                }
+
+                return false;
+            }
+
+            /**
+             * @brief The main loop of the worker threads.
+             *
+             * @param worker
+             */
+            void Work(size_t worker) {
+                uint64_t seen = 0;
+
+                while (true) {
+                    {
+                        std::unique_lock<std::mutex> lock(this->mutex);
+                        this->wake.wait(lock, [&] { return this->stopping || this->generation != seen; });
+
+                        if (this->stopping) {
+                            return;
+                        }
+
+                        seen = this->generation;
+                    }
+
+                    size_t task;
+                    while (this->Take(worker, task)) {
+                        std::exception_ptr failure;
+                        const Job *current;
+
+                        /*
+                            The job is read after taking the task: a slow worker
+                            can take a task of the next batch, whose job is set
+                            by Run() before it releases the lock.
+                        */
+                        {
+                            std::lock_guard<std::mutex> lock(this->mutex);
+                            current = this->job;
+                        }
+
+                        try {
+                            (*current)(task, worker);
+                        } catch (...) {
+                            failure = std::current_exception();
+                        }
+
+                        std::lock_guard<std::mutex> lock(this->mutex);
+                        if (failure && !this->error) {
+                            this->error = failure;
+                        }
+
+                        if (--this->remaining == 0) {
+                            this->done.notify_all();
+                        }
+                    }
+                }
+            }
+
+        public:
+            /**
+             * @brief Construct a new WorkStealingPool object
+             *
+             * @param threadCount The number of the worker threads.
+             * 0: execute the tasks on the calling thread.
+             */
+            WorkStealingPool(size_t threadCount) : steals(0) {
+                for (size_t i = 0; i < threadCount; i++) {
+                    this->queues.emplace_back(new Queue());
+                }
+
+                for (size_t i = 0; i < threadCount; i++) {
+                    this->threads.emplace_back(&WorkStealingPool::Work, this, i);
+                }
+            }
+
+            WorkStealingPool(const WorkStealingPool&) = delete;
+            WorkStealingPool &operator=(const WorkStealingPool&) = delete;
+
+            /**
+             * @brief Stop and join the workers.
+             */
+            ~WorkStealingPool() {
+                {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    this->stopping = true;
+                }
+
+                this->wake.notify_all();
+
+                for (std::thread &thread : this->threads) {
+                    thread.join();
+                }
+            }
+
+            /**
+             * @brief Get the number of the worker threads.
+             *
+             * @return size_t
+             */
+            size_t GetThreadCount() const {
+                return this->threads.size();
+            }
+
+            /**
+             * @brief Get the number of the tasks, which were executed
+             * by another worker than the one they were assigned to.
+             *
+             * @return uint64_t
+             */
+            uint64_t GetStealCount() const {
+                return this->steals.load();
+            }
+
+            /**
+             * @brief Execute a batch of tasks, and wait for all of them
+             * to finish. If any of them throws, then the rest are still
+             * executed, and the first exception is rethrown.
+             *
+             * @param taskCount
+             * @param job Called once for each task index.
+             */
+            void Run(size_t taskCount, const Job &job) {
+                if (taskCount == 0) {
+                    return;
+                }
+
+                if (this->threads.empty()) {
+                    for (size_t task = 0; task < taskCount; task++) {
+                        job(task, 0);
+                    }
+
+                    return;
+                }
+
+                std::unique_lock<std::mutex> lock(this->mutex);
+                size_t workers = this->queues.size();
+
+                for (size_t i = 0; i < workers; i++) {
+                    std::lock_guard<std::mutex> queueLock(this->queues[i]->mutex);
+
+                    for (size_t task = taskCount * i / workers; task < taskCount * (i + 1) / workers; task++) {
+                        this->queues[i]->tasks.push_back(task);
+                    }
+                }
+
+                this->job = &job;
+                this->remaining = taskCount;
+                this->error = nullptr;
+                this->generation++;
+                this->wake.notify_all();
+
+                this->done.wait(lock, [this] { return this->remaining == 0; });
+                this->job = nullptr;
+
+                if (this->error) {
+                    std::exception_ptr failure = this->error;
+                    this->error = nullptr;
+                    std::rethrow_exception(failure);
+                }
+            }
+    };
+}
@@ -44,6 +44,74 @@ int main(int argc, char *argv[]) {
             "typi|cally a weaker hash al|go|rithm, which is used to|gether with the "
             "stron|ger 'pass|word hash' that is now SHA512. The cur|rent|ly sup|port|ed values are: "
             "SHA1, SHA256, SHA512, RIPEMD160, SHA224, SHA384. De|fault is SHA1.");
+        cmd.Argument.Int("read-ahead", 'r', 65536, "bytes", "The size of the read-ahead buf|fer. Re|spon|ses "
+            "are read from the socket in chunks of this size, which re|duces the num|ber of sys|tem calls. "
+            "Set it to 0 to read every packet sep|a|rate|ly. The de|fault value is 65536.");
+        cmd.Argument.String("transport", 'T', "socket", "name", "The I/O back|end of the con|nec|tion. "
+            "Sup|port|ed values: 'socket' (read/write sys|tem calls) and 'io_uring' (multi|shot re|ceives "
+            "into reg|is|tered buf|fers, Linux 6.0+). With io_uring the read-ahead buf|fer is not re|quired, "
+            "it can be set to 0. The de|fault value is 'socket'.");
+        cmd.Argument.String("socket-profile", 'S', "default", "name", "Pre|de|fined socket op|tions. "
+            "'default': keep the sys|tem de|faults. 'latency': for point queries (TCP_NODELAY, TCP_QUICKACK, "
+            "50 us busy poll|ing). 'bulk': for large ex|ports (TCP_NODELAY, 4 MiB re|ceive and 256 KiB send "
+            "buf|fer). 'auto': TCP_NODELAY, then de|cides from the mea|sured round-trip time and through|put. "
+            "The op|tions below over|ride those of the pro|file. The de|fault value is 'default'.");
+        cmd.Argument.Int("receive-buffer", 'R', 0, "bytes", "The size of the socket re|ceive buf|fer "
+            "(SO_RCVBUF). 0 = de|fined by the pro|file.");
+        cmd.Argument.Int("send-buffer", 'W', 0, "bytes", "The size of the socket send buf|fer "
+            "(SO_SNDBUF). 0 = de|fined by the pro|file.");
+        cmd.Argument.Int("busy-poll", 'B', 0, "us", "Busy poll the net|work de|vice for this many "
+            "micro|sec|onds when wait|ing for data (SO_BUSY_POLL). Values above the net.core.busy_read "
+            "sysctl re|quire CAP_NET_ADMIN. 0 = de|fined by the pro|file.");
+        cmd.Option("no-delay", 'n', "Dis|able Nagle's al|go|rithm (TCP_NODELAY).");
+        cmd.Option("quick-ack", 'q', "Send the ACKs im|me|di|ate|ly, in|stead of de|lay|ing them (TCP_QUICKACK).");
+        cmd.Argument.Int("timeout", 'o', 0, "ms", "The time limit of the in|di|vid|ual socket op|er|a|tions "
+            "(con|nect|ing, send|ing or re|ceiv|ing a mes|sage) in mil|li|sec|onds. The con|nec|tion is "
+            "closed on time|out. The de|fault value 0 means no limit.");
+        cmd.Argument.Int("connect-timeout", 'c', 0, "ms", "The time limit of con|nect|ing and au|then|ti|cat|ing "
+            "to|geth|er, in|clud|ing the Merovingian re|di|rects, in mil|li|sec|onds. The de|fault value 0 "
+            "means no limit.");
+        cmd.Option("decode", 'd', "De|code the re|sponse mes|sages and print a sum|ma|ry of their re|sults "
+            "(sta|tus fields, col|umn meta|da|ta, tu|ple counts).");
+        cmd.Argument.String("materialize", 'm', "eager", "policy", "When to de|code the tu|ples for "
+            "--decode. \"eager\": all of them at once, in|to typed col|umns. \"lazy\": each row at its "
+            "first ac|cess. (On|ly the first row is ac|cessed.)");
+        cmd.Argument.Int("decode-threads", 'j', 1, "count", "The num|ber of threads for the ea|ger de|cod|ing "
+            "of --decode. Large pages are cut in|to chunks, and de|cod|ed in par|al|lel. 0: one per CPU core. "
+            "The re|sults which don't fit in|to a sin|gle mes|sage are de|cod|ed on one thread, with their "
+            "Xexport blocks.");
+        cmd.Argument.Int("dictionary", 'D', 0, "values", "Dic|tion|ary en|code the string col|umns at the "
+            "ea|ger de|cod|ing of --decode, un|til they have more dis|tinct val|ues than this. Then they are "
+            "stored as plain strings. 0: no dic|tion|ary en|cod|ing.");
+        cmd.Argument.String("select", 'C', "", "column", "De|code on|ly this col|umn of the re|sult sets "
+            "at --decode. Can be re|peat|ed. The oth|er fields are skipped af|ter lo|cat|ing them.");
+        cmd.Argument.String("where", 'w', "", "condition", "De|code on|ly the rows of the re|sult sets "
+            "match|ing a con|di|tion, at --decode: name=value, name=low..high (one bound can be emp|ty) "
+            "or name^=prefix. Can be re|peat|ed.");
+        cmd.Argument.Int("prefetch", 'f', 0, "rows", "Ex|e|cute the SQL queries through a pre|fetch|ing "
+            "cur|sor, with pages of this many rows. An I/O thread re|quests the next page with Xexport, while "
+            "the cur|rent one is de|cod|ed. Prints the page sizes and the time spent wait|ing for the net|work. "
+            "0: send the SQL queries as they are.");
+        cmd.Argument.Int("page-bytes", 'b', 0, "bytes", "Adapt the row count of the pages af|ter the first "
+            "one for --prefetch, so that they are about this large. The pages are en|larged if the round trip "
+            "would take more than 10% of their time. 0: all the pages have the row count of --prefetch.");
+        cmd.Argument.Int("page-memory", 'M', 67108864, "bytes", "The lim|it of the mem|o|ry used by the "
+            "pages at once (re|ceived, buf|fered and de|cod|ed), for --page-bytes. The de|fault value is 64 MiB.");
+        cmd.Argument.Int("spill", 'l', 0, "bytes", "Store the pages of --prefetch, then read them back. "
+            "The pages are kept in mem|o|ry un|til they use this many bytes, then the fur|ther ones are "
+            "writ|ten to a tem|po|rary file in $TMPDIR, and mapped back at read|ing. 0: the pages are not stored.");
+        cmd.Argument.Int("browse", 'g', 0, "rows", "Open the re|sults of the SQL queries for brows|ing, with "
+            "pages of this many rows. Then enter @row (for ex|am|ple @5000000) to show a row. The miss|ing pages "
+            "are fetched with Xexport, and the de|cod|ed ones are cached. Se|quen|tial ac|cess trig|gers read-ahead. "
+            "0: no brows|ing.");
+        cmd.Argument.Int("page-cache", 'K', 67108864, "bytes", "The lim|it of the mem|o|ry used by the de|cod|ed "
+            "pages of --browse. The least re|cent|ly used pages are evict|ed first. The de|fault value is 64 MiB.");
+        cmd.Argument.Int("prepared-cache", 'k', 0, "count", "Cache the pre|pared state|ments of the "
+            "'sPREPARE ...' mes|sages by their text, up to this many. A cached query is not pre|pared again. "
+            "The least re|cent|ly used ones are re|leased with Xrelease, which is sent to|geth|er with the next "
+            "re|quest. 0: no cach|ing.");
+        cmd.Option("stats", 's', "Print the transfer statistics of the con|nec|tion after each re|ceived "
+            "mes|sage. (Counts of the mes|sages, packets, re|ceived and copied bytes.)");
         cmd.Option("help", '?', "Display the usage instructions.");
         cmd.RestrictOperands();
 
@@ -0,0 +1,73 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/*
+    Compares the dispatch modes of the columnar decoder: the switch on
+    the type of each field (DecoderDispatch::PerField) and the loops
+    specialized for the type of each column (DecoderDispatch::PerColumn).
+    Also checks that both of them decode the same values.
+
+    Usage: DecoderBenchmark [rows]
+*/
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include "../ColumnarDecoder.hpp"
+#include "../ResponseParser.hpp"
+#include "DecoderFixture.hpp"
+#include "TestUtil.hpp"
+
+using namespace MonetExplorer;
+
+
+/**
+ * @brief Decode the result a few times, and print the throughput.
+ */
+static void Measure(const ParsedResult &result, DecoderDispatch dispatch, ColumnarResult &output) {
+    ColumnarDecoder decoder(GetBestKernel(), dispatch);
+    int repeats = 5;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repeats; i++) {
+        decoder.Decode(result, output);
+    }
+    double seconds = Test::Elapsed(start) / repeats;
+
+    std::cout << (dispatch == DecoderDispatch::PerField ? "per-field" : "per-column") << ": "
+        << result.tuples.length / seconds / 1e9 << " GB/s, " << result.tupleCount / seconds / 1e6
+        << " M rows/s\n";
+}
+
+int main(int argc, char *argv[]) {
+    size_t rows = Test::GetSizeArgument(argc, argv, 500000);
+    std::string message = Test::GenerateResponse(rows);
+
+    ResponseParser parser;
+    parser.Parse(StringView(message));
+    const ParsedResult &result = parser.GetResult(0);
+    Test::CheckEqual(result.tupleCount, rows, "tuple count");
+
+    ColumnarResult perField;
+    ColumnarResult perColumn;
+    Measure(result, DecoderDispatch::PerField, perField);
+    Measure(result, DecoderDispatch::PerColumn, perColumn);
+
+    Test::Check(perField.GetRowCount() == perColumn.GetRowCount() && Test::IsSameRows(perField, 0, perColumn),
+        "the dispatch modes decode the same values");
+
+    return Test::Finish("DecoderBenchmark");
+}
@@ -0,0 +1,119 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include "../ColumnarResult.hpp"
+
+
+namespace MonetExplorer {
+    namespace Test {
+        /**
+         * @brief Generate a complete &1 response of 10 columns of mixed types.
+         *
+         * @param rows
+         * @return std::string
+         */
+        inline std::string GenerateResponse(size_t rows) {
+            std::string message = "&1 0 " + std::to_string(rows) + " 10 " + std::to_string(rows) + " 1 10 5 5\n"
+                "% sys.t,\tsys.t,\tsys.t,\tsys.t,\tsys.t,\tsys.t,\tsys.t,\tsys.t,\tsys.t,\tsys.t # table_name\n"
+                "% id,\tsmall,\tbig,\tamount,\tratio,\tday,\tflag,\tname,\tcity,\tnote # name\n"
+                "% int,\tsmallint,\tbigint,\tdecimal,\tdouble,\tdate,\tboolean,\tvarchar,\tvarchar,\tclob # type\n"
+                "% 10,\t5,\t20,\t18,\t24,\t10,\t5,\t20,\t10,\t40 # length\n"
+                "% 32 0,\t16 0,\t64 0,\t18 2,\t53 0,\t0 0,\t1 0,\t0 0,\t0 0,\t0 0 # typesizes\n";
+            static const char *cities[] = { "Berlin", "Budapest", "Amsterdam", "Lisbon" };
+
+            message.reserve(message.length() + rows * 120);
+
+            for (size_t i = 0; i < rows; i++) {
+                message += "[ " + std::to_string(i) + ",\t" + std::to_string(i % 30000) + ",\t"
+                    + std::to_string((int64_t)i * 1000003) + ",\t" + std::to_string(i % 100000) + "."
+                    + std::to_string(10 + i % 90) + ",\t" + std::to_string(i * 0.25) + ",\t\"2020-0"
+                    + std::to_string(1 + i % 9) + "-1" + std::to_string(i % 10) + "\",\t" + (i % 2 ? "true" : "false")
+                    + ",\t\"name " + std::to_string(i) + "\",\t\"" + cities[i % 4] + "\",\t"
+                    + (i % 7 == 0 ? "NULL" : "\"a\\tb " + std::to_string(i % 1000) + "\"") + "\t]\n";
+            }
+
+            return message;
+        }
+
+        /**
+         * @brief Compare the raw values of two fixed-width columns.
+         * Any type of the same size can be used.
+         */
+        template<typename T>
+        bool IsSameValues(const Column &expected, size_t first, const Column &actual) {
+            return memcmp(expected.GetValues<T>().data + first, actual.GetValues<T>().data,
+                actual.GetRowCount() * sizeof(T)) == 0;
+        }
+
+        inline bool IsSameValues(const Column &expected, size_t first, const Column &actual) {
+            switch (GetColumnTypeSize(expected.GetType())) {
+                case 1: return IsSameValues<int8_t>(expected, first, actual);
+                case 2: return IsSameValues<int16_t>(expected, first, actual);
+                case 4: return IsSameValues<int32_t>(expected, first, actual);
+                case 8: return IsSameValues<int64_t>(expected, first, actual);
+                default: return IsSameValues<HugeInt>(expected, first, actual);
+            }
+        }
+
+        /**
+         * @brief Compare a decoded result to a range of the rows of
+         * another one, value by value.
+         *
+         * @param expected
+         * @param first The first row of the range in 'expected'.
+         * @param actual Holds the rows of the range.
+         * @return bool
+         */
+        inline bool IsSameRows(const ColumnarResult &expected, size_t first, const ColumnarResult &actual) {
+            if (first + actual.GetRowCount() > expected.GetRowCount()
+                || expected.GetColumnCount() != actual.GetColumnCount()) {
+
+                return false;
+            }
+
+            for (size_t i = 0; i < expected.GetColumnCount(); i++) {
+                const Column &a = expected.GetColumn(i);
+                const Column &b = actual.GetColumn(i);
+
+                if (a.GetType() != b.GetType() || a.GetScale() != b.GetScale()) {
+                    return false;
+                }
+
+                for (size_t row = 0; row < actual.GetRowCount(); row++) {
+                    if (a.IsNull(first + row) != b.IsNull(row)) {
+                        return false;
+                    }
+
+                    if (a.GetType() == ColumnType::String && !b.IsNull(row)
+                        && a.GetString(first + row).ToString() != b.GetString(row).ToString()) {
+
+                        return false;
+                    }
+                }
+
+                if (a.GetType() != ColumnType::String && !IsSameValues(a, first, b)) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+    }
+}
@@ -0,0 +1,96 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/*
+    The scaling of the parallel decoder: decodes the same page with
+    1 to N worker threads (N = the number of the CPU cores by default),
+    and checks the order and the values of the rows against a single
+    ColumnarDecoder.
+
+    Usage: ParallelDecoderBenchmark [rows] [N]
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include "../ColumnarDecoder.hpp"
+#include "../ParallelDecoder.hpp"
+#include "../ResponseParser.hpp"
+#include "DecoderFixture.hpp"
+#include "TestUtil.hpp"
+
+using namespace MonetExplorer;
+
+
+/**
+ * @brief Check that the segments hold the rows of the reference, in order.
+ */
+static bool IsSame(const ColumnarResult &reference, const SegmentedResult &segmented) {
+    if (segmented.GetRowCount() != reference.GetRowCount()) {
+        return false;
+    }
+
+    for (size_t i = 0; i < segmented.GetSegmentCount(); i++) {
+        if (!Test::IsSameRows(reference, segmented.GetSegmentStart(i), segmented.GetSegment(i))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    size_t rows = Test::GetSizeArgument(argc, argv, 500000);
+    size_t maxThreads = argc > 2 ? (size_t)std::strtoull(argv[2], nullptr, 10)
+        : std::max(1u, std::thread::hardware_concurrency());
+    std::string message = Test::GenerateResponse(rows);
+
+    ResponseParser parser;
+    parser.Parse(StringView(message));
+    const ParsedResult &result = parser.GetResult(0);
+
+    ColumnarResult reference;
+    ColumnarDecoder(GetBestKernel()).Decode(result, reference);
+    Test::CheckEqual(reference.GetRowCount(), rows, "row count of the single decoder");
+
+    double baseline = 0;
+
+    for (size_t threads = 1; threads <= maxThreads; threads++) {
+        ParallelDecoder decoder(threads);
+        SegmentedResult segmented;
+        int repeats = 5;
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < repeats; i++) {
+            decoder.Decode(result, segmented);
+        }
+        double seconds = Test::Elapsed(start) / repeats;
+
+        if (threads == 1) {
+            baseline = seconds;
+        }
+
+        Test::Check(IsSame(reference, segmented), std::to_string(threads)
+            + " threads decode the rows of the single decoder, in order");
+        std::cout << threads << " threads: " << result.tuples.length / seconds / 1e9 << " GB/s, "
+            << segmented.GetSegmentCount() << " segments, speedup " << baseline / seconds << "\n";
+    }
+
+    return Test::Finish("ParallelDecoderBenchmark");
+}
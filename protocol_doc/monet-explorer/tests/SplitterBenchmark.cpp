@@ -0,0 +1,87 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/*
+    Throughput of the tuple splitter kernels, on a generated page
+    of 12 columns. Also checks that all the kernels split the page
+    the same way as the scalar one.
+
+    Usage: SplitterBenchmark [rows]
+*/
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include "../TupleSplitter.hpp"
+#include "TestUtil.hpp"
+
+using namespace MonetExplorer;
+
+
+static const size_t COLUMN_COUNT = 12;
+
+/**
+ * @brief Generate the tuple lines of a page: integers, decimals, dates,
+ * NULLs and strings, some of them with escape sequences.
+ */
+static std::string GeneratePage(size_t rows) {
+    std::string page;
+    page.reserve(rows * 140);
+
+    for (size_t i = 0; i < rows; i++) {
+        page += "[ " + std::to_string(i) + ",\t" + std::to_string(i * 7919 % 100000) + ".25,\t";
+        page += (i % 5 == 0) ? "\"line\\none\\ttab\"" : "\"name " + std::to_string(i) + "\"";
+        page += ",\t\"2020-01-" + std::to_string(10 + i % 18) + "\",\ttrue,\tNULL,\t";
+        page += std::to_string(-(int64_t)i * 31) + ",\t\"" + std::string(i % 40, 'x') + "\",\t";
+        page += std::to_string(i % 3) + ",\t\"quoted \\\"word\\\"\",\t1.5e3,\tfalse\t]\n";
+    }
+
+    return page;
+}
+
+int main(int argc, char *argv[]) {
+    size_t rows = Test::GetSizeArgument(argc, argv, 200000);
+    std::string page = GeneratePage(rows);
+
+    SplitPage reference;
+    TupleSplitter(SimdKernel::Scalar).Split(StringView(page), COLUMN_COUNT, reference);
+    Test::CheckEqual(reference.rowCount, rows, "scalar row count");
+
+    for (SimdKernel kernel : Test::GetSupportedKernels()) {
+        TupleSplitter splitter(kernel);
+        SplitPage result;
+        int repeats = 10;
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < repeats; i++) {
+            splitter.Split(StringView(page), COLUMN_COUNT, result);
+        }
+        double seconds = Test::Elapsed(start) / repeats;
+
+        bool same = result.rowCount == reference.rowCount;
+        for (size_t i = 0; same && i < result.rowCount * COLUMN_COUNT; i++) {
+            same = result.fields[i].offset == reference.fields[i].offset
+                && result.fields[i].length == reference.fields[i].length
+                && result.fields[i].escaped == reference.fields[i].escaped;
+        }
+
+        Test::Check(same, std::string(GetKernelName(kernel)) + " kernel splits like the scalar one");
+        std::cout << GetKernelName(kernel) << ": " << page.length() / seconds / 1e9 << " GB/s ("
+            << rows << " rows, " << page.length() << " bytes)\n";
+    }
+
+    return Test::Finish("SplitterBenchmark");
+}
@@ -0,0 +1,114 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "../SimdKernel.hpp"
+
+
+namespace MonetExplorer {
+    /**
+     * @brief Minimal helpers of the standalone test and benchmark
+     * programs. (See: 'make check')
+     */
+    namespace Test {
+        /**
+         * @brief The number of the failed checks of the program.
+         */
+        inline int &Failures() {
+            static int failures = 0;
+            return failures;
+        }
+
+        /**
+         * @brief Record the outcome of a check. Only the failures are printed.
+         *
+         * @param passed
+         * @param name Describes the check.
+         */
+        inline void Check(bool passed, const std::string &name) {
+            if (!passed) {
+                std::cout << "FAILED: " << name << '\n';
+                Failures()++;
+            }
+        }
+
+        /**
+         * @brief Check that two values are equal.
+         */
+        template<typename T>
+        void CheckEqual(const T &actual, const T &expected, const std::string &name) {
+            if (!(actual == expected)) {
+                std::cout << "FAILED: " << name << ": '" << actual << "' instead of '" << expected << "'\n";
+                Failures()++;
+            }
+        }
+
+        /**
+         * @brief Print the summary of the program.
+         *
+         * @param name
+         * @return int The exit code.
+         */
+        inline int Finish(const std::string &name) {
+            if (Failures() > 0) {
+                std::cout << name << ": " << Failures() << " checks failed\n";
+                return 1;
+            }
+
+            std::cout << name << ": all checks passed\n";
+            return 0;
+        }
+
+        /**
+         * @brief Get the seconds elapsed since a time.
+         */
+        inline double Elapsed(std::chrono::steady_clock::time_point since) {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+        }
+
+        /**
+         * @brief Get the kernels supported by the CPU.
+         */
+        inline std::vector<SimdKernel> GetSupportedKernels() {
+            std::vector<SimdKernel> kernels;
+
+            for (SimdKernel kernel : { SimdKernel::Scalar, SimdKernel::SSE2, SimdKernel::AVX2 }) {
+                if (IsKernelSupported(kernel)) {
+                    kernels.push_back(kernel);
+                }
+            }
+
+            return kernels;
+        }
+
+        /**
+         * @brief Get the size argument of a benchmark.
+         *
+         * @param argc
+         * @param argv
+         * @param fallback If no argument is passed.
+         */
+        inline size_t GetSizeArgument(int argc, char *argv[], size_t fallback) {
+            return argc > 1 ? (size_t)std::strtoull(argv[1], nullptr, 10) : fallback;
+        }
+    }
+}
@@ -0,0 +1,317 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/*
+    Compares the transports: streams the same large response over a
+    loopback TCP connection through the blocking SocketTransport, the
+    epoll based Reactor, and the UringTransport (if compiled in). The
+    server is a minimal MAPI server on a thread of the program.
+    Prints the throughput and the system calls per MB of each.
+
+    Usage: TransportBenchmark [response size in MB]
+*/
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include "../Connection.hpp"
+#include "../ConnectionSettings.hpp"
+#include "../Handshake.hpp"
+#include "../IoUring.hpp"
+#include "../Reactor.hpp"
+#include "../Transport.hpp"
+#include "DecoderFixture.hpp"
+#include "TestUtil.hpp"
+
+using namespace MonetExplorer;
+
+
+static const int REPEATS = 8;
+static const char *QUERY = "sSELECT * FROM t;\n";
+
+/**
+ * @brief A MAPI server, which answers every query with the same
+ * response. The connections are served one by one.
+ */
+class FakeServer {
+    private:
+        int listener = -1;
+        int port = 0;
+        std::string framedResponse;
+        std::thread thread;
+
+        /**
+         * @brief Frame a message into MAPI packets.
+         */
+        static std::string Frame(const std::string &message) {
+            static const size_t MAX_PAYLOAD = 8190;
+            std::string framed;
+            size_t position = 0;
+
+            do {
+                size_t length = std::min(MAX_PAYLOAD, message.length() - position);
+                uint16_t header = (uint16_t)((length << 1) | (position + length == message.length() ? 1 : 0));
+
+                framed.append((const char*)&header, 2);
+                framed.append(message, position, length);
+                position += length;
+            } while (position < message.length());
+
+            return framed;
+        }
+
+        static bool ReadAll(int fd, char *data, size_t length) {
+            while (length > 0) {
+                ssize_t result = read(fd, data, length);
+                if (result <= 0) {
+                    return false;
+                }
+
+                data += result;
+                length -= result;
+            }
+
+            return true;
+        }
+
+        static bool WriteAll(int fd, const std::string &data) {
+            size_t position = 0;
+
+            while (position < data.length()) {
+                ssize_t result = write(fd, data.data() + position, data.length() - position);
+                if (result <= 0) {
+                    return false;
+                }
+
+                position += result;
+            }
+
+            return true;
+        }
+
+        /**
+         * @brief Read a complete message, without its content.
+         */
+        static bool SkipMessage(int fd) {
+            uint16_t header;
+            char payload[8190];
+
+            do {
+                if (!ReadAll(fd, (char*)&header, 2) || !ReadAll(fd, payload, header >> 1)) {
+                    return false;
+                }
+            } while ((header & 1) == 0);
+
+            return true;
+        }
+
+        void Serve(int fd) {
+            if (!WriteAll(fd, Frame("abcdefgh:mserver:9:SHA1,SHA512:LIT:SHA512:\n")) || !SkipMessage(fd)
+                || !WriteAll(fd, Frame(""))) {
+
+                return;
+            }
+
+            while (SkipMessage(fd) && WriteAll(fd, this->framedResponse)) { }
+        }
+
+    public:
+        FakeServer(const std::string &response) : framedResponse(Frame(response)) {
+            struct sockaddr_in address = {};
+            socklen_t length = sizeof(address);
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+            this->listener = socket(AF_INET, SOCK_STREAM, 0);
+            if (this->listener < 0 || bind(this->listener, (struct sockaddr*)&address, sizeof(address)) != 0
+                || listen(this->listener, 4) != 0
+                || getsockname(this->listener, (struct sockaddr*)&address, &length) != 0) {
+
+                throw std::runtime_error("Failed to start the server: " + std::string(strerror(errno)));
+            }
+
+            this->port = ntohs(address.sin_port);
+
+            this->thread = std::thread([this]() {
+                int fd;
+
+                while ((fd = accept(this->listener, nullptr, nullptr)) >= 0) {
+                    int one = 1;
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                    this->Serve(fd);
+                    close(fd);
+                }
+            });
+        }
+
+        ~FakeServer() {
+            shutdown(this->listener, SHUT_RDWR);
+            this->thread.join();
+            close(this->listener);
+        }
+
+        int GetPort() const {
+            return this->port;
+        }
+};
+
+/**
+ * @brief The result of a transport.
+ */
+struct Measurement {
+    double seconds = 0;
+    uint64_t bytes = 0;
+    uint64_t systemCalls = 0;
+};
+
+static void Print(const char *name, const Measurement &measurement) {
+    double megabytes = measurement.bytes / 1e6;
+
+    std::cout << name << ": " << megabytes / measurement.seconds / 1e3 << " GB/s, "
+        << measurement.systemCalls / megabytes << " system calls per MB\n";
+}
+
+/**
+ * @brief Receive the responses on a blocking connection.
+ *
+ * @param transport
+ * @param port
+ * @param expected The length of the response.
+ * @return Measurement
+ */
+static Measurement MeasureBlocking(Transport &transport, int port, size_t expected) {
+    ConnectionSettings settings;
+    Connection connection;
+    Handshake handshake(settings);
+    std::string reply;
+    Measurement measurement;
+
+    connection.SetTransport(transport);
+    connection.ConnectTCP(settings.host, port);
+
+    while (true) {
+        HandshakeStep step = handshake.Process(connection.ReceiveMessageView(), reply);
+
+        if (step == HandshakeStep::Authenticated) {
+            break;
+        } else if (step == HandshakeStep::SendReply) {
+            connection.SendMessage(reply);
+        }
+    }
+
+    uint64_t calls = transport.GetSystemCalls();
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < REPEATS; i++) {
+        connection.SendMessage(QUERY);
+        size_t length = connection.ReceiveMessageView().length;
+
+        Test::CheckEqual(length, expected, std::string(transport.GetName()) + " response length");
+        measurement.bytes += length;
+    }
+
+    measurement.seconds = Test::Elapsed(start);
+    measurement.systemCalls = transport.GetSystemCalls() - calls;
+
+    return measurement;
+}
+
+/**
+ * @brief Receive the responses through the Reactor. The system calls
+ * are the reads, the writes and the epoll_wait calls.
+ *
+ * @param port
+ * @param expected The length of the response.
+ * @return Measurement
+ */
+static Measurement MeasureReactor(int port, size_t expected) {
+    ConnectionSettings settings;
+    settings.port = port;
+    AsyncSession session(settings);
+    Reactor reactor;
+    Measurement measurement;
+
+    reactor.Add(session);
+    reactor.Run();
+
+    if (session.GetState() != SessionState::Ready) {
+        throw std::runtime_error("The reactor session failed: " + session.GetError());
+    }
+
+    const TransferStats &stats = session.GetConnection().GetStats();
+    uint64_t calls = stats.readCalls + stats.writeCalls;
+    uint64_t waits = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < REPEATS; i++) {
+        session.Query(StringView(QUERY), [&](AsyncSession &, StringView response) {
+            Test::CheckEqual(response.length, expected, "reactor response length");
+            measurement.bytes += response.length;
+        });
+    }
+
+    while (reactor.HasActiveSessions()) {
+        reactor.RunOnce(-1);
+        waits++;
+    }
+
+    measurement.seconds = Test::Elapsed(start);
+    measurement.systemCalls = stats.readCalls + stats.writeCalls - calls + waits;
+    Test::Check(session.GetState() == SessionState::Ready, "the reactor session stays ready");
+
+    return measurement;
+}
+
+int main(int argc, char *argv[]) {
+    size_t megabytes = Test::GetSizeArgument(argc, argv, 16);
+    std::string response = Test::GenerateResponse(megabytes * 10000);     // About 100 bytes per row
+    FakeServer server(response);
+
+    std::cout << REPEATS << " responses of " << response.length() / 1e6 << " MB each\n";
+
+    SocketTransport socketTransport;
+    Print("socket", MeasureBlocking(socketTransport, server.GetPort(), response.length()));
+    Print("reactor", MeasureReactor(server.GetPort(), response.length()));
+
+#ifdef MONET_EXPLORER_IO_URING
+    std::unique_ptr<UringTransport> uring;
+
+    try {
+        uring.reset(new UringTransport());
+    } catch (const std::runtime_error &err) {
+        std::cout << "io_uring: not available (" << err.what() << ")\n";
+    }
+
+    if (uring) {
+        Print("io_uring", MeasureBlocking(*uring, server.GetPort(), response.length()));
+    }
+#else
+    std::cout << "io_uring: not compiled in\n";
+#endif
+
+    return Test::Finish("TransportBenchmark");
+}
@@ -0,0 +1,150 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/*
+    Checks the SIMD kernels of the Unescaper against the scalar reference
+    implementation on random inputs, then measures their throughput.
+
+    Usage: UnescaperTest [iterations]
+*/
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "../Unescaper.hpp"
+#include "TestUtil.hpp"
+
+using namespace MonetExplorer;
+
+
+/**
+ * @brief Generate an escaped text. The density of the escape sequences
+ * varies, so that the kernels switch between their fast and dense paths.
+ */
+static std::string GenerateInput(std::mt19937 &random, size_t length, int escapePercent) {
+    static const char *sequences[] = { "\\t", "\\n", "\\r", "\\f", "\\\"", "\\'", "\\\\", "\\101", "\\007", "\\q" };
+    std::uniform_int_distribution<int> percent(0, 99);
+    std::uniform_int_distribution<int> sequence(0, 9);
+    std::uniform_int_distribution<int> letter(' ', '~');
+    std::string input;
+
+    while (input.length() < length) {
+        if (percent(random) < escapePercent) {
+            input += sequences[sequence(random)];
+        } else {
+            char c = (char)letter(random);
+            input += c == '\\' ? 'x' : c;
+        }
+    }
+
+    if (percent(random) < 10) {
+        input += '\\';      // A trailing backslash
+    }
+
+    return input;
+}
+
+/**
+ * @brief Unescape with the scalar reference implementation.
+ */
+static std::string UnescapeReference(const std::string &input) {
+    std::vector<char> output(input.length() + 1);
+    return std::string(output.data(), Unescaper::UnescapeScalar(input.data(), input.length(), output.data()));
+}
+
+static void CheckKnownAnswers() {
+    static const char *cases[][2] = {
+        { "plain", "plain" },
+        { "a\\tb\\nc", "a\tb\nc" },
+        { "\\\"quoted\\\"", "\"quoted\"" },
+        { "back\\\\slash", "back\\slash" },
+        { "\\101\\102C", "ABC" },
+        { "\\q", "q" },
+        { "trailing\\", "trailing\\" },
+        { "", "" }
+    };
+
+    for (auto &item : cases) {
+        Test::CheckEqual(UnescapeReference(item[0]), std::string(item[1]), std::string("scalar '") + item[0] + "'");
+    }
+}
+
+static void CheckEquivalence(SimdKernel kernel, size_t iterations) {
+    Unescaper unescaper(kernel);
+    std::mt19937 random(2020);
+    std::uniform_int_distribution<size_t> length(0, 600);
+    std::uniform_int_distribution<int> density(0, 3);
+    static const int densities[] = { 0, 1, 10, 60 };
+    std::string name = GetKernelName(kernel);
+
+    for (size_t i = 0; i < iterations; i++) {
+        std::string input = GenerateInput(random, length(random), densities[density(random)]);
+        std::string expected = UnescapeReference(input);
+
+        std::vector<char> output(input.length() + 1);
+        size_t result = unescaper.Unescape(input.data(), input.length(), output.data());
+
+        if (std::string(output.data(), result) != expected) {
+            Test::Check(false, name + " kernel differs from the scalar one on: " + input);
+            return;
+        }
+
+        std::string inPlace = input;
+        result = unescaper.UnescapeInPlace(&inPlace[0], inPlace.length());
+
+        if (inPlace.substr(0, result) != expected) {
+            Test::Check(false, name + " kernel differs in place on: " + input);
+            return;
+        }
+    }
+}
+
+static void MeasureThroughput(SimdKernel kernel, int escapePercent) {
+    Unescaper unescaper(kernel);
+    std::mt19937 random(1);
+    std::string input = GenerateInput(random, 64 * 1024 * 1024, escapePercent);
+    std::vector<char> output(input.length());
+    int repeats = 5;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repeats; i++) {
+        unescaper.Unescape(input.data(), input.length(), output.data());
+    }
+    double seconds = Test::Elapsed(start) / repeats;
+
+    std::cout << GetKernelName(kernel) << " (" << escapePercent << "% escapes): "
+        << input.length() / seconds / 1e9 << " GB/s\n";
+}
+
+int main(int argc, char *argv[]) {
+    size_t iterations = Test::GetSizeArgument(argc, argv, 20000);
+
+    CheckKnownAnswers();
+
+    for (SimdKernel kernel : Test::GetSupportedKernels()) {
+        CheckEquivalence(kernel, iterations);
+    }
+
+    for (int escapePercent : { 0, 1, 20 }) {
+        for (SimdKernel kernel : Test::GetSupportedKernels()) {
+            MeasureThroughput(kernel, escapePercent);
+        }
+    }
+
+    return Test::Finish("UnescaperTest");
+}
@@ -0,0 +1,307 @@
+/*
+    Copyright 2020 Tamas Bolner
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+/*
+    Checks the value parsers and the columnar decoder on the extremes of
+    the numeric types, NULLs and escaped strings. The values are the ones
+    of the PHP tests. (tests/int64Test.php, int128Test.php, dec38Test.php)
+*/
+
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include "../ColumnarDecoder.hpp"
+#include "../ParsePlan.hpp"
+#include "../ResponseParser.hpp"
+#include "../ValueParser.hpp"
+#include "TestUtil.hpp"
+
+using namespace MonetExplorer;
+
+
+static void CheckInt64() {
+    static const char *valid[][2] = {
+        { "1234567890987654321", "1234567890987654321" },
+        { "9223372036854775807", "9223372036854775807" },
+        { "-9223372036854775808", "-9223372036854775808" },
+        { "+42", "42" },
+        { "0", "0" }
+    };
+
+    for (auto &item : valid) {
+        int64_t value = 0;
+        Test::Check(ValueParser::ParseInt64(StringView(item[0]), value), std::string("int64 parses ") + item[0]);
+        Test::CheckEqual(std::to_string(value), std::string(item[1]), std::string("int64 ") + item[0]);
+    }
+
+    for (const char *text : { "9223372036854775808", "-9223372036854775809", "12a", "-", "" }) {
+        int64_t value = 0;
+        Test::Check(!ValueParser::ParseInt64(StringView(text), value), std::string("int64 rejects '") + text + "'");
+    }
+}
+
+static void CheckInt128() {
+    static const char *valid[] = {
+        "12345678901234567899876543210987654321",
+        "170141183460469231731687303715884105727",
+        "-170141183460469231731687303715884105728",
+        "-1",
+        "0"
+    };
+
+    for (const char *text : valid) {
+        HugeInt value = 0;
+        Test::Check(ValueParser::ParseHugeInt(StringView(text), value), std::string("int128 parses ") + text);
+        Test::CheckEqual(ValueParser::FormatHugeInt(value), std::string(text), "int128 round trip");
+    }
+
+    for (const char *text : { "170141183460469231731687303715884105728", "-170141183460469231731687303715884105729",
+        "1e10", "" }) {
+
+        HugeInt value = 0;
+        Test::Check(!ValueParser::ParseHugeInt(StringView(text), value), std::string("int128 rejects '") + text + "'");
+    }
+}
+
+static void CheckDecimal() {
+    // The text, the scale of the column, the formatted value
+    static const char *cases[][3] = {
+        { "12345678901234567899876543210987654321", "0", "12345678901234567899876543210987654321" },
+        { "1234567890123456789.9876543210987654321", "19", "1234567890123456789.9876543210987654321" },
+        { ".12345678901234567899876543210987654321", "38", "0.12345678901234567899876543210987654321" },
+        { "-.12345678901234567899876543210987654321", "38", "-0.12345678901234567899876543210987654321" },
+        { "123456789987654321", "0", "123456789987654321" },
+        { "123456789.987654321", "9", "123456789.987654321" },
+        { "12.5", "3", "12.500" },
+        { "7", "2", "7.00" }
+    };
+
+    for (auto &item : cases) {
+        int scale = std::stoi(item[1]);
+        HugeInt value = 0;
+
+        Test::Check(ValueParser::ParseDecimal(StringView(item[0]), scale, value),
+            std::string("decimal parses ") + item[0]);
+        Test::CheckEqual(ValueParser::FormatDecimal(value, scale), std::string(item[2]),
+            std::string("decimal ") + item[0]);
+    }
+
+    // More fractional digits than the scale
+    int scale = 2;
+    HugeInt value = 0;
+    Test::Check(!ValueParser::ParseDecimal(StringView("1.234"), scale, value), "decimal rejects a longer fraction");
+}
+
+/**
+ * @brief Decode a result of every numeric type with extremes, NULLs
+ * and escaped strings, through both of the dispatch modes.
+ */
+static void CheckColumnarDecoder(DecoderDispatch dispatch) {
+    std::string name = dispatch == DecoderDispatch::PerField ? "per-field" : "per-column";
+    std::string message =
+        "&1 0 3 7 3 1 10 5 5\n"
+        "% sys.t,\tsys.t,\tsys.t,\tsys.t,\tsys.t,\tsys.t,\tsys.t # table_name\n"
+        "% i64,\ti128,\td0,\td19,\td38,\ts,\to # name\n"
+        "% bigint,\thugeint,\tdecimal,\tdecimal,\tdecimal,\tvarchar,\toid # type\n"
+        "% 20,\t40,\t40,\t40,\t40,\t20,\t5 # length\n"
+        "% 64 0,\t128 0,\t38 0,\t38 19,\t38 38,\t0 0,\t63 0 # typesizes\n"
+        "[ 9223372036854775807,\t170141183460469231731687303715884105727,\t"
+            "12345678901234567899876543210987654321,\t1234567890123456789.9876543210987654321,\t"
+            "0.12345678901234567899876543210987654321,\t\"tab\\there \\\"quoted\\\"\",\t1@0\t]\n"
+        "[ -9223372036854775808,\t-170141183460469231731687303715884105728,\t"
+            "-12345678901234567899876543210987654321,\t-1.5,\t"
+            "-.5,\t\"back\\\\slash\\nnew line \\101\",\t123456@0\t]\n"
+        "[ NULL,\tNULL,\tNULL,\tNULL,\tNULL,\tNULL,\tNULL\t]\n";
+
+    ResponseParser parser;
+    parser.Parse(StringView(message));
+
+    ColumnarResult output;
+    ColumnarDecoder decoder(SimdKernel::Scalar, dispatch);
+    decoder.Decode(parser.GetResult(0), output);
+
+    Test::CheckEqual(output.GetRowCount(), (size_t)3, name + " row count");
+
+    Span<int64_t> i64 = output.GetColumn(0).GetValues<int64_t>();
+    Test::CheckEqual(i64[0], INT64_MAX, name + " int64 max");
+    Test::CheckEqual(i64[1], INT64_MIN, name + " int64 min");
+
+    Span<HugeInt> i128 = output.GetColumn(1).GetValues<HugeInt>();
+    Test::CheckEqual(ValueParser::FormatHugeInt(i128[0]), std::string("170141183460469231731687303715884105727"),
+        name + " int128 max");
+    Test::CheckEqual(ValueParser::FormatHugeInt(i128[1]), std::string("-170141183460469231731687303715884105728"),
+        name + " int128 min");
+
+    static const char *decimals[][2] = {
+        { "12345678901234567899876543210987654321", "-12345678901234567899876543210987654321" },
+        { "1234567890123456789.9876543210987654321", "-1.5000000000000000000" },
+        { "0.12345678901234567899876543210987654321", "-0.50000000000000000000000000000000000000" }
+    };
+
+    for (size_t i = 0; i < 3; i++) {
+        const Column &column = output.GetColumn(2 + i);
+        Span<HugeInt> values = column.GetValues<HugeInt>();
+
+        for (size_t row = 0; row < 2; row++) {
+            Test::CheckEqual(ValueParser::FormatDecimal(values[row], column.GetScale()), std::string(decimals[i][row]),
+                name + " " + column.GetName() + " row " + std::to_string(row));
+        }
+    }
+
+    const Column &strings = output.GetColumn(5);
+    Test::CheckEqual(strings.GetString(0).ToString(), std::string("tab\there \"quoted\""), name + " escaped string");
+    Test::CheckEqual(strings.GetString(1).ToString(), std::string("back\\slash\nnew line A"), name + " escaped string");
+
+    Span<int64_t> oids = output.GetColumn(6).GetValues<int64_t>();
+    Test::CheckEqual(oids[0], (int64_t)1, name + " oid");
+    Test::CheckEqual(oids[1], (int64_t)123456, name + " oid");
+
+    for (size_t i = 0; i < output.GetColumnCount(); i++) {
+        const Column &column = output.GetColumn(i);
+
+        Test::Check(!column.IsNull(0) && !column.IsNull(1) && column.IsNull(2), name + " NULLs of " + column.GetName());
+        Test::CheckEqual(column.GetNullCount(), (size_t)1, name + " NULL count of " + column.GetName());
+    }
+}
+
+/**
+ * @brief Decode a DECIMAL(38,30) column with range conditions. Rescaling
+ * the values or the bounds to the same scale would overflow.
+ *
+ * @param condition See: ParsePlan::Where()
+ * @return size_t The number of the matching rows.
+ */
+static size_t CountMatches(const std::string &condition) {
+    std::string message =
+        "&1 0 4 1 4 1 10 5 5\n"
+        "% sys.t # table_name\n"
+        "% d # name\n"
+        "% decimal # type\n"
+        "% 40 # length\n"
+        "% 38 30 # typesizes\n"
+        "[ 99999999.999999999999999999999999999999\t]\n"
+        "[ -99999999.999999999999999999999999999999\t]\n"
+        "[ 0.500000000000000000000000000000\t]\n"
+        "[ 1.000000000000000000000000000001\t]\n";
+
+    ResponseParser parser;
+    parser.Parse(StringView(message));
+
+    ParsePlan plan;
+    plan.Where(condition);
+
+    ColumnarResult output;
+    ColumnarDecoder decoder;
+    decoder.Begin(parser.GetResult(0), output, plan);
+    decoder.Append(parser.GetResult(0).tuples, output);
+
+    return output.GetRowCount();
+}
+
+static void CheckDecimalBounds() {
+    Test::CheckEqual(CountMatches("d=..1000000000"), (size_t)4, "DECIMAL(38,30) <= 1000000000");
+    Test::CheckEqual(CountMatches("d=-1000000000.."), (size_t)4, "DECIMAL(38,30) >= -1000000000");
+    Test::CheckEqual(CountMatches("d=100000000.."), (size_t)0, "DECIMAL(38,30) >= 100000000");
+    Test::CheckEqual(CountMatches("d=9999999.9999999999999999999999999999991.."), (size_t)1,
+        "DECIMAL(38,30) >= a bound of scale 31");
+    Test::CheckEqual(CountMatches("d=0.6..1.0000000000000000000000000000011"), (size_t)1,
+        "DECIMAL(38,30) in a range of scale 31");
+    Test::CheckEqual(CountMatches("d=-0.1..0.5"), (size_t)1, "DECIMAL(38,30) in a range around 0");
+
+    // 39 fractional digits, and 40 digits
+    for (const char *condition : { "d=0.123456789012345678901234567890123456789",
+        "d=1000000000000000000000000000000000000000" }) {
+
+        bool rejected = false;
+
+        try {
+            CountMatches(condition);
+        } catch (const std::runtime_error &) {
+            rejected = true;
+        }
+
+        Test::Check(rejected, std::string("unrepresentable bound is rejected: ") + condition);
+    }
+}
+
+/**
+ * @brief The first page of a large result: the memory is reserved
+ * for the tuples of the message, not for the whole result.
+ */
+static void CheckReservation() {
+    std::string message =
+        "&1 0 1000000000 2 100 1 10 5 5\n"
+        "% sys.t,\tsys.t # table_name\n"
+        "% id,\ts # name\n"
+        "% bigint,\tvarchar # type\n"
+        "% 20,\t1 # length\n";
+
+    for (int i = 0; i < 100; i++) {
+        message += "[ " + std::to_string(i) + ",\t\"v\"\t]\n";
+    }
+
+    ResponseParser parser;
+    parser.Parse(StringView(message));
+
+    ColumnarResult output;
+    ColumnarDecoder decoder;
+    decoder.Decode(parser.GetResult(0), output);
+
+    Test::CheckEqual(output.GetRowCount(), (size_t)100, "row count of the first page");
+    Test::Check(output.GetMemoryUsage() < 100000, "the first page of 1e9 rows reserves memory for its tuples only");
+}
+
+/**
+ * @brief The header and tuple lines without the ",\t" separators are rejected.
+ */
+static void CheckBrokenLines() {
+    static const char *messages[] = {
+        "&1 0 1 2 1 1 10 5 5\n% \tx # name\n",
+        "&1 0 1 2 1 1 10 5 5\n% a\tb # name\n",
+        "&1 0 1 2 1 1 10 5 5\n% a,\tb # name\n% int,\tint # type\n[ \t1\t]\n"
+    };
+
+    for (const char *message : messages) {
+        bool rejected = false;
+
+        try {
+            ResponseParser parser;
+            parser.Parse(StringView(message));
+
+            ColumnarResult output;
+            ColumnarDecoder decoder;
+            decoder.Decode(parser.GetResult(0), output);
+        } catch (const std::runtime_error &) {
+            rejected = true;
+        }
+
+        Test::Check(rejected, std::string("broken line is rejected: ") + message);
+    }
+}
+
+int main() {
+    CheckInt64();
+    CheckInt128();
+    CheckDecimal();
+    CheckColumnarDecoder(DecoderDispatch::PerField);
+    CheckColumnarDecoder(DecoderDispatch::PerColumn);
+    CheckDecimalBounds();
+    CheckReservation();
+    CheckBrokenLines();
+
+    return Test::Finish("ValueParserTest");
+}